@@ -0,0 +1,328 @@
+/*
+ *  GWUpdate Bench
+ *  Plays an SVF or XSVF file through the GWUpdate host on a chosen JTAG
+ *  backend and reports bits/sec. On the "sim" backend the figures are in
+ *  virtual time and repeat exactly from run to run. With -c the file is
+ *  first compiled to an op-stream, as Packager does, and that is played.
+ *  With -z the file is block-compressed and decoded while it plays.
+ *  With -v only some of the TDO-checked scans are compared (gwu_verify.h).
+ *  A dry pass, as Packager does, measures the memory the players need,
+ *  which is reserved up front, and predicts the play time under the
+ *  latency model given with -l (gwu_profile.h).
+ *  With -r the file is only parsed, the given number of rounds, against
+ *  the dry host (gwu_dry.h), and the parser's throughput is reported.
+ *  With -s the file, of any kind, is only copied and padded to 128k the
+ *  way Packager does, the given number of rounds, through streamtools
+ *  and through a byte loop, and both throughputs are reported.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "../libxsvf.h"
+#include "../jtag.h"
+#include "../gwu_host.h"
+#include "../gwu_time.h"
+#include "../opscomp.h"
+#include "../gwu_lz.h"
+#include "../gwu_image.h"
+#include "../gwu_verify.h"
+#include "../gwu_profile.h"
+#include "../gwu_dry.h"
+#include "../streamtools.h"
+
+static gwu_session_t session;
+static lz_reader_t lz;
+static gwu_image_t image;
+static gwu_verify_t verify;
+
+/* Parse-only timing */
+
+// Parses input rounds times and returns MB/s, or a negative value if it
+// fails. With borrow the input is lent out with getspan() and copied
+// with getbytes(), without it read a byte at a time.
+static double time_parser(gwu_span_t input, enum libxsvf_mode mode, int rounds, int borrow) {
+	gwu_dry_t d;
+	LONGLONG start = GetTicksNow();
+	for (int i = 0; i < rounds; i++) {
+		gwu_dry_init(&d, input, NULL, NULL);
+		d.lend = borrow;
+		d.report_errors = 1;
+		if (!borrow) { d.h.getbytes = NULL; }
+		if (gwu_dry_play(&d, mode) < 0) { return -1.0; }
+	}
+	double secs = (double)(GetTicksNow() - start) / ticks_per_ms / 1000.0;
+	return (double)input.len * rounds / 1000000.0 / (secs > 0.0 ? secs : 1e-9);
+}
+
+/* Copy timing */
+
+#define LEN128K (128 * 1024)
+
+// How streamtools copied and padded before it moved blocks
+static int copy_bytewise(FILE* to, FILE* from) {
+	while (1) {
+		int c = fgetc(from);
+		if (ferror(from)) { return -1; }
+		if (c == EOF) { break; }
+		fputc(c, to);
+		if (ferror(to)) { return -1; }
+	}
+	while (ftell(to) % LEN128K) {
+		fputc(0, to);
+		if (ferror(to)) { return -1; }
+	}
+	return 0;
+}
+
+static int copy_streamtools(FILE* to, FILE* from) {
+	return file_writeall(to, from) || file_pad128k(to) ? -1 : 0;
+}
+
+// Copies the file rounds times into temporary files and returns MB/s,
+// or a negative value if it fails
+static double time_copy(const char* filename, size_t len, int rounds, int (*copy)(FILE*, FILE*)) {
+	size_t padded = (len + LEN128K - 1) / LEN128K * LEN128K;
+	LONGLONG start = GetTicksNow();
+	for (int i = 0; i < rounds; i++) {
+		FILE* from = fopen(filename, "rb");
+		FILE* to = tmpfile();
+		if (!from || !to) { return -1.0; }
+		int failed = copy(to, from) || fflush(to) || fseek(to, 0L, SEEK_END) || (size_t)ftell(to) != padded;
+		fclose(from);
+		fclose(to);
+		if (failed) { return -1.0; }
+	}
+	double secs = (double)(GetTicksNow() - start) / ticks_per_ms / 1000.0;
+	return (double)len * rounds / 1000000.0 / (secs > 0.0 ? secs : 1e-9);
+}
+
+int main(int argc, char** argv)
+{
+	const jtag_backend_t* backend = &jtag_sim_backend;
+	const char* portname = NULL;
+	const char* filename = NULL;
+	lz_reader_t* getbyte_lz = NULL;
+	const char* options[16];
+	int num_options = 0;
+	const char* timing = NULL;
+	int pipeline = 0;
+	int compile = 0;
+	int compress = 0;
+	int parse_rounds = 0;
+	int copy_rounds = 0;
+	gwu_latency_t latency = gwu_latency_default;
+	gwu_verify_parse(&verify, "full");
+
+	// Parse arguments
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			backend = jtag_find_backend(argv[++i]);
+			if (!backend) {
+				fprintf(stderr, "Error! Unknown JTAG backend \"%s\". Available backends:\n", argv[i]);
+				jtag_list_backends(stderr);
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc) { portname = argv[++i]; }
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc) { timing = argv[++i]; }
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc) { SetWaitSpin(atol(argv[++i])); }
+		else if (!strcmp(argv[i], "-P")) { pipeline = 1; }
+		else if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+			if (gwu_verify_parse(&verify, argv[++i])) {
+				fprintf(stderr, "Error! Unknown verify policy \"%s\".\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+			if (gwu_latency_parse(&latency, argv[++i])) {
+				fprintf(stderr, "Error! Invalid latency model \"%s\".\n", argv[i]);
+				return -1;
+			}
+		}
+		else if (!strcmp(argv[i], "-c")) { compile = 1; }
+		else if (!strcmp(argv[i], "-z")) { compress = 1; }
+		else if (!strcmp(argv[i], "-r") && i + 1 < argc) { parse_rounds = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "-s") && i + 1 < argc) { copy_rounds = atoi(argv[++i]); }
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc && num_options < 16) {
+			options[num_options++] = argv[++i];
+		}
+		else if (!filename && argv[i][0] != '-') { filename = argv[i]; }
+		else { filename = NULL; break; }
+	}
+	if (!filename || ((backend->flags & JTAG_NEEDS_PORT) && !portname)) {
+		fputs("Usage: Bench [-b <BACKEND>] [-p <PORT>] [-t fixed|baud|drain] [-w <SPIN_US>] [-P] [-v full|sampled[:N[:SEED]]|deferred] [-o <KEY>=<VALUE>]... [-l line=NS,run=NS,clock=NS,sample=NS] [-c] [-z] [-r <ROUNDS>] [-s <ROUNDS>] <FILE.SVF|FILE.XSVF>\n", stderr);
+		return -1;
+	}
+
+	// Pick player mode from the file extension
+	enum libxsvf_mode mode = LIBXSVF_MODE_SVF;
+	size_t len = strlen(filename);
+	if (len >= 5 && (!strcmp(filename + len - 5, ".xsvf") || !strcmp(filename + len - 5, ".XSVF"))) {
+		mode = LIBXSVF_MODE_XSVF;
+	}
+
+	// Map input file
+	if (image_open(&image, filename)) {
+		fputs("Error! Couldn't open input file.\n", stderr);
+		return -1;
+	}
+	gwu_span_t input = image.all;
+
+	// Optionally time only copying the file
+	if (copy_rounds > 0) {
+		SetupTicks();
+		double bytes = time_copy(filename, input.len, copy_rounds, copy_bytewise);
+		double blocks = time_copy(filename, input.len, copy_rounds, copy_streamtools);
+		if (bytes < 0.0 || blocks < 0.0) {
+			fputs("Error! Couldn't copy input file.\n", stderr);
+			return -1;
+		}
+		fprintf(stderr, "Copy: %lu bytes, %d rounds\n", (unsigned long)input.len, copy_rounds);
+		fprintf(stderr, "  %-14s %10.1lf MB/s\n", "Byte loop", bytes);
+		fprintf(stderr, "  %-14s %10.1lf MB/s\n", "Streamtools", blocks);
+		image_close(&image);
+		return 0;
+	}
+
+	// Optionally replace the input with its compiled op-stream
+	unsigned char* ops = NULL;
+	if (compile) {
+		size_t ops_length;
+		int compiled = ops_compile(input, mode, &ops, &ops_length);
+		if (compiled != OPS_COMPILE_OK) {
+			fputs(compiled == OPS_COMPILE_UNSUPPORTED ?
+				"Error! File uses XSVF retries and cannot be compiled.\n" :
+				"Error! Could not compile input file.\n", stderr);
+			return -1;
+		}
+		fprintf(stderr, "Compiled to op-stream of %lu bytes.\n", (unsigned long)ops_length);
+		input.p = ops;
+		input.len = ops_length;
+		mode = LIBXSVF_MODE_OPS;
+	}
+
+	// Optionally time only the parser, reading in place and a byte at a time
+	if (parse_rounds > 0) {
+		SetupTicks();
+		double borrowed = time_parser(input, mode, parse_rounds, 1);
+		double bytes = time_parser(input, mode, parse_rounds, 0);
+		if (borrowed < 0.0 || bytes < 0.0) {
+			fprintf(stderr, "%s: FAILED\n", filename);
+			return -1;
+		}
+		fprintf(stderr, "Parser: %lu bytes, %d rounds\n", (unsigned long)input.len, parse_rounds);
+		fprintf(stderr, "  %-14s %10.1lf MB/s\n", "In place", borrowed);
+		fprintf(stderr, "  %-14s %10.1lf MB/s\n", "Byte reads", bytes);
+		free(ops);
+		image_close(&image);
+		return 0;
+	}
+
+	// Measure what playing needs and takes, before compressing
+	gwu_profile_t profile;
+	if (gwu_profile_measure(&profile, input, mode)) {
+		fprintf(stderr, "%s: FAILED\n", filename);
+		return -1;
+	}
+	gwu_profile_print(&profile, &latency, stderr);
+
+	// Optionally compress the input and decode it while playing
+	unsigned char* packed = NULL;
+	if (compress) {
+		FILE* z = tmpfile();
+		uint32_t length;
+		if (!z || lz_compress(z, input, &length)) {
+			fputs("Error! Couldn't compress input file.\n", stderr);
+			return -1;
+		}
+		fprintf(stderr, "Compressed to %lu bytes.\n", (unsigned long)length);
+		packed = malloc(length ? length : 1);
+		rewind(z);
+		if (!packed || fread(packed, 1, length, z) != length) {
+			fputs("Error! Couldn't read back compressed input.\n", stderr);
+			return -1;
+		}
+		fclose(z);
+		input.p = packed;
+		input.len = length;
+		lz_reader_open(&lz, input);
+		getbyte_lz = &lz;
+	}
+
+	// Plan which TDO-checked scans to compare
+	int planned = gwu_verify_plan(&verify, mode, input, compress);
+	if (planned == GWU_VERIFY_PLAN_ERROR) {
+		fputs("Error! Could not plan verification of input file.\n", stderr);
+		return -1;
+	}
+	else if (planned == GWU_VERIFY_PLAN_FULL) {
+		fputs("Deferred verify is not possible for this file, verifying in full.\n", stderr);
+	}
+	if (verify.program) {
+		input.p = verify.program;
+		input.len = verify.program_len;
+		getbyte_lz = NULL;
+	}
+
+	// Create JTAG connection on the chosen backend
+	jtag_t* jtag = jtag_new(backend, portname);
+	if (!jtag) {
+		fputs("Error! Could not allocate JTAG backend.\n", stderr);
+		return -1;
+	}
+	for (int i = 0; i < num_options; i++) {
+		if (jtag_configure(jtag, options[i])) {
+			fprintf(stderr, "Error! Backend \"%s\" does not accept option \"%s\".\n",
+				backend->name, options[i]);
+			return -1;
+		}
+	}
+	if (timing && jtag_set_timing(jtag, timing)) {
+		fprintf(stderr, "Error! Backend \"%s\" does not support timing profile \"%s\".\n",
+			backend->name, timing);
+		return -1;
+	}
+	if (pipeline && jtag_set_pipeline(jtag, 1)) {
+		fputs("Error! Could not allocate JTAG pipeline.\n", stderr);
+		return -1;
+	}
+
+	// Play the file without progress lines
+	gwu_session_init(&session, jtag, NULL);
+	if (gwu_session_reserve(&session, &profile.marks)) {
+		fputs("Error! Could not reserve memory for playing.\n", stderr);
+		return -1;
+	}
+	session.show_progress = 0;
+	session.cur_mode = mode;
+	session.getbyte_span = input;
+	session.getbyte_lz = getbyte_lz;
+	session.verify = &verify;
+	SetupTicks();
+	gwu_session_start(&session);
+	LONGLONG host_start = GetTicksNow();
+	int play_result = libxsvf_play(&session.h, mode);
+	if (play_result >= 0 && verify.pass) {
+		session.getbyte_span.p = verify.pass;
+		session.getbyte_span.len = verify.pass_len;
+		session.getbyte_lz = NULL;
+		session.cur_mode = LIBXSVF_MODE_OPS;
+		gwu_verify_start_pass(&verify);
+		play_result = libxsvf_play(&session.h, LIBXSVF_MODE_OPS);
+	}
+	LONGLONG host_end = GetTicksNow();
+	gwu_session_stop(&session);
+	printinfo(&session);
+	fprintf(stderr, "Host time: %lf sec.\n", (double)(host_end - host_start) / ticks_per_ms / 1000.0f);
+	fprintf(stderr, "%s: %s\n", filename, play_result < 0 ? "FAILED" : "PASSED");
+
+	free(packed);
+	free(ops);
+	image_close(&image);
+	gwu_session_free(&session);
+	gwu_verify_free(&verify);
+	jtag_free(jtag);
+	return play_result < 0 ? -1 : 0;
+}
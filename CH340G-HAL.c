@@ -0,0 +1,687 @@
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#endif
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+
+#include "CH340G-HAL.h"
+#include "jtag_timing.h"
+#include "jtag_wave.h"
+#include "gwu_time.h"
+
+// A TCK write in flight. Writes complete in the order they were queued.
+typedef struct ch340_write_s {
+#ifdef _WIN32
+	OVERLAPPED ov;
+#endif
+	int len;
+	int done; // Characters the driver has taken so far
+	LONGLONG issued;
+	char tckbuf[TCKBUF_SIZ];
+} ch340_write_t;
+
+typedef struct ch340_s {
+#ifdef _WIN32
+	HANDLE port;
+#else
+	int port;
+#endif
+	int profile; // JTAG_TIMING_* asked for, or default
+	LONGLONG overhead; // Measured or configured write latency, 0 until known
+	char frame[8]; // Frame format asked for, or empty to pick the fastest
+	long min_pulse_ns; // Shortest TCK high or low the target takes
+	jtag_wave_t wave;
+	jtag_timing_t timing;
+
+	// Queue of writes, oldest at write_head
+	ch340_write_t writes[CH340_WRITES];
+	int write_head;
+	int write_num;
+	int drained_chars; // Drain profile: retired since the last drain
+
+	long queued_writes;
+	int max_writes;
+	long write_waits;
+	LONGLONG write_wait_ticks;
+} ch340_t;
+
+#define CH340(_j) ((ch340_t*)(_j)->priv)
+
+// Characters the CH340 may still hold in its transmit FIFO after the
+// OS reports its own output queue empty.
+#define CH340_TXFIFO_SIZ (32)
+
+// After the port opens or its break changes, the modem lines have
+// settled once they read the same for LINES_STABLE_MS, but no sooner than
+// LINES_MIN_MS and no later than LINES_MAX_MS (the fixed wait this used
+// to be)
+#define LINES_MIN_MS (2)
+#define LINES_STABLE_MS (3)
+#define LINES_MAX_MS (100)
+
+// How long to keep retrying a port that is still being let go of, for
+// an adapter reopened right after it was closed
+#define OPEN_RETRY_MS (500)
+
+static void io_timing_init(jtag_t* j) {
+	ch340_t* c = CH340(j);
+	jtag_timing_init(&c->timing, BAUD_RATE, CH340_TXFIFO_SIZ, ticks_per_ms / 1000.0);
+	c->timing.char_time = (LONGLONG)jtag_wave_char_time(&c->wave, BAUD_RATE, ticks_per_ms / 1000.0);
+}
+
+static void io_setgate(jtag_t* j) {
+	jtag_timing_line(&CH340(j)->timing, GetTicksNow());
+}
+
+static void io_flush(jtag_t* j);
+
+// Reports an adapter error, once, and fails the connection rather than
+// quitting, so that with several boards only this one's play fails
+static void io_fail(jtag_t* j, const char* message)
+{
+	if (!jtag_failed(j)) { fprintf(stderr, message, j->portname); }
+	jtag_fail(j);
+}
+
+#ifdef _WIN32
+static void io_tms(jtag_t* j, int val)
+{
+	io_flush(j);
+	if (!EscapeCommFunction(CH340(j)->port, val ? CLRRTS : SETRTS)) {
+		io_fail(j, "Error setting TMS on %s!\n");
+	}
+	io_setgate(j);
+}
+
+static void io_tdi(jtag_t* j, int val)
+{
+	io_flush(j);
+	if (!EscapeCommFunction(CH340(j)->port, val ? CLRDTR : SETDTR)) {
+		io_fail(j, "Error setting TDI on %s!\n");
+	}
+	io_setgate(j);
+}
+
+// Hands a write to the driver, which completes it in the background
+static void io_start(jtag_t* j, ch340_write_t* w)
+{
+	w->ov.Offset = 0;
+	w->ov.OffsetHigh = 0;
+	if (!WriteFile(CH340(j)->port, w->tckbuf, w->len, NULL, &w->ov) &&
+		GetLastError() != ERROR_IO_PENDING) {
+		io_fail(j, "Error pulsing TCK on %s!\n");
+		w->done = w->len; // Never started, so there is nothing to wait for
+	}
+}
+
+// Returns 1 once the driver has taken all of w, waiting for it if asked.
+// Writes have no timeout, so one that completes was taken whole.
+static int io_reap(jtag_t* j, ch340_write_t* w, int wait)
+{
+	if (w->done == w->len) { return 1; }
+	DWORD written = 0;
+	if (!GetOverlappedResult(CH340(j)->port, &w->ov, &written, wait) &&
+		!wait && GetLastError() == ERROR_IO_INCOMPLETE) {
+		return 0;
+	}
+	if (written != (DWORD)w->len) {
+		io_fail(j, "Error pulsing TCK on %s!\n");
+	}
+	w->done = w->len;
+	return 1;
+}
+
+// Blocks until the driver has handed every character to the adapter
+static void io_wait_idle(jtag_t* j)
+{
+	if (!FlushFileBuffers(CH340(j)->port)) {
+		io_fail(j, "Error pulsing TCK on %s!\n");
+	}
+}
+
+static int io_status(jtag_t* j)
+{
+	DWORD status = 0;
+	io_flush(j);
+	if (!GetCommModemStatus(CH340(j)->port, &status)) {
+		io_fail(j, "Error reading modem status from %s!\n");
+	}
+	return status;
+}
+
+#define STATUS_CTS MS_CTS_ON
+#define STATUS_DSR MS_DSR_ON
+#define STATUS_RI MS_RING_ON
+#define STATUS_DCD MS_RLSD_ON
+#else
+static void io_modem(jtag_t* j, int val, int line, const char* message)
+{
+	io_flush(j);
+	if (ioctl(CH340(j)->port, val ? TIOCMBIC : TIOCMBIS, &line)) { io_fail(j, message); }
+	io_setgate(j);
+}
+
+static void io_tms(jtag_t* j, int val) { io_modem(j, val, TIOCM_RTS, "Error setting TMS on %s!\n"); }
+
+static void io_tdi(jtag_t* j, int val) { io_modem(j, val, TIOCM_DTR, "Error setting TDI on %s!\n"); }
+
+// Blocks until the driver has handed every character to the adapter
+static void io_wait_idle(jtag_t* j)
+{
+	int queued;
+	if (tcdrain(CH340(j)->port)) { goto error; }
+	// Some USB serial drivers return from tcdrain() before their last URB
+	// has completed, so also wait for the output queue to read empty,
+	// sleeping for as long as what it still holds takes to send
+	for (;;) {
+		if (ioctl(CH340(j)->port, TIOCOUTQ, &queued)) { goto error; }
+		if (queued <= 0) { break; }
+		WaitTicks(GetTicksNow() + queued * CH340(j)->timing.char_time);
+	}
+	return;
+
+error:
+	io_fail(j, "Error pulsing TCK on %s!\n");
+}
+
+// Gives the driver as much of the queued writes, in order, as it takes
+// without blocking. The port is non-blocking, so this returns once the
+// driver's buffer is full. Once the connection has failed the writes
+// are dropped, so that waits for them end.
+static void io_pump(jtag_t* j)
+{
+	ch340_t* c = CH340(j);
+	for (int i = 0; i < c->write_num; i++) {
+		ch340_write_t* w = &c->writes[(c->write_head + i) % CH340_WRITES];
+		while (w->done < w->len) {
+			if (jtag_failed(j)) {
+				w->done = w->len;
+				break;
+			}
+			ssize_t written = write(c->port, w->tckbuf + w->done, w->len - w->done);
+			if (written < 0) {
+				if (errno == EINTR) { continue; }
+				if (errno == EAGAIN || errno == EWOULDBLOCK) { return; }
+				io_fail(j, "Error pulsing TCK on %s!\n");
+				continue;
+			}
+			w->done += (int)written;
+		}
+	}
+}
+
+// w is the newest queued write. The writes before it must reach the
+// port first, so pump them all in order.
+static void io_start(jtag_t* j, ch340_write_t* w)
+{
+	(void)w;
+	io_pump(j);
+}
+
+// Returns 1 once the driver has taken all of w, waiting for it if asked
+static int io_reap(jtag_t* j, ch340_write_t* w, int wait)
+{
+	io_pump(j);
+	while (w->done < w->len) {
+		if (!wait) { return 0; }
+		struct pollfd pfd = { CH340(j)->port, POLLOUT, 0 };
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR) {
+			io_fail(j, "Error pulsing TCK on %s!\n");
+		}
+		io_pump(j);
+	}
+	return 1;
+}
+
+static int io_status(jtag_t* j)
+{
+	int status = 0;
+	io_flush(j);
+	if (ioctl(CH340(j)->port, TIOCMGET, &status)) {
+		io_fail(j, "Error reading modem status from %s!\n");
+	}
+	return status;
+}
+
+#define STATUS_CTS TIOCM_CTS
+#define STATUS_DSR TIOCM_DSR
+#define STATUS_RI TIOCM_RI
+#define STATUS_DCD TIOCM_CAR
+#endif
+
+// Polls the modem status until it stops changing
+static void io_wait_lines(jtag_t* j)
+{
+	LONGLONG start = GetTicksNow();
+	LONGLONG changed = start;
+	int last = io_status(j);
+	while (!jtag_failed(j)) {
+		Sleep(1);
+		LONGLONG now = GetTicksNow();
+		int status = io_status(j);
+		if (status != last) {
+			last = status;
+			changed = now;
+		}
+		if (now - start >= LINES_MAX_MS * ticks_per_ms) { return; }
+		if (now - start >= LINES_MIN_MS * ticks_per_ms &&
+			now - changed >= LINES_STABLE_MS * ticks_per_ms) { return; }
+	}
+}
+
+// Retires the oldest write if the driver has taken it, or once it has
+// if asked to wait. Returns 0 if there was nothing to retire yet.
+static int io_retire(jtag_t* j, int wait)
+{
+	ch340_t* c = CH340(j);
+	if (!c->write_num) { return 0; }
+	ch340_write_t* w = &c->writes[c->write_head];
+	if (!io_reap(j, w, 0)) {
+		if (!wait) { return 0; }
+		LONGLONG start = GetTicksNow();
+		io_reap(j, w, 1);
+		c->write_waits++;
+		c->write_wait_ticks += GetTicksNow() - start;
+	}
+
+	// The drain profile accounts for writes once the UART has gone idle
+	if (c->timing.profile == JTAG_TIMING_DRAIN) { c->drained_chars += w->len; }
+	else { jtag_timing_write(&c->timing, w->issued, GetTicksNow(), w->len); }
+	if (w->len) { w->tckbuf[w->len - 1] = c->wave.chars[c->wave.max_pulses]; } // io_tck() may have put a shorter burst there
+	c->write_head = (c->write_head + 1) % CH340_WRITES;
+	c->write_num--;
+	return 1;
+}
+
+// Waits for every queued write. Line changes and samples must not get
+// ahead of the clocks queued before them.
+static void io_flush(jtag_t* j)
+{
+	ch340_t* c = CH340(j);
+	if (!c->write_num) { return; }
+	LONGLONG issued = c->writes[(c->write_head + c->write_num - 1) % CH340_WRITES].issued;
+	while (io_retire(j, 1)) { }
+	if (c->timing.profile == JTAG_TIMING_DRAIN) {
+		io_wait_idle(j);
+		jtag_timing_write(&c->timing, issued, GetTicksNow(), c->drained_chars);
+		c->drained_chars = 0;
+	}
+}
+
+// Returns the buffer for the next write. Waits for the oldest write only
+// if every buffer is still in flight.
+static ch340_write_t* io_next(jtag_t* j)
+{
+	ch340_t* c = CH340(j);
+	while (io_retire(j, 0)) { }
+	if (c->write_num == CH340_WRITES) { io_retire(j, 1); }
+	return &c->writes[(c->write_head + c->write_num) % CH340_WRITES];
+}
+
+// Queues the first len characters of w->tckbuf without waiting for them
+static void io_queue(jtag_t* j, ch340_write_t* w, int len)
+{
+	ch340_t* c = CH340(j);
+	w->len = len;
+	w->done = 0;
+	w->issued = GetTicksNow();
+	c->write_num++;
+	c->queued_writes++;
+	if (c->write_num > c->max_writes) { c->max_writes = c->write_num; }
+	io_start(j, w);
+}
+
+// Times drained one-character writes to learn how long a write takes to
+// reach the UART. TMS is high, so the single TCK keeps the TAP in reset.
+static void io_calibrate(jtag_t* j)
+{
+	ch340_t* c = CH340(j);
+	LONGLONG worst = 0;
+	for (int i = 0; i < 8; i++) {
+		LONGLONG issued = GetTicksNow();
+		ch340_write_t* w = io_next(j);
+		w->tckbuf[0] = c->wave.chars[1];
+		io_queue(j, w, 1);
+		io_flush(j);
+		io_wait_idle(j);
+		LONGLONG took = GetTicksNow() - issued;
+		if (took > worst) { worst = took; }
+	}
+	c->overhead = worst;
+}
+
+// Picks the timing profile and, for the baud profile, its overhead
+static void io_setup_timing(jtag_t* j)
+{
+	ch340_t* c = CH340(j);
+	io_timing_init(j);
+	c->timing.profile = c->profile;
+	if (c->timing.profile == JTAG_TIMING_DEFAULT) {
+#ifdef _WIN32
+		// WriteFile() returns before the characters are on the wire,
+		// so wait a fixed 1 ms after each write and 2 ms before sampling.
+		c->timing.profile = JTAG_TIMING_FIXED;
+#else
+		// Modem line ioctls complete synchronously and draining writes
+		// leaves only the adapter FIFO, so lines need no extra settling.
+		c->timing.profile = JTAG_TIMING_DRAIN;
+#endif
+	}
+	if (c->timing.profile == JTAG_TIMING_BAUD) {
+		if (!c->overhead) { io_calibrate(j); }
+		c->timing.overhead = c->overhead;
+	}
+}
+
+// Queues count pulses as full characters and one for the rest. Runs
+// longer than a buffer holds take more than one write.
+static void io_tck(jtag_t* j, uint16_t count) {
+	jtag_wave_t* wave = &CH340(j)->wave;
+	int left = count;
+	do {
+		int n = left < TCKBUF_SIZ * wave->max_pulses ? left : TCKBUF_SIZ * wave->max_pulses;
+		ch340_write_t* w = io_next(j);
+		int full = n / wave->max_pulses;
+		int remainder = n % wave->max_pulses;
+		if (remainder) { w->tckbuf[full] = wave->chars[remainder]; }
+		io_queue(j, w, full + (remainder == 0 ? 0 : 1));
+		left -= n;
+	} while (left > 0);
+}
+
+// Modem inputs are active low, so a deasserted status bit reads as 1
+static int io_sample(jtag_t* j)
+{
+	int status = io_status(j);
+	int lines = 0;
+	if (!(status & STATUS_CTS)) { lines |= JTAG_TDO; }
+	if (!(status & STATUS_DSR)) { lines |= JTAG_DSR; }
+	if (!(status & STATUS_RI)) { lines |= JTAG_RI; }
+	if (!(status & STATUS_DCD)) { lines |= JTAG_DCD; }
+	return lines;
+}
+
+static void io_settle(jtag_t* j, int what)
+{
+	io_flush(j);
+	WaitTicks(jtag_timing_until(&CH340(j)->timing, what));
+}
+
+// Delays count from when the clocks queued before them have been sent
+static void io_delay(jtag_t* j, long usecs)
+{
+	io_flush(j);
+	WaitUsecs(usecs);
+}
+
+static void io_print_stats(jtag_t* j, FILE* f)
+{
+	ch340_t* c = CH340(j);
+	char frame[8];
+	jtag_wave_name(&c->wave, frame, sizeof(frame));
+	fprintf(f, "CH340: %d baud %s, %d TCK per character\n", BAUD_RATE, frame, c->wave.max_pulses);
+	fprintf(f, "CH340 writes: %ld queued, up to %d of %d in flight\n",
+		c->queued_writes, c->max_writes, CH340_WRITES);
+	fprintf(f, "  %-14s %8ld  %10.3lf ms\n", "Write waits", c->write_waits,
+		(double)c->write_wait_ticks / ticks_per_ms);
+}
+
+static int io_configure(jtag_t* j, const char* key, const char* value)
+{
+	ch340_t* c = CH340(j);
+	if (!strcmp(key, "timing")) {
+		int profile = jtag_timing_parse(value);
+		if (profile < 0) { return -1; }
+		c->profile = profile;
+		return 0;
+	}
+	if (!strcmp(key, "frame")) {
+		for (int i = 0; jtag_wave_ch340_formats[i]; i++) {
+			if (!strcmp(value, jtag_wave_ch340_formats[i])) {
+				strcpy(c->frame, value);
+				return 0;
+			}
+		}
+		return -1;
+	}
+	if (!strcmp(key, "min_pulse_ns")) {
+		char* end;
+		long v = strtol(value, &end, 10);
+		if (end == value || *end || v < 0) { return -1; }
+		c->min_pulse_ns = v;
+		return 0;
+	}
+	if (!strcmp(key, "overhead_us")) {
+		char* end;
+		double v = strtod(value, &end);
+		if (end == value || *end || v <= 0) { return -1; }
+		c->overhead = (LONGLONG)(v * ticks_per_ms / 1000.0);
+		return 0;
+	}
+	return -1;
+}
+
+// Builds the TCK characters for the frame format asked for, or for the
+// fastest one, and fills the write buffers with full characters
+static int io_setup_wave(jtag_t* j)
+{
+	ch340_t* c = CH340(j);
+	int failed;
+	if (c->frame[0]) {
+		failed = jtag_wave_parse(&c->wave, c->frame) || !jtag_wave_build(&c->wave, BAUD_RATE, c->min_pulse_ns);
+	}
+	else { failed = jtag_wave_pick(&c->wave, jtag_wave_ch340_formats, BAUD_RATE, c->min_pulse_ns); }
+	if (failed) {
+		fprintf(stderr, "Error! No frame format can clock TCK at %d baud.\n", BAUD_RATE);
+		return -1;
+	}
+	for (int i = 0; i < CH340_WRITES; i++) {
+		memset(c->writes[i].tckbuf, c->wave.chars[c->wave.max_pulses], TCKBUF_SIZ);
+	}
+	c->write_head = 0;
+	c->write_num = 0;
+	return 0;
+}
+
+#ifdef _WIN32
+static int io_setup(jtag_t* j)
+{
+	ch340_t* c = CH340(j);
+	char name[100] = { 0 };
+	char root[] = "\\\\.\\\0";
+	memcpy(name, root, strlen(root));
+	memcpy(name + strlen(root), j->portname, strlen(j->portname));
+
+	c->port = INVALID_HANDLE_VALUE;
+	if (io_setup_wave(j)) { goto error; }
+	for (int i = 0; i < CH340_WRITES; i++) {
+		c->writes[i].ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!c->writes[i].ov.hEvent) { goto error; }
+	}
+	io_timing_init(j);
+
+	LONGLONG give_up = GetTicksNow() + OPEN_RETRY_MS * ticks_per_ms;
+	for (;;) {
+		c->port = CreateFileA(
+			name,							// Port name
+			GENERIC_READ | GENERIC_WRITE,	// Read & Write
+			0,								// No sharing
+			NULL,							// No security
+			OPEN_EXISTING,					// Open existing port
+			FILE_FLAG_OVERLAPPED,			// Writes complete in the background
+			NULL);							// Null for comm devices
+		if (c->port != INVALID_HANDLE_VALUE) { break; }
+		if (GetLastError() != ERROR_ACCESS_DENIED || GetTicksNow() >= give_up) { goto error; }
+		Sleep(1);
+	}
+
+	DCB dcb;
+	SecureZeroMemory(&dcb, sizeof(DCB));
+	dcb.DCBlength = sizeof(DCB);
+
+	if (!GetCommState(c->port, &dcb)) { goto error; }
+	dcb.BaudRate = BAUD_RATE;
+	dcb.fBinary = TRUE;
+	dcb.fParity = FALSE;
+	dcb.fOutxCtsFlow = FALSE;
+	dcb.fOutxDsrFlow = FALSE;
+	dcb.fDtrControl = DTR_CONTROL_DISABLE;
+	dcb.fDsrSensitivity = FALSE;
+	dcb.fTXContinueOnXoff = TRUE;
+	dcb.fOutX = FALSE;
+	dcb.fInX = FALSE;
+	dcb.fNull = FALSE;
+	dcb.fRtsControl = RTS_CONTROL_DISABLE;
+	dcb.fAbortOnError = TRUE;
+	dcb.ByteSize = (BYTE)c->wave.data_bits;
+	switch (c->wave.parity) {
+	case 'E': dcb.Parity = EVENPARITY; break;
+	case 'O': dcb.Parity = ODDPARITY; break;
+	case 'M': dcb.Parity = MARKPARITY; break;
+	case 'S': dcb.Parity = SPACEPARITY; break;
+	default: dcb.Parity = NOPARITY; break;
+	}
+	dcb.StopBits = c->wave.stop_halves == 4 ? TWOSTOPBITS : ONESTOPBIT;
+	if (!SetCommState(c->port, &dcb)) { goto error; }
+
+	// Without a write timeout a write only ever completes in full
+	COMMTIMEOUTS timeouts;
+	SecureZeroMemory(&timeouts, sizeof(COMMTIMEOUTS));
+	if (!SetCommTimeouts(c->port, &timeouts)) { goto error; }
+
+	io_tms(j, 1);
+	io_tdi(j, 1);
+
+	for (int i = 0; i < 5; i++) {
+		if (!EscapeCommFunction(c->port, (i & 1) ? SETBREAK : CLRBREAK)) { goto error; }
+		io_wait_lines(j);
+	}
+
+	io_setup_timing(j);
+	if (jtag_failed(j)) { goto error; }
+	return 0;
+
+error:
+	fprintf(stderr, "Error opening %s!\n", j->portname);
+	if (c->port != INVALID_HANDLE_VALUE) { CloseHandle(c->port); }
+	for (int i = 0; i < CH340_WRITES; i++) {
+		if (c->writes[i].ov.hEvent) { CloseHandle(c->writes[i].ov.hEvent); }
+		c->writes[i].ov.hEvent = NULL;
+	}
+	return -1;
+}
+
+static void io_shutdown(jtag_t* j)
+{
+	ch340_t* c = CH340(j);
+	io_flush(j);
+	io_wait_idle(j);
+	CloseHandle(c->port);
+	for (int i = 0; i < CH340_WRITES; i++) {
+		CloseHandle(c->writes[i].ov.hEvent);
+		c->writes[i].ov.hEvent = NULL;
+	}
+}
+#else
+static int io_setup(jtag_t* j)
+{
+	ch340_t* c = CH340(j);
+	c->port = -1;
+	if (io_setup_wave(j)) { goto error; }
+	io_timing_init(j);
+
+	// Non-blocking, so that writes queue up behind the driver's buffer
+	// instead of holding up the caller
+	LONGLONG give_up = GetTicksNow() + OPEN_RETRY_MS * ticks_per_ms;
+	for (;;) {
+		c->port = open(j->portname, O_RDWR | O_NOCTTY | O_NONBLOCK);
+		if (c->port >= 0) { break; }
+		if (errno != EBUSY || GetTicksNow() >= give_up) { goto error; }
+		Sleep(1);
+	}
+
+	struct termios tio;
+	if (tcgetattr(c->port, &tio)) { goto error; }
+	cfmakeraw(&tio);
+	tio.c_cflag &= ~(CSIZE | CSTOPB | PARENB | PARODD | CMSPAR | CRTSCTS | HUPCL);
+	tio.c_cflag |= CLOCAL | CREAD;
+	switch (c->wave.data_bits) {
+	case 5: tio.c_cflag |= CS5; break;
+	case 6: tio.c_cflag |= CS6; break;
+	case 7: tio.c_cflag |= CS7; break;
+	default: tio.c_cflag |= CS8; break;
+	}
+	switch (c->wave.parity) {
+	case 'E': tio.c_cflag |= PARENB; break;
+	case 'O': tio.c_cflag |= PARENB | PARODD; break;
+	case 'M': tio.c_cflag |= PARENB | CMSPAR | PARODD; break;
+	case 'S': tio.c_cflag |= PARENB | CMSPAR; break;
+	default: break;
+	}
+	if (c->wave.stop_halves == 4) { tio.c_cflag |= CSTOPB; }
+	tio.c_cc[VMIN] = 0;
+	tio.c_cc[VTIME] = 0;
+	if (cfsetispeed(&tio, B2000000) || cfsetospeed(&tio, B2000000)) { goto error; }
+	if (tcsetattr(c->port, TCSANOW, &tio)) { goto error; }
+
+	// Ask the driver to push data and status through without batching.
+	// Not every driver supports this, so failure is not an error.
+	struct serial_struct ss;
+	if (!ioctl(c->port, TIOCGSERIAL, &ss)) {
+		ss.flags |= ASYNC_LOW_LATENCY;
+		ioctl(c->port, TIOCSSERIAL, &ss);
+	}
+
+	io_tms(j, 1);
+	io_tdi(j, 1);
+
+	for (int i = 0; i < 5; i++) {
+		if (ioctl(c->port, (i & 1) ? TIOCSBRK : TIOCCBRK)) { goto error; }
+		io_wait_lines(j);
+	}
+
+	io_setup_timing(j);
+	if (jtag_failed(j)) { goto error; }
+	return 0;
+
+error:
+	fprintf(stderr, "Error opening %s!\n", j->portname);
+	if (c->port >= 0) { close(c->port); }
+	return -1;
+}
+
+static void io_shutdown(jtag_t* j)
+{
+	io_flush(j);
+	io_wait_idle(j);
+	close(CH340(j)->port);
+}
+#endif
+
+const jtag_backend_t jtag_ch340_backend = {
+	"ch340",
+	"CH340G USB serial adapter (TCK on TXD, TMS on RTS, TDI on DTR, TDO on CTS)",
+	JTAG_NEEDS_PORT,
+	sizeof(ch340_t),
+	io_setup,
+	io_shutdown,
+	io_tms,
+	io_tdi,
+	io_tck,
+	io_sample,
+	io_settle,
+	io_configure,
+	NULL,
+	io_delay,
+	io_print_stats,
+	io_flush
+};
@@ -6,7 +6,10 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <ctype.h>
 #include "../streamtools.h"
+#include "../gwu_lz.h"
+#include "../gwu_toc.h"
 
 char buf[256];
 
@@ -21,67 +24,111 @@ int main(int argc, char** argv)
 	// Open output file
 	FILE* out_file;
 	if (defaults) {
-		out_file = fopen("GWUpdate_combined.exe", "wb");
+		out_file = fopen("GWUpdate_combined.exe", "w+b");
 		argc = 4;
 	}
-	else { out_file = fopen(argv[1], "wb"); }
+	else { out_file = fopen(argv[1], "w+b"); } // Read back for the checksums
 	if (!out_file) {
 		fputs("Error! Couldn't open output file.\n", stderr);
 		return -1;
 	}
 
+	// Table of contents: the driver, the instructions and every image
+	gwu_toc_entry_t* toc = calloc(argc, sizeof(gwu_toc_entry_t));
+	uint32_t num_toc = 0;
+	uint32_t out_update_offset = 0;
+	if (!toc) {
+		fputs("Error! Couldn't allocate table of contents.\n", stderr);
+		return -1;
+	}
+
 	// Open each input file
 	for (int i = 2; i < argc; i++) {
 		int c; // Character buffer
 
-		// Open input file
-		FILE* in_file;
-		if (defaults) { in_file = fopen("../Packager/GWUpdate_out.exe", "rb"); }
-		else { in_file = fopen(argv[i], "rb"); }
-		if (!in_file) {
+		// Open input file, and map it for its table of contents
+		const char* in_name = defaults ? "../Packager/GWUpdate_out.exe" : argv[i];
+		FILE* in_file = fopen(in_name, "rb");
+		gwu_image_t in_image;
+		if (!in_file || image_open(&in_image, in_name)) {
 			fputs("Error! Couldn't open input file.\n", stderr);
 			return -1;
 		}
+		gwu_toc_t in_toc;
+		int has_toc = !gwu_toc_read(in_image.all, &in_toc);
 
-		// Find embedded update file
-		int update_index;
-		for (update_index = 1; ; update_index++) { // Search at each 128k offset for UPD8 signature
-			if (update_index > 255) { // Looked too many times fail
-				fprintf(stderr, "Error! Update file signature not found.\n");
+		// Find embedded update file, from the table of contents if there
+		// is one, else at each 128k offset
+		long update_offset;
+		int image_info; // Input is "UPD9", with image info
+		if (has_toc) {
+			update_offset = in_toc.update_offset;
+			if (fseek(in_file, update_offset, SEEK_SET)) {
+				fprintf(stderr, "Error! Couldn't seek to update file.\n");
 				return -1;
 			}
-			if (fseek(in_file, update_index * 128 * 1024, SEEK_SET)) { // Seek past end of file fail
-				fprintf(stderr, "Error! Seeked past end of file looking for update file signature.\n");
+			if (fread(buf, 1, 4, in_file) != 4 || memcmp(buf, "UPD", 3) || (buf[3] != '8' && buf[3] != '9')) {
+				fprintf(stderr, "Error! Update file signature not found.\n");
 				return -1;
 			}
+			image_info = buf[3] == '9';
+		}
+		else {
+			for (int update_index = 1; ; update_index++) { // Search at each 128k offset for UPD8/UPD9 signature
+				if (update_index > 255) { // Looked too many times fail
+					fprintf(stderr, "Error! Update file signature not found.\n");
+					return -1;
+				}
+				update_offset = update_index * 128L * 1024;
+				if (fseek(in_file, update_offset, SEEK_SET)) { // Seek past end of file fail
+					fprintf(stderr, "Error! Seeked past end of file looking for update file signature.\n");
+					return -1;
+				}
 
-			char c = fgetc(in_file);
-			if (c != 'U') { continue; }
-			c = fgetc(in_file);
-			if (c != 'P') { continue; }
-			c = fgetc(in_file);
-			if (c != 'D') { continue; }
-			c = fgetc(in_file);
-			if (c != '8') { continue; }
-			break;
+				char c = fgetc(in_file);
+				if (c != 'U') { continue; }
+				c = fgetc(in_file);
+				if (c != 'P') { continue; }
+				c = fgetc(in_file);
+				if (c != 'D') { continue; }
+				c = fgetc(in_file);
+				if (c != '8' && c != '9') { continue; }
+				image_info = c == '9';
+				break;
+			}
 		}
 
 		// Copy GWUpdate base executable from first update file
 		if (i == 2) {
+			// The driver comes along with it, at the same offset
+			const gwu_toc_entry_t* driver = has_toc ? gwu_toc_find(&in_toc, "DRVR") : NULL;
+			gwu_span_t driver_data;
+			uint32_t driver_length;
+			if (driver) { toc[num_toc++] = *driver; }
+			else if (!has_toc && image_find128k(&in_image, "DRVR", &driver_data) &&
+				driver_data.p - in_image.all.p < update_offset &&
+				!span_read(&driver_data, &driver_length, sizeof(uint32_t))) {
+				gwu_toc_entry_t* e = &toc[num_toc++];
+				memcpy(e->type, "DRVR", 4);
+				e->offset = (uint32_t)(driver_data.p - in_image.all.p) - sizeof(uint32_t);
+				e->length = sizeof(uint32_t) + driver_length;
+			}
+
 			// Copy everything before embedded update file
 			rewind(in_file);
-			if (file_copy128k(out_file, in_file, update_index)) {
+			if (file_copy(out_file, in_file, update_offset)) {
 				fprintf(stderr, "Error! Failed copying GWUpdate executable to output file.\n");
 				return -1;
 			}
 
-			// Write update file signature "UPD8"
+			// Write update file signature "UPD9"
+			out_update_offset = (uint32_t)ftell(out_file);
 			buf[0] = 'U';
 			buf[1] = 'P';
 			buf[2] = 'D';
-			buf[3] = '8';
+			buf[3] = '9';
 			fwrite(buf, 1, 4, out_file);
-			fseek(in_file, 4, SEEK_CUR); // Skip "UPD8" in source file
+			fseek(in_file, 4, SEEK_CUR); // Skip signature in source file
 		}
 
 		// Get number of update images from input file
@@ -102,29 +149,116 @@ int main(int argc, char** argv)
 			num_updates = argc - 2;
 			fwrite(&num_updates, sizeof(uint32_t), 1, out_file);
 		}
-		else {
-			// Skip instructions 1 and 2
-			for (int j = 0; j < 2; j++) {
-				while (1) {
-					c = fgetc(in_file);
-					if (c == EOF) {
-						fprintf(stderr, "Error! EOF during instructions %i.\n", j);
-					}
-					else if (c == 0) { break; }
+
+		// Copy instructions 1 and 2 from the first input, skip them in the rest
+		if (i == 2) {
+			memcpy(toc[num_toc].type, "INST", 4);
+			toc[num_toc].offset = (uint32_t)ftell(out_file);
+		}
+		for (int j = 0; j < 2; j++) {
+			do {
+				c = fgetc(in_file);
+				if (c == EOF) {
+					fprintf(stderr, "Error! EOF during instructions %i.\n", j);
+					return -1;
 				}
+				if (i == 2) { fputc(c, out_file); }
+			} while (c != 0);
+		}
+		if (i == 2) {
+			toc[num_toc].length = (uint32_t)ftell(out_file) - toc[num_toc].offset;
+			num_toc++;
+		}
+
+		// Read update image header: type, boardid digits, expected bits,
+		// device count and IDCODE
+		unsigned char header[20];
+		if (fread(header, 1, sizeof(header), in_file) != sizeof(header)) {
+			fprintf(stderr, "Error! Couldn't read update image header.\n");
+			return -1;
+		}
+
+		// Read image info, which UPD8 files go without
+		uint32_t info_size = 0;
+		unsigned char* info = NULL;
+		if (image_info) {
+			if (!fread(&info_size, sizeof(uint32_t), 1, in_file)) {
+				fprintf(stderr, "Error! Couldn't read update image info.\n");
+				return -1;
+			}
+			info = malloc(info_size ? info_size : 1);
+			if (!info || fread(info, 1, info_size, in_file) != info_size) {
+				fprintf(stderr, "Error! Couldn't read update image info.\n");
+				return -1;
 			}
 		}
 
-		// Write remainder of update to output file
-		if (file_writeall(out_file, in_file)) {
-			fprintf(stderr, "Error! Failed to write input file to output file.\n");
+		// Read payload length
+		uint32_t payload_length;
+		if (!fread(&payload_length, sizeof(uint32_t), 1, in_file)) {
+			fprintf(stderr, "Error! Couldn't read update image length.\n");
 			return -1;
 		}
 
+		// Payloads from older Packagers are raw (uppercase type); compress them
+		gwu_toc_entry_t* image_entry = &toc[num_toc++];
+		image_entry->offset = (uint32_t)ftell(out_file);
+		memcpy(image_entry->boardid, header + 4, 4);
+		memcpy(&image_entry->idcode, header + 16, sizeof(uint32_t));
+		if (header[1] >= 'A' && header[1] <= 'Z') {
+			for (int j = 0; j < 4; j++) { header[j] = tolower(header[j]); }
+			uint32_t raw_length = payload_length;
+			fwrite(header, 1, sizeof(header), out_file);
+			fwrite(&info_size, sizeof(uint32_t), 1, out_file);
+			fwrite(info, 1, info_size, out_file);
+			long length_pos = ftell(out_file);
+			fwrite(&payload_length, sizeof(uint32_t), 1, out_file);
+
+			gwu_span_t raw;
+			unsigned char* raw_data = malloc(raw_length ? raw_length : 1);
+			if (!raw_data || fread(raw_data, 1, raw_length, in_file) != raw_length) {
+				fprintf(stderr, "Error! Couldn't read update image.\n");
+				return -1;
+			}
+			raw.p = raw_data;
+			raw.len = raw_length;
+
+			uint32_t length;
+			if (lz_compress(out_file, raw, &length)) {
+				fprintf(stderr, "Error! Failed to compress update image.\n");
+				return -1;
+			}
+			free(raw_data);
+			fseek(out_file, length_pos, SEEK_SET);
+			fwrite(&length, sizeof(uint32_t), 1, out_file);
+			fseek(out_file, 0L, SEEK_END);
+		}
+		else {
+			fwrite(header, 1, sizeof(header), out_file);
+			fwrite(&info_size, sizeof(uint32_t), 1, out_file);
+			fwrite(info, 1, info_size, out_file);
+			fwrite(&payload_length, sizeof(uint32_t), 1, out_file);
+			if (file_copy(out_file, in_file, payload_length)) {
+				fprintf(stderr, "Error! Failed to write input file to output file.\n");
+				return -1;
+			}
+		}
+		memcpy(image_entry->type, header, 4);
+		image_entry->length = (uint32_t)ftell(out_file) - image_entry->offset;
+
 		// Close this input file
+		free(info);
+		gwu_toc_free(&in_toc);
+		image_close(&in_image);
 		fclose(in_file);
 	}
 
+	if (gwu_toc_write(out_file, out_update_offset, toc, num_toc)) {
+		fprintf(stderr, "Error! Failed to write table of contents.\n");
+		return -1;
+	}
+	free(toc);
+
 	// Close output file
 	fclose(out_file);
 }
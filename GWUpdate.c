@@ -28,286 +28,55 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
-#include "CH340G-HAL.h"
+#include <ctype.h>
+#include "jtag.h"
+#include "gwu_host.h"
 #include "gwu_time.h"
 #include "gwu_console.h"
 #include "gwu_os.h"
-#include "streamtools.h"
+#include "gwu_thread.h"
+#include "gwu_image.h"
+#include "gwu_verify.h"
+#include "gwu_toc.h"
 #include "boardid.h"
 
 #define LEN128K (128 * 1024)
+#define MAX_BOARDS (16)
 
-uint32_t expected_devices;
-uint32_t expected_idcode;
-uint32_t found_devices;
-uint32_t found_idcode;
-uint32_t expected_bits;
-enum libxsvf_mode cur_mode;
-char enable_vt;
-
-typedef struct udata_s {
-	FILE* f;
-	int clockcount;
-	int bitcount_tdi;
-	int bitcount_tdo;
-	int sendcount;
-} udata_t;
-static struct udata_s u;
-
-LONGLONG start = 0;
-void printinfo() {
-	LONGLONG end = GetTicksNow() - start;
-	double elapsed = (double)end / ticks_per_ms / 1000.0f;
-	fprintf(stderr, "\n");
-	fprintf(stderr, "Total number of clock cycles: %d\n", u.clockcount);
-	fprintf(stderr, "Number of significant TDI bits: %d\n", u.bitcount_tdi);
-	fprintf(stderr, "Number of significant TDO bits: %d\n", u.bitcount_tdo);
-	fprintf(stderr, "Number of TCK pulsetrains: %d\n", u.sendcount);
-	fprintf(stderr, "Time elapsed: %lf sec.\n", elapsed);
-	fprintf(stderr, "Speed: %lf bits / sec.\n", (double)u.clockcount / elapsed);
-	fprintf(stderr, "\n");
-}
-
-#define HISTORY_LEN (64)
-int clockcount_history[HISTORY_LEN];
-LONGLONG ticks_history[HISTORY_LEN];
-int history_len_current = 0;
-void shift_history(int clockcount, LONGLONG ticks) {
-	for (int i = 0; i < HISTORY_LEN - 1; i++) {
-		clockcount_history[i] = clockcount_history[i + 1];
-		ticks_history[i] = ticks_history[i + 1];
-	}
-	history_len_current++;
-	clockcount_history[HISTORY_LEN - 1] = clockcount;
-	ticks_history[HISTORY_LEN - 1] = ticks;
-}
-float get_speed() {
-
-	if (history_len_current < 4) { return 0.0f; }
-	if (clockcount_history[HISTORY_LEN - 1] == clockcount_history[HISTORY_LEN - 2] &&
-		clockcount_history[HISTORY_LEN - 2] == clockcount_history[HISTORY_LEN - 3] &&
-		clockcount_history[HISTORY_LEN - 3] == clockcount_history[HISTORY_LEN - 4]) {
-		return 0.0f;
-	}
-
-	int start_index = 0;
-	if (history_len_current < HISTORY_LEN) {
-		start_index = HISTORY_LEN - history_len_current;
-	}
-
-	float speed_duration = (float)(ticks_history[HISTORY_LEN - 1] - ticks_history[start_index]) / ticks_per_ms / 1000.0f;
-	float speed = (float)(clockcount_history[HISTORY_LEN - 1] - clockcount_history[start_index]) / speed_duration;
-	return speed;
-}
-void printshortinfo_unconditional(LONGLONG ticks) {
-	LONGLONG end = ticks - start;
-	double elapsed = (float)end / ticks_per_ms / 1000.0f;
-	float percent = 100.0f * (float)u.clockcount / expected_bits;
-	if (percent > 100.0f) { percent = 100.0f; }
-	shift_history(u.clockcount, ticks);
-	if (enable_vt) {
-		fprintf(stderr,
-			"\033[1A\033[KUpdate in progress... %-4.1f%%      Bits: %d       Time: %.1f sec.      Speed: %.1f b/sec.\n",
-			percent, u.clockcount, elapsed, get_speed());
-	}
-	else {
-		fprintf(stderr,
-			"Update in progress... %-4.1f%%      Bits: %d       Time: %.1f sec.      Speed: %.1f b/sec.\n",
-			percent, u.clockcount, elapsed, get_speed());
-	}
-}
-void printshortinfo() {
-	if (cur_mode != LIBXSVF_MODE_SCAN) {
-		LONGLONG ticks = GetTicksNow();
-		LONGLONG since_last = ticks - ticks_history[HISTORY_LEN - 1];
-		float time_since_last = (float)since_last / ticks_per_ms / 1000.0f;
-		int clocks_since_last = u.clockcount - clockcount_history[HISTORY_LEN - 1];
-		if (time_since_last >= 0.09f || clocks_since_last >= 40) {
-			printshortinfo_unconditional(ticks);
-		}
-	}
-}
-
-unsigned char tck_queue = 0;
-
-static void flush_tck() {
-	io_tck(tck_queue);
-	tck_queue = 0;
-}
-
-static int h_setup(struct libxsvf_host* h)
-{
-	static char printed = 0;
-	udata_t* u = (udata_t*)h->user_data;
-	if (!printed) {
-		fprintf(stderr, "Opening JTAG connection...\n");
-		fflush(stderr);
-		printed = 1;
-	}
-	tck_queue = 0;
-	io_setup();
-	return 0;
-}
-
-static int h_shutdown(struct libxsvf_host* h)
-{
-	struct udata_s* u = (struct udata_s*)h->user_data;
-	flush_tck();
-	io_shutdown();
-	return 0;
-}
-
-static void h_udelay(struct libxsvf_host* h, long usecs, int tms, long num_tck)
-{
-	udata_t* u = (udata_t*)h->user_data;
-
-	if (tck_queue > 0) {
-		flush_tck();
-		Gate();
-	}
-
-	if (num_tck > 0) {
-		io_tms(tms);
-		SetGate();
-		Gate();
-		while (num_tck > 65000) {
-			io_tck(65000);
-			num_tck -= 65000;
-			printshortinfo();
-		}
-		io_tck((uint16_t)num_tck);
-		SetGate();
-		printshortinfo();
-	}
-	if (usecs > 0) { Sleep((usecs + 999) / 1000); }
-	else { Gate(); }
-}
-
-int getbyte_limit = 0;
-int getbyte_cur = 0;
-static int h_getbyte(struct libxsvf_host* h)
-{
-	if (getbyte_cur >= getbyte_limit) { return EOF; }
-	udata_t* u = (udata_t*)h->user_data;
-	int c = fgetc(u->f);
-	getbyte_cur++;
-	return c;
-}
-
-static int h_set_frequency(struct libxsvf_host* h, int v) { return 0; }
-
-static void h_report_tapstate(struct libxsvf_host* h)
-{
-	udata_t* u = (udata_t*)h->user_data;
-	const char* message = libxsvf_state2str(h->tap_state);
-	char newmessage[40];
-	memset(newmessage, ' ', sizeof(newmessage) - 1);
-	newmessage[sizeof(newmessage) - 1] = 0;
-	memcpy(newmessage, message, strlen(message));
-	newmessage[strlen(message)] = ']';
-	//fprintf(stderr, "[%s  ", newmessage);
-	printshortinfo();
-}
-
-static unsigned long idcode_match = 0;
-static void h_report_device(struct libxsvf_host* h, unsigned long idcode)
-{
-	if (idcode_match == 0 || idcode_match == -1 || idcode == idcode_match) {
-		printf("Found device on JTAG chain.      IDCODE=0x%08lx, REV=0x%01lx, PART=0x%04lx, MFR=0x%03lx\n",
-			idcode, (idcode >> 28) & 0xf, (idcode >> 12) & 0xffff, (idcode >> 1) & 0x7ff);
-	}
-
-	found_devices++;
-	found_idcode = idcode;
-	printshortinfo();
-}
-
-static void h_report_status(struct libxsvf_host* h, const char* message)
-{
-	udata_t* u = (udata_t*)h->user_data;
-	char newmessage[33];
-	memset(newmessage, ' ', sizeof(newmessage) - 1);
-	newmessage[sizeof(newmessage) - 1] = 0;
-	if (strlen(message) < 33) {
-		memcpy(newmessage, message, strlen(message));
-		//fprintf(stderr, "[STATUS] %s ", newmessage);
-	}
-	else {
-		//fprintf(stderr, "[STATUS] %s ", message);
-	}
-	printshortinfo();
-}
-
-static void h_report_error(struct libxsvf_host* h, const char* file, int line, const char* message)
-{
-	fprintf(stderr, "[%s:%d] %s\n\n", file, line, message);
-}
-
-static int realloc_maxsize[LIBXSVF_MEM_NUM];
-
-static void* h_realloc(struct libxsvf_host* h, void* ptr, int size, enum libxsvf_mem which)
-{
-	udata_t* u = (udata_t*)h->user_data;
-	if (size > realloc_maxsize[which]) { realloc_maxsize[which] = size; }
-	return realloc(ptr, size);
-}
-
-static int tms_old = -1;
-static int tdi_old = -1;
-static int tck_flushed = 1;
-static int tdi_tms_changed = 1;
-static int h_pulse_tck(struct libxsvf_host* h, int tms, int tdi, int tdo, int rmask, int sync)
-{
-	udata_t* u = (udata_t*)h->user_data;
-
-	u->clockcount++;
-	if (tdi >= 0) { u->bitcount_tdi++; }
-
-	if (!sync && tdo < 0 && tms == tms_old && (tdi == tdi_old || tdi < 0) && tck_queue < 255) {
-		tck_queue++;
-		return 1;
-	}
-	else {
-		int change_tms = tms != tms_old;
-		int change_tdi = tdi >= 0 && tdi != tdi_old;
-
-		if (tck_queue > 0) {
-			flush_tck();
-			u->sendcount++;
-			Gate();
-		}
-
-		if (change_tms) {
-			io_tms(tms);
-			SetGate();
-			tms_old = tms;
-		}
-		if (change_tdi) {
-			if (tdi != tdi_old) {
-				io_tdi(tdi);
-				SetGate();
-				tdi_old = tdi;
-			}
-		}
-
-		if (change_tms || change_tdi) { Gate(); }
-
-		if (!sync && tdo < 0) {
-			tck_queue++;
-			return 1;
-		}
-		else {
-			if (tdo >= 0) { u->bitcount_tdo++; }
-			io_tck(1);
-			u->sendcount++;
-			Gate2();
-			int line_tdo = io_tdo();
-			return tdo < 0 || line_tdo == tdo ? line_tdo : -1;
-		}
-	}
-}
-
-static struct libxsvf_host h;
+// One firmware image of the update file, read once and shared by all boards
+typedef struct update_image_s {
+	enum libxsvf_mode mode;
+	int compressed;
+	boardid_digit_t boardid_dsr;
+	boardid_digit_t boardid_ri;
+	boardid_digit_t boardid_dcd;
+	uint32_t expected_bits;
+	uint32_t expected_idcode;
+	gwu_info_t info; // All zero in update files without image info
+	gwu_span_t payload; // Points into the mapped image
+	const gwu_toc_entry_t* entry; // NULL in update files without a table of contents
+	gwu_span_t bytes; // Header and payload, checked against entry before playing
+} update_image_t;
+
+// One board being updated through its own adapter and session
+typedef struct board_s {
+	gwu_session_t s;
+	char portname[16];
+	char label[16];
+	lz_reader_t lz;
+	gwu_verify_t verify;
+	int played; // Got as far as playing the update
+	int result;
+} board_t;
+
+static gwu_image_t image;
+static gwu_toc_t toc; // No entries in update files without one
+static gwu_toc_index_t toc_index;
+static int image_info; // Image headers carry an info block ("UPD9")
+static update_image_t* updates;
+static uint32_t num_updates;
+static gwu_marks_t marks; // Largest of all images, reserved by every session
+static gwu_verify_t verify_policy; // As given with -v, planned per board
 
 static void copyleft()
 {
@@ -347,29 +116,61 @@ static void copyleft()
 #define STRBUF_SIZE (64 * 1024)
 char strbuf[STRBUF_SIZE];
 
-int check_boardid_digit(int(*get)(), boardid_digit_t expected) {
-	if (expected == BOARDID_DIGIT_DONTCARE) { return 0; }
-
-	int id;
-	io_tms(0);
-	io_tdi(0);
-	id = get();
-	io_tms(0);
-	io_tdi(1);
-	id = (id << 1) | get();
-	io_tms(1);
-	io_tdi(0);
-	id = (id << 1) | get();
-	io_tms(1);
-	io_tdi(1);
-	id = (id << 1) | get();
-
-	if (id == expected) { return 0; }
-	else { return -1; }
+// What a board reports about itself, read once and matched against
+// every image
+typedef struct board_fingerprint_s {
+	int dsr; // Boardid digits, as BOARDID_DIGIT_*
+	int ri;
+	int dcd;
+	uint32_t idcode;
+	int idcode_known; // 0 if the backend cannot read TDO
+} board_fingerprint_t;
+
+// Reads the boardid digits on all three lines: each digit is a line's
+// level under the four TMS/TDI combinations, and one sample reads all
+// lines for a combination
+static void read_boardid(jtag_t* jtag, board_fingerprint_t* fp) {
+	fp->dsr = 0;
+	fp->ri = 0;
+	fp->dcd = 0;
+	for (int combo = 0; combo < 4; combo++) {
+		jtag_tms(jtag, combo >> 1);
+		jtag_tdi(jtag, combo & 1);
+		int lines = jtag_sample(jtag);
+		fp->dsr = (fp->dsr << 1) | ((lines & JTAG_DSR) ? 1 : 0);
+		fp->ri = (fp->ri << 1) | ((lines & JTAG_RI) ? 1 : 0);
+		fp->dcd = (fp->dcd << 1) | ((lines & JTAG_DCD) ? 1 : 0);
+	}
+}
+
+// Returns 1 if some image constrains a boardid digit. If none does the
+// lines are left alone, as they were before a digit was ever checked.
+static int boardid_checked(void) {
+	for (uint32_t i = 0; i < num_updates; i++) {
+		if (updates[i].boardid_dsr != BOARDID_DIGIT_DONTCARE ||
+			updates[i].boardid_ri != BOARDID_DIGIT_DONTCARE ||
+			updates[i].boardid_dcd != BOARDID_DIGIT_DONTCARE) { return 1; }
+	}
+	return 0;
+}
+
+static int boardid_accepts(boardid_digit_t expected, int digit) {
+	return expected == BOARDID_DIGIT_DONTCARE || expected == digit;
+}
+
+// Returns 1 if the image is for the board
+static int image_accepts(const update_image_t* update, const board_fingerprint_t* fp) {
+	return boardid_accepts(update->boardid_dsr, fp->dsr) &&
+		boardid_accepts(update->boardid_ri, fp->ri) &&
+		boardid_accepts(update->boardid_dcd, fp->dcd) &&
+		(!fp->idcode_known ||
+			update->expected_idcode == 0 ||
+			update->expected_idcode == GWU_ANY_IDCODE ||
+			update->expected_idcode == fp->idcode);
 }
 
-int read_boardid_digit(FILE* f, boardid_digit_t* digit, int index) {
-	if (!fread(digit, sizeof(boardid_digit_t), 1, f)) {
+int read_boardid_digit(gwu_span_t* s, boardid_digit_t* digit, int index) {
+	if (span_read(s, digit, sizeof(boardid_digit_t))) {
 		switch (index) {
 		case 0: fprintf(stderr,
 			"Error! Could not read boardid digit DSR from update image.\n");
@@ -406,27 +207,266 @@ int read_boardid_digit(FILE* f, boardid_digit_t* digit, int index) {
 	return 0;
 }
 
+// Reads the header of one firmware image and takes its payload out of data
+static int read_update(gwu_span_t* data, update_image_t* update) {
+	// Get (X)SVF file type flag
+	unsigned char tag[4];
+	int c[4];
+	if (span_read(data, tag, 4)) { tag[0] = 0; }
+	for (int i = 0; i < 4; i++) { c[i] = tag[i]; }
+
+	// Lowercase letters mark a block-compressed payload (see gwu_lz.h)
+	update->compressed = (c[0] == 'x' || c[0] == ' ') && islower(c[1]) && islower(c[2]) && islower(c[3]);
+	if (update->compressed) {
+		for (int i = 0; i < 4; i++) { c[i] = toupper(c[i]); }
+	}
+
+	// Check update file type - SVF, XSVF or precompiled op-stream
+	int tag_ok = (c[1] == 'S') && (c[2] == 'V') && (c[3] == 'F');
+	if (c[0] == 'X') { update->mode = LIBXSVF_MODE_XSVF; } // First 'X' for XSVF
+	else if (c[0] == ' ') { update->mode = LIBXSVF_MODE_SVF; } // First ' ' for SVF
+	else { tag_ok = 0; }
+	if ((c[0] == ' ') && (c[1] == 'O') && (c[2] == 'P') && (c[3] == 'S')) { // " OPS" for op-stream
+		update->mode = LIBXSVF_MODE_OPS;
+		tag_ok = 1;
+	}
+	if (!tag_ok) {
+		fprintf(stderr, "Error! Unsupported firmware image format: \"");
+
+		return -1;
+	}
+
+	// Get boardid digits
+	boardid_digit_t boardid_reserved;
+	if (read_boardid_digit(data, &update->boardid_dsr, 0) ||
+		read_boardid_digit(data, &update->boardid_ri, 1) ||
+		read_boardid_digit(data, &update->boardid_dcd, 2) ||
+		read_boardid_digit(data, &boardid_reserved, 3)) {
+		fprintf(stderr, "Error! Could not read boardid digits from update image.\n");
+		return -1;
+	}
+
+	// Get expected bit count from update file
+	if (span_read(data, &update->expected_bits, sizeof(uint32_t))) {
+		fprintf(stderr, "Error! Could not read expected bit count from update image.\n");
+		return -1;
+	}
+
+	// Read number of devices on JTAG chain
+	uint32_t expected_devices;
+	if (span_read(data, &expected_devices, sizeof(uint32_t))) {
+		fprintf(stderr, "Error! Could not read JTAG device count from update image.\n");
+		return -1;
+	}
+
+	// Fail if number of devices isn't 1
+	if (expected_devices > 1) {
+		fprintf(stderr, "Error! Update image has multiple devices on JTAG chain but GWUpdate only supports one device.\n");
+		return -1;
+	}
+	else if (expected_devices == 0) {
+		fprintf(stderr, "Error! Update image has no devices on JTAG chain.\n");
+		return -1;
+	}
+
+	// Read single expected IDCODE from update file
+	if (span_read(data, &update->expected_idcode, sizeof(uint32_t))) { // Couldn't read idcode
+		fprintf(stderr, "Error! Couldn't read JTAG idcode from file.\n");
+		return -1;
+	}
+
+	// Read image info: buffer marks and the dry pass prediction
+	if (image_info) {
+		if (gwu_info_read(data, &update->info)) {
+			fprintf(stderr, "Error! Couldn't read firmware image info from file.\n");
+			return -1;
+		}
+		gwu_marks_merge(&marks, &update->info.profile.marks);
+	}
+
+	// Read update image length from update file
+	uint32_t fwsize;
+	if (span_read(data, &fwsize, sizeof(uint32_t))) { // Couldn't read length
+		fprintf(stderr, "Error! Couldn't read firmware image length from file.\n");
+		return -1;
+	}
+	if (span_take(data, fwsize, &update->payload)) {
+		fprintf(stderr, "Error! Firmware image is truncated.\n");
+		return -1;
+	}
+	return 0;
+}
+
+// Reads the header of every firmware image in the update file into updates
+static int read_updates(gwu_span_t* data) {
+	updates = calloc(num_updates, sizeof(update_image_t));
+	if (!updates) {
+		fprintf(stderr, "Error! Could not allocate firmware image list.\n");
+		return -1;
+	}
+
+	for (uint32_t update_index = 0; update_index < num_updates; update_index++) {
+		if (read_update(data, &updates[update_index])) { return -1; }
+	}
+	return 0;
+}
+
+// Same for the images listed in the table of contents, each read from
+// where its entry points
+static int read_updates_toc() {
+	num_updates = toc_index.num_images;
+	updates = calloc(num_updates ? num_updates : 1, sizeof(update_image_t));
+	if (!updates) {
+		fprintf(stderr, "Error! Could not allocate firmware image list.\n");
+		return -1;
+	}
+
+	for (uint32_t update_index = 0; update_index < num_updates; update_index++) {
+		update_image_t* update = &updates[update_index];
+		update->entry = toc_index.images[update_index];
+		if (gwu_toc_span(image.all, update->entry, &update->bytes)) {
+			fprintf(stderr, "Error! Firmware image is out of the update file.\n");
+			return -1;
+		}
+		gwu_span_t data = update->bytes;
+		if (read_update(&data, update)) { return -1; }
+	}
+	return 0;
+}
+
+// Finds the firmware image for one board and plays it, over the JTAG
+// session update_board() holds open
+static int play_board(board_t* b) {
+	gwu_session_t* s = &b->s;
+	jtag_t* jtag = s->jtag;
+
+	// Read the board's boardid digits, if any image cares, then its
+	// IDCODE with one scan
+	board_fingerprint_t fp = { 0 };
+	if (boardid_checked()) { read_boardid(jtag, &fp); }
+
+	s->found_devices = 0; // Reset found devices
+	s->found_idcode = 0;
+	s->idcode_match = 0;
+	s->cur_mode = LIBXSVF_MODE_SCAN;
+	if (libxsvf_play(&s->h, LIBXSVF_MODE_SCAN) < 0) {
+		fprintf(stderr, "%sError! Failed to scan JTAG chain.\n", s->prefix);
+		return -1;
+	}
+	fp.idcode = s->found_idcode;
+	fp.idcode_known = !(jtag->backend->flags & JTAG_NO_TDO);
+
+	// Take the first image for the board: looked up in the table of
+	// contents, or else checked one after another
+	const update_image_t* update = NULL;
+	if (toc.num_entries) {
+		int found = gwu_toc_lookup(&toc_index, fp.dsr, fp.ri, fp.dcd, fp.idcode, fp.idcode_known);
+		if (found >= 0) { update = &updates[found]; }
+	}
+	for (uint32_t update_index = 0; !toc.num_entries && update_index < num_updates; update_index++) {
+		if (image_accepts(&updates[update_index], &fp)) {
+			update = &updates[update_index];
+			break;
+		}
+	}
+
+	// Fail if no boards matched
+	if (!update) {
+		fprintf(stderr, "%sError! Firmware update is not compatible with this board.\n", s->prefix);
+		return -1;
+	}
+
+	// Make sure the image is intact before it goes anywhere near the board
+	if (update->entry && gwu_toc_verify(update->entry, update->bytes)) {
+		fprintf(stderr, "%sError! Firmware image is corrupt.\n", s->prefix);
+		return -1;
+	}
+
+	// Set firmware size limit
+	s->expected_bits = update->expected_bits;
+	s->info = update->info.predicted_ms ? &update->info : NULL;
+	s->getbyte_span = update->payload;
+	s->getbyte_lz = NULL;
+	if (update->compressed) {
+		lz_reader_open(&b->lz, update->payload);
+		s->getbyte_lz = &b->lz;
+	}
+
+	// Plan which TDO-checked scans to compare
+	b->verify = verify_policy;
+	int planned = gwu_verify_plan(&b->verify, update->mode, update->payload, update->compressed);
+	if (planned == GWU_VERIFY_PLAN_ERROR) {
+		fprintf(stderr, "%sError! Could not plan verification of firmware image.\n", s->prefix);
+		return -1;
+	}
+	else if (planned == GWU_VERIFY_PLAN_FULL) {
+		fprintf(stderr, "%sDeferred verify is not possible for this firmware image, verifying in full.\n", s->prefix);
+	}
+	s->verify = &b->verify;
+	if (b->verify.program) {
+		// Deferred verify programs from its own copy of the update
+		s->getbyte_span.p = b->verify.program;
+		s->getbyte_span.len = b->verify.program_len;
+		s->getbyte_lz = NULL;
+	}
+
+	// Reset bit count and start elapsed time timer
+	gwu_session_start(s);
+
+	// Play update (X)SVF
+	if (!s->label) { fputc('\n', stderr); }
+	s->cur_mode = update->mode;
+	b->played = 1;
+	int play_result = libxsvf_play(&s->h, update->mode);
+
+	// Deferred verify plays the checked sections again, now comparing,
+	// and then the rest of the update
+	if (play_result >= 0 && b->verify.pass) {
+		printshortinfo_unconditional(s, jtag_ticks(jtag));
+		fprintf(stderr, "%sVerifying update...\n", s->prefix);
+		if (!s->label) { fputc('\n', stderr); }
+		s->getbyte_span.p = b->verify.pass;
+		s->getbyte_span.len = b->verify.pass_len;
+		s->getbyte_lz = NULL;
+		s->cur_mode = LIBXSVF_MODE_OPS;
+		gwu_verify_start_pass(&b->verify);
+		play_result = libxsvf_play(&s->h, LIBXSVF_MODE_OPS);
+	}
+	gwu_session_stop(s);
+	printshortinfo_unconditional(s, s->finish);
+	if (play_result < 0) {
+		fprintf(stderr, "%sError! Failed to play (X)SVF.\n", s->prefix);
+		return -1;
+	}
+	return 0;
+}
+
+// Opens one board's adapter once for the boardid check, the chain scan
+// and every play, and updates it. Runs on its own thread when several
+// boards are updated at once, so it reports errors with the board's
+// prefix and returns instead of quitting.
+static int update_board(void* arg) {
+	board_t* b = (board_t*)arg;
+	if (jtag_session_begin(b->s.jtag)) {
+		fprintf(stderr, "%sError! Failed to open JTAG connection.\n", b->s.prefix);
+		return -1;
+	}
+	int result = play_board(b);
+	jtag_session_end(b->s.jtag);
+	return result;
+}
+
 int main(int argc, char** argv)
 {
-	enum libxsvf_mode mode;
-	int portnum;
-	int driver_installed = 0;
-
-	// Set callback pointers
-	h.udelay = h_udelay;
-	h.setup = h_setup;
-	h.shutdown = h_shutdown;
-	h.getbyte = h_getbyte;
-	h.pulse_tck = h_pulse_tck;
-	h.pulse_sck = NULL;
-	h.set_trst = NULL;
-	h.set_frequency = h_set_frequency;
-	h.report_tapstate = h_report_tapstate;
-	h.report_device = h_report_device;
-	h.report_status = h_report_status;
-	h.report_error = h_report_error;
-	h.realloc = h_realloc;
-	h.user_data = &u;
+	int num_boards = 1;
+	int num_ports = 0;
+	char portnames[MAX_BOARDS][16] = { 0 };
+	const jtag_backend_t* backend = &jtag_ch340_backend;
+	const char* options[16];
+	int num_options = 0;
+	const char* timing = NULL;
+	int pipeline = 0;
+	gwu_verify_parse(&verify_policy, "full");
 
 	// Start driver check
 	driver_start_check();
@@ -439,20 +479,56 @@ int main(int argc, char** argv)
 	// Display copyright message
 	copyleft();
 
-	// Check for correct number of arguments
-	if (argc != 1) {
-		fprintf(stderr, "Error! Bad arguments.\n");
-		return quit(-1);
+	// Parse arguments
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			backend = jtag_find_backend(argv[++i]);
+			if (!backend) {
+				fprintf(stderr, "Error! Unknown JTAG backend \"%s\". Available backends:\n", argv[i]);
+				jtag_list_backends(stderr);
+				return quit(-1);
+			}
+		}
+		else if (!strcmp(argv[i], "-o") && i + 1 < argc && num_options < 16) {
+			options[num_options++] = argv[++i];
+		}
+		else if (!strcmp(argv[i], "-t") && i + 1 < argc) { timing = argv[++i]; }
+		else if (!strcmp(argv[i], "-w") && i + 1 < argc) { SetWaitSpin(atol(argv[++i])); }
+		else if (!strcmp(argv[i], "-P")) { pipeline = 1; }
+		else if (!strcmp(argv[i], "-v") && i + 1 < argc) {
+			if (gwu_verify_parse(&verify_policy, argv[++i])) {
+				fprintf(stderr, "Error! Unknown verify policy \"%s\".\n", argv[i]);
+				return quit(-1);
+			}
+		}
+		else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			num_boards = atoi(argv[++i]);
+			if (num_boards < 1 || num_boards > MAX_BOARDS) {
+				fprintf(stderr, "Error! Can update between 1 and %d boards at once.\n", MAX_BOARDS);
+				return quit(-1);
+			}
+		}
+		else if (!strcmp(argv[i], "-p") && i + 1 < argc && num_ports < MAX_BOARDS) {
+			strncpy(portnames[num_ports++], argv[++i], sizeof(portnames[0]) - 1);
+		}
+		else {
+			fprintf(stderr, "Error! Bad arguments.\n");
+			fprintf(stderr, "Usage: GWUpdate [-b <BACKEND>] [-t fixed|baud|drain] [-w <SPIN_US>] [-P] [-v full|sampled[:N[:SEED]]|deferred] [-n <BOARDS> | -p <PORT>...] [-o <KEY>=<VALUE>]...\n");
+			return quit(-1);
+		}
 	}
+	if (num_ports > 0) { num_boards = num_ports; }
 
-	// Open data file
-#ifndef _DEBUG
-	u.f = fopen(argv[0], "rb");
+	// Map data file
+#if !defined(_DEBUG) && defined(_WIN32)
+	int open_failed = image_open(&image, argv[0]);
+#elif !defined(_DEBUG)
+	int open_failed = image_open(&image, "/proc/self/exe");
 #else
-	u.f = fopen("Packager/GWUpdate_out.exe", "rb");
+	int open_failed = image_open(&image, "Packager/GWUpdate_out.exe");
 #endif
 
-	if (!u.f) {
+	if (open_failed) {
 		fprintf(stderr,
 #ifndef _DEBUG
 			"Error! Failed to open GWUpdate executable as data file."
@@ -463,38 +539,70 @@ int main(int argc, char** argv)
 		return quit(-1);
 	}
 
+	// Read the table of contents. Update files without one are searched
+	// for signatures at 128k boundaries.
+	if (!gwu_toc_read(image.all, &toc) && gwu_toc_index_build(&toc_index, &toc)) {
+		fprintf(stderr, "Error! Could not allocate table of contents.\n");
+		return quit(-1);
+	}
+
 	// Find embedded driver file
+	gwu_span_t data;
 	char sig[4];
 	sig[0] = 'D';
 	sig[1] = 'R';
 	sig[2] = 'V';
 	sig[3] = 'R';
-	if (file_search128k(u.f, sig)) {
+	int has_driver;
+	if (toc.num_entries) {
+		const gwu_toc_entry_t* entry = gwu_toc_find(&toc, sig);
+		has_driver = entry != NULL;
+		if (entry && (gwu_toc_span(image.all, entry, &data) || gwu_toc_verify(entry, data))) {
+			fprintf(stderr, "Error! Driver installer in update file is corrupt.\n");
+			return quit(-1);
+		}
+	}
+	else { has_driver = image_find128k(&image, sig, &data); }
+	if (has_driver) {
 		// Check for driver and install it not currently present
 		if (!driver_finish_check()) {
 			fprintf(stderr, "Installing driver...");
-			if (driver_install(u.f)) {
+			if (driver_install(data)) {
 				fprintf(stderr, "Error! Failed to install driver.\n");
 				return quit(-1);
 			}
 		}
 	}
 
-	// Find embedded update file and fail if not found
-	sig[0] = 'U';
-	sig[1] = 'P';
-	sig[2] = 'D';
-	sig[3] = '8';
-	if (!file_search128k(u.f, sig)) {
-		fprintf(stderr, "Error! Update file signature not found.\n");
-		return quit(-1);
+	if (toc.num_entries) {
+		// The table lists the instructions and every image itself
+		const gwu_toc_entry_t* entry = gwu_toc_find(&toc, "INST");
+		if (!entry || gwu_toc_span(image.all, entry, &data) || gwu_toc_verify(entry, data)) {
+			fprintf(stderr, "Error! Instructions in update file are missing or corrupt.\n");
+			return quit(-1);
+		}
+		image_info = 1;
+		num_updates = toc_index.num_images;
 	}
+	else {
+		// Find embedded update file and fail if not found. "UPD8" is the
+		// same without image info.
+		sig[0] = 'U';
+		sig[1] = 'P';
+		sig[2] = 'D';
+		sig[3] = '9';
+		image_info = image_find128k(&image, sig, &data);
+		sig[3] = '8';
+		if (!image_info && !image_find128k(&image, sig, &data)) {
+			fprintf(stderr, "Error! Update file signature not found.\n");
+			return quit(-1);
+		}
 
-	// Read number of update images from update file
-	uint32_t num_updates;
-	if (!fread(&num_updates, sizeof(uint32_t), 1, u.f)) { // Couldn't read idcode
-		fprintf(stderr, "Error! Couldn't read number of firmware images in update file.\n");
-		return quit(-1);
+		// Read number of update images from update file
+		if (span_read(&data, &num_updates, sizeof(uint32_t))) { // Couldn't read idcode
+			fprintf(stderr, "Error! Couldn't read number of firmware images in update file.\n");
+			return quit(-1);
+		}
 	}
 
 	// Fail if number of updates is 0
@@ -504,177 +612,145 @@ int main(int argc, char** argv)
 	}
 
 	// Print first instructions text from update file
-	while (1) {
-		int c = fgetc(u.f);
-		if (c == EOF || c == 0) { break; }
-		else { fputc(c, stderr); }
-	}
+	const char* instructions = span_str(&data);
+	if (instructions) { fputs(instructions, stderr); }
 	get_enter(); // Wait for enter key
 
 	// Enumerate COM ports
-	comsearch();
+	int pick_ports = (backend->flags & JTAG_NEEDS_PORT) && num_ports == 0;
+	if (pick_ports) { comsearch(); }
 
 	// Print second instructions text from update file
-	while (1) {
-		int c = fgetc(u.f);
-		if (c == EOF || c == 0) { break; }
-		else { fputc(c, stderr); }
-	}
+	instructions = span_str(&data);
+	if (instructions) { fputs(instructions, stderr); }
 	get_enter(); // Wait for enter key
 
-	// Pick COM port
-	if ((portnum = compick(portname)) <= 0) {
-		fprintf(stderr, "Error! Could not find USB device.\n");
-		return quit(-1);
-	}
-
-	// Check each update until one with matching boardid and IDCODE
-	uint32_t fwsize = 0;
-	int matched_board = 0;
-	for (uint32_t update_index = 0; update_index < num_updates; update_index++) {
-		// Get (X)SVF file type flag
-		int c[4];
-		for (int i = 0; i < 4; i++) { c[i] = fgetc(u.f); }
-
-		// Check update file type - SVF or XSVF
-		if (c[0] == 'X') { mode = LIBXSVF_MODE_XSVF; } // First 'X' for XSVF
-		else if (c[0] == ' ') { mode = LIBXSVF_MODE_SVF; } // First ' ' for SVF
-		else { c[1] = EOF; }
-		if ((c[1] != 'S') || (c[2] != 'V') || (c[3] != 'F')) {
-			fprintf(stderr, "Error! Unsupported firmware image format: \"");
-
-			return quit(-1);
-		}
-
-		// Get boardid digits
-		boardid_digit_t boardid_dsr;
-		boardid_digit_t boardid_ri;
-		boardid_digit_t boardid_dcd;
-		boardid_digit_t boardid_reserved;
-		if (read_boardid_digit(u.f, &boardid_dsr, 0) ||
-			read_boardid_digit(u.f, &boardid_ri, 1) ||
-			read_boardid_digit(u.f, &boardid_dcd, 2) ||
-			read_boardid_digit(u.f, &boardid_reserved, 3)) {
-			fprintf(stderr, "Error! Could not read boardid digits from update image.\n");
-			return quit(-1);
-		}
+	// Read every firmware image header once; all boards share them
+	if (toc.num_entries ? read_updates_toc() : read_updates(&data)) { return quit(-1); }
 
-		// Get expected bit count from update file
-		if (!fread(&expected_bits, sizeof(uint32_t), 1, u.f)) {
-			fprintf(stderr, "Error! Could not read expected bit count from update image.\n");
+	// Pick COM ports, one new one per board
+	if (pick_ports && num_boards == 1) {
+		if (compick(portnames[0]) <= 0) {
+			fprintf(stderr, "Error! Could not find USB device.\n");
 			return quit(-1);
 		}
-
-		// Read number of devices on JTAG chain
-		if (!fread(&expected_devices, sizeof(uint32_t), 1, u.f)) {
-			fprintf(stderr, "Error! Could not read JTAG device count from update image.\n");
+	}
+	else if (pick_ports) {
+		int found = compick_all(portnames, MAX_BOARDS);
+		if (found != num_boards) {
+			fprintf(stderr, "Error! Expected %d new USB devices but found %d.\n", num_boards, found);
 			return quit(-1);
 		}
+	}
 
-		// Fail if number of devices isn't 1
-		if (expected_devices > 1) {
-			fprintf(stderr, "Error! Update image has multiple devices on JTAG chain but GWUpdate only supports one device.\n");
+	// Create a JTAG connection and session for each board
+	board_t* boards = calloc(num_boards, sizeof(board_t));
+	if (!boards) {
+		fprintf(stderr, "Error! Could not allocate boards.\n");
+		return quit(-1);
+	}
+	for (int n = 0; n < num_boards; n++) {
+		board_t* b = &boards[n];
+		memcpy(b->portname, portnames[n], sizeof(b->portname));
+		jtag_t* jtag = jtag_new(backend, b->portname);
+		if (!jtag) {
+			fprintf(stderr, "Error! Could not allocate JTAG backend.\n");
 			return quit(-1);
 		}
-		else if (expected_devices == 0) {
-			fprintf(stderr, "Error! Update image has no devices on JTAG chain.\n");
-			return quit(-1);
+		for (int i = 0; i < num_options; i++) {
+			if (jtag_configure(jtag, options[i])) {
+				fprintf(stderr, "Error! Backend \"%s\" does not accept option \"%s\".\n",
+					backend->name, options[i]);
+				return quit(-1);
+			}
 		}
-		found_devices = 0; // Reset found devices
-
-		// Read single expected IDCODE from update file
-		if (!fread(&expected_idcode, sizeof(uint32_t), 1, u.f)) { // Couldn't read idcode
-			fprintf(stderr, "Error! Couldn't read JTAG idcode from file.\n");
+		if (timing && jtag_set_timing(jtag, timing)) {
+			fprintf(stderr, "Error! Backend \"%s\" does not support timing profile \"%s\".\n",
+				backend->name, timing);
 			return quit(-1);
 		}
-
-		// Read update image length from update file
-		if (!fread(&fwsize, sizeof(uint32_t), 1, u.f)) { // Couldn't read length
-			fprintf(stderr, "Error! Couldn't read firmware image length from file.\n");
+		if (pipeline && jtag_set_pipeline(jtag, 1)) {
+			fprintf(stderr, "Error! Could not allocate JTAG pipeline.\n");
 			return quit(-1);
 		}
 
-		// Check for expected board ID
-		io_setup();
-		if (check_boardid_digit(io_dsr, boardid_dsr) ||
-			check_boardid_digit(io_ri, boardid_ri) ||
-			check_boardid_digit(io_dcd, boardid_dcd)) {
-			goto wrong_type;
+		// Label boards by port, without the /dev/ on Linux
+		const char* label = NULL;
+		if (num_boards > 1) {
+			if (b->portname[0]) {
+				const char* slash = strrchr(b->portname, '/');
+				snprintf(b->label, sizeof(b->label), "%s", slash ? slash + 1 : b->portname);
+			}
+			else { snprintf(b->label, sizeof(b->label), "#%d", n + 1); }
+			label = b->label;
 		}
-		io_shutdown();
-
-		// Scan JTAG chain
-		idcode_match = expected_idcode;
-		cur_mode = LIBXSVF_MODE_SCAN;
-		if (libxsvf_play(&h, LIBXSVF_MODE_SCAN) < 0) {
-			fprintf(stderr, "Error! Failed to scan JTAG chain.\n");
+		gwu_session_init(&b->s, jtag, label);
+		if (gwu_session_reserve(&b->s, &marks)) {
+			fprintf(stderr, "Error! Could not reserve memory for the update.\n");
 			return quit(-1);
 		}
+	}
 
-		// Check for expected IDCODE
-		if (expected_idcode != 0 &&
-			expected_idcode != -1 &&
-			expected_idcode != found_idcode) {
-			goto wrong_type;
+	// Update a single board here, or every board on its own thread
+	if (num_boards == 1) { boards[0].result = update_board(&boards[0]); }
+	else {
+		gwu_thread_t threads[MAX_BOARDS];
+		int started[MAX_BOARDS];
+		SetupTicks();
+		for (int n = 0; n < num_boards; n++) {
+			started[n] = !thread_start(&threads[n], update_board, &boards[n]);
+			if (!started[n]) {
+				fprintf(stderr, "%sError! Could not start update thread.\n", boards[n].s.prefix);
+				boards[n].result = -1;
+			}
 		}
-
-		// If everything is good, break out of the loop
-		matched_board = 1;
-		break;
-
-	wrong_type:
-		// Fast-forward through update (X)SVF if not last update
-		if (update_index != num_updates - 1) {
-			fseek(u.f, fwsize, SEEK_CUR);
+		for (int n = 0; n < num_boards; n++) {
+			if (started[n]) { boards[n].result = thread_join(threads[n]); }
 		}
-		continue; // Try again
 	}
 
-	// Fail if no boards matched
-	if (!matched_board) {
-		fprintf(stderr, "Error! Firmware update is not compatible with this board.\n");
-		return quit(-1);
+	// Report each board that got as far as playing its update
+	int num_failed = 0;
+	for (int n = 0; n < num_boards; n++) {
+		board_t* b = &boards[n];
+		if (b->result) { num_failed++; }
+		if (!b->played) { continue; }
+		if (b->s.label) { fprintf(stderr, "\n%s:\n", b->s.label); }
+		printinfo(&b->s);
 	}
-
-	// Set firmware size limit
-	getbyte_cur = 0;
-	getbyte_limit = fwsize;
-
-	// Reset bit count
-	u.bitcount_tdi = 0;
-	u.bitcount_tdo = 0;
-	u.clockcount = 0;
-	u.sendcount = 0;
-
-	// Start elapsed time timer
-	SetupTicks();
-	start = GetTicksNow();
-
-	// Play update (X)SVF
-	fputc('\n', stderr);
-	cur_mode = mode;
-	int play_result = libxsvf_play(&h, mode);
-	printshortinfo_unconditional(GetTicksNow());
-	if (play_result < 0) {
-		fprintf(stderr, "Error! Failed to play (X)SVF.\n");
-		printinfo();
-		fprintf(stderr, "-----------------\n");
-		fprintf(stderr, "| Update FAILED |\n");
-		fprintf(stderr, "-----------------\n");
-		return quit(-1);
+	if (num_boards == 1) {
+		if (!boards[0].played) { return quit(-1); }
+		if (boards[0].result) {
+			fprintf(stderr, "-----------------\n");
+			fprintf(stderr, "| Update FAILED |\n");
+			fprintf(stderr, "-----------------\n");
+			return quit(-1);
+		}
+		else {
+			fprintf(stderr, "---------------------\n");
+			fprintf(stderr, "| Update SUCCESSFUL |\n");
+			fprintf(stderr, "---------------------\n");
+		}
 	}
 	else {
-		printinfo();
-		fprintf(stderr, "---------------------\n");
-		fprintf(stderr, "| Update SUCCESSFUL |\n");
-		fprintf(stderr, "---------------------\n");
+		fprintf(stderr, "------------------------------------\n");
+		for (int n = 0; n < num_boards; n++) {
+			fprintf(stderr, "| %-12s | Update %-10s |\n", boards[n].label,
+				boards[n].result ? "FAILED" : "SUCCESSFUL");
+		}
+		fprintf(stderr, "------------------------------------\n");
+		fprintf(stderr, "%d of %d boards updated.\n", num_boards - num_failed, num_boards);
 	}
 
-	LONGLONG end = GetTicksNow() - start;
-	double elapsed = (double)end / ticks_per_ms / 1000.0f;
-
 	// Close file
-	fclose(u.f);
+	for (int n = 0; n < num_boards; n++) {
+		gwu_session_free(&boards[n].s);
+		gwu_verify_free(&boards[n].verify);
+		jtag_free(boards[n].s.jtag);
+	}
+	free(boards);
+	free(updates);
+	image_close(&image);
 
-	return quit(0);
+	return quit(num_failed ? -1 : 0);
 }
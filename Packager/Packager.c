@@ -8,6 +8,11 @@
 #include <stdio.h>
 #include "../boardid.h"
 #include "../streamtools.h"
+#include "../opscomp.h"
+#include "../gwu_lz.h"
+#include "../gwu_image.h"
+#include "../gwu_profile.h"
+#include "../gwu_toc.h"
 
 char buf[256];
 
@@ -23,7 +28,8 @@ boardid_digit_t parse_boardid_digit(const char* digit, const char* fail_message)
 
 int main(int argc, char** argv)
 {
-	uint32_t expected_bits;
+	uint32_t expected_bits; // 0 to take the dry pass's count
+	gwu_latency_t latency = gwu_latency_default;
 	boardid_digit_t boardid_dsr;
 	boardid_digit_t boardid_ri;
 	boardid_digit_t boardid_dcd;
@@ -39,13 +45,13 @@ int main(int argc, char** argv)
 
 	FILE* gwupdate_file;
 	FILE* driver_file = NULL;
-	FILE* update_file;
+	gwu_image_t update_image;
 	FILE* inst1_file = NULL;
 	FILE* inst2_file = NULL;
 	FILE* out_file;
 
 	if (argc == 1) { // Default arguments
-		expected_bits = 799341;
+		expected_bits = 0;
 		boardid_dsr = BOARDID_DIGIT_1;
 		boardid_ri = BOARDID_DIGIT_1;
 		boardid_dcd = BOARDID_DIGIT_1;
@@ -58,8 +64,8 @@ int main(int argc, char** argv)
 		driver_name = "../Driver/CH341SER.exe";
 		out_name = "GWUpdate_out.exe";
 	}
-	else if (argc == 12) {
-		expected_bits = strtol(argv[1], NULL, 10);
+	else if (argc == 12 || argc == 13) {
+		expected_bits = strcmp(argv[1], "auto") ? strtol(argv[1], NULL, 10) : 0;
 		boardid_dsr = parse_boardid_digit(argv[2], "Error! Bad BOARDID_DSR.");
 		boardid_ri = parse_boardid_digit(argv[3], "Error! Bad BOARDID_RI.\n");
 		boardid_dcd = parse_boardid_digit(argv[4], "Error! Bad BOARDID_DCD.\n");
@@ -70,6 +76,10 @@ int main(int argc, char** argv)
 		gwupdate_name = argv[9];
 		driver_name = argv[10];
 		out_name = argv[11];
+		if (argc == 13 && gwu_latency_parse(&latency, argv[12])) {
+			fputs("Error! Bad LATENCY, expected line=NS,run=NS,clock=NS,sample=NS.\n", stderr);
+			return -1;
+		}
 
 		is_xsvf = (update_name[strlen(update_name) - 4] == 'X') ||
 			(update_name[strlen(update_name) - 4] == 'x');
@@ -88,7 +98,7 @@ int main(int argc, char** argv)
 	}
 	else {
 		fputs("Usage: Packager "
-			"<EXPECTED_LENGTH> "
+			"<EXPECTED_LENGTH|auto> "
 			"<BOARDID_DSR> "
 			"<BOARDID_RI> "
 			"<BOARDID_DCD> "
@@ -98,7 +108,8 @@ int main(int argc, char** argv)
 			"<UPDATE> "
 			"<GWUPDATE> "
 			"<DRIVER> "
-			"<OUT>\n", stderr);
+			"<OUT> "
+			"[<LATENCY>]\n", stderr);
 		return -1;
 	}
 
@@ -116,13 +127,58 @@ int main(int argc, char** argv)
 		}
 	}
 
-	update_file = fopen(update_name, "rb");
-	if (!update_file) {
+	if (image_open(&update_image, update_name)) {
 		fputs("Error! Could not open update file.\n", stderr);
 		return -1;
 	}
 
-	out_file = fopen(out_name, "wb");
+	// Precompile update into an op-stream, unless it needs runtime TDO feedback
+	unsigned char* ops = NULL;
+	size_t ops_length = 0;
+	int compiled = ops_compile(update_image.all, is_xsvf ? LIBXSVF_MODE_XSVF : LIBXSVF_MODE_SVF, &ops, &ops_length);
+	if (compiled == OPS_COMPILE_ERROR) {
+		fputs("Error! Could not compile update file.\n", stderr);
+		return -1;
+	}
+	long update_length = (long)update_image.all.len;
+	if (compiled == OPS_COMPILE_OK) {
+		fprintf(stderr, "Compiled update to op-stream: %ld -> %lu bytes.\n", update_length, (unsigned long)ops_length);
+	}
+	else {
+		fputs("Update uses XSVF retries, packaging it uncompiled.\n", stderr);
+	}
+
+	// Payload is the op-stream, or the (X)SVF itself
+	gwu_span_t payload = update_image.all;
+	enum libxsvf_mode payload_mode = is_xsvf ? LIBXSVF_MODE_XSVF : LIBXSVF_MODE_SVF;
+	if (ops) {
+		payload.p = ops;
+		payload.len = ops_length;
+		payload_mode = LIBXSVF_MODE_OPS;
+	}
+
+	// Dry pass over the payload for what it needs in memory and how long
+	// it takes. An update that does not play here never will on a board.
+	gwu_info_t info;
+	if (gwu_profile_measure(&info.profile, payload, payload_mode)) {
+		fputs("Error! Update failed its dry pass.\n", stderr);
+		return -1;
+	}
+	gwu_profile_print(&info.profile, &latency, stderr);
+	info.latency = latency;
+	info.predicted_ms = (uint32_t)(gwu_profile_time(&info.profile, &latency) * 1000.0 + 0.5);
+	if (expected_bits && expected_bits != info.profile.clocks) {
+		fprintf(stderr, "Warning! EXPECTED_LENGTH is %lu but the update clocks %lu bits, using %lu.\n",
+			(unsigned long)expected_bits, (unsigned long)info.profile.clocks, (unsigned long)info.profile.clocks);
+	}
+	expected_bits = info.profile.clocks;
+
+	// Everything written is listed in the table of contents at the end
+	gwu_toc_entry_t toc[3];
+	uint32_t num_toc = 0;
+	memset(toc, 0, sizeof(toc));
+
+	out_file = fopen(out_name, "w+b"); // Read back for the checksums
 	if (!out_file) {
 		fputs("Error! Could not open output file.\n", stderr);
 		return -1;
@@ -153,6 +209,10 @@ int main(int argc, char** argv)
 		rewind(driver_file);
 
 		// Write driver file length
+		gwu_toc_entry_t* driver_entry = &toc[num_toc++];
+		memcpy(driver_entry->type, "DRVR", 4);
+		driver_entry->offset = (uint32_t)ftell(out_file);
+		driver_entry->length = sizeof(uint32_t) + driver_length;
 		fwrite(&driver_length, sizeof(uint32_t), 1, out_file);
 
 		if (file_writeall(out_file, driver_file)) {
@@ -166,11 +226,12 @@ int main(int argc, char** argv)
 		}
 	}
 
-	// Write update file signature "UPD8"
+	// Write update file signature "UPD9"
+	uint32_t update_offset = (uint32_t)ftell(out_file);
 	buf[0] = 'U';
 	buf[1] = 'P';
 	buf[2] = 'D';
-	buf[3] = '8';
+	buf[3] = '9';
 	fwrite(buf, 1, 4, out_file);
 
 	// Write number of updates (only 1 supported)
@@ -178,18 +239,37 @@ int main(int argc, char** argv)
 	fwrite(&num_updates, sizeof(uint32_t), 1, out_file);
 
 	// Write instructions 1
+	gwu_toc_entry_t* inst_entry = &toc[num_toc++];
+	memcpy(inst_entry->type, "INST", 4);
+	inst_entry->offset = (uint32_t)ftell(out_file);
 	if (inst1_file) { file_writeallstr(out_file, inst1_file); }
 	else { fputs(inst1, out_file); fputc(0, out_file); }
 
 	// Write instructions 2
 	if (inst2_file) { file_writeallstr(out_file, inst2_file); }
 	else { fputs(inst2, out_file); fputc(0, out_file); }
-
-	// Write update file type
-	buf[0] = is_xsvf ? 'X' : ' ';
-	buf[1] = 'S';
-	buf[2] = 'V';
-	buf[3] = 'F';
+	inst_entry->length = (uint32_t)ftell(out_file) - inst_entry->offset;
+
+	// Write update file type, lowercase since the payload is compressed
+	if (ops) {
+		buf[0] = ' ';
+		buf[1] = 'o';
+		buf[2] = 'p';
+		buf[3] = 's';
+	}
+	else {
+		buf[0] = is_xsvf ? 'x' : ' ';
+		buf[1] = 's';
+		buf[2] = 'v';
+		buf[3] = 'f';
+	}
+	gwu_toc_entry_t* image_entry = &toc[num_toc++];
+	memcpy(image_entry->type, buf, 4);
+	image_entry->offset = (uint32_t)ftell(out_file);
+	image_entry->boardid[0] = boardid_dsr;
+	image_entry->boardid[1] = boardid_ri;
+	image_entry->boardid[2] = boardid_dcd;
+	image_entry->idcode = idcode;
 	fwrite(buf, 1, 4, out_file);
 
 	// Write boardid digits
@@ -209,22 +289,40 @@ int main(int argc, char** argv)
 	// Write first (and only) device IDCODE
 	fwrite(&idcode, sizeof(uint32_t), 1, out_file);
 
-	// Compute and write update length
+	// Write the image info: the buffers GWUpdate reserves up front and
+	// the prediction its ETA is based on
+	if (gwu_info_write(out_file, &info)) {
+		fputs("Error! Could not write image info.\n", stderr);
+		return -1;
+	}
+
+	// Write placeholder update length, then the compressed payload
 	uint32_t length = 0;
-	// Get length of update_file
-	fseek(update_file, 0L, SEEK_END);
-	length += ftell(update_file);
-	rewind(update_file);
-	// Write update length
+	long length_pos = ftell(out_file);
 	fwrite(&length, sizeof(uint32_t), 1, out_file);
+	if (lz_compress(out_file, payload, &length)) {
+		fputs("Error! Could not compress update.\n", stderr);
+		return -1;
+	}
+	fprintf(stderr, "Compressed update payload: %ld -> %lu bytes.\n",
+		ops ? (long)ops_length : update_length, (unsigned long)length);
 
-	// Write (X)SVF image
-	file_writeall(out_file, update_file);
+	// Fill in update length
+	fseek(out_file, length_pos, SEEK_SET);
+	fwrite(&length, sizeof(uint32_t), 1, out_file);
+	fseek(out_file, 0L, SEEK_END);
+	image_entry->length = (uint32_t)ftell(out_file) - image_entry->offset;
+
+	if (gwu_toc_write(out_file, update_offset, toc, num_toc)) {
+		fputs("Error! Could not write table of contents.\n", stderr);
+		return -1;
+	}
 
 	// Close files
 	fclose(out_file);
-	fclose(update_file);
+	image_close(&update_image);
 	fclose(gwupdate_file);
+	free(ops);
 	if (inst2_file) { fclose(inst2_file); }
 	if (inst1_file) { fclose(inst1_file); }
 
@@ -1,8 +1,16 @@
 #include "comsearch.h"
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "gwu_time.h"
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 
+#ifdef _WIN32
 static int comexists(int portnum, char* nameout) {
 	char strbuf[1027];
 	char devname[8];
@@ -23,10 +31,61 @@ static int comexists(int portnum, char* nameout) {
 	}
 	else { return 0; }
 }
+#else
+// On Linux CH340 adapters appear as /dev/ttyUSB0, /dev/ttyUSB1, ...
+// Port number n refers to /dev/ttyUSB(n-1) so that 0 still means "none".
+static int comexists(int portnum, char* nameout) {
+	char devname[16];
+
+	if (portnum < 1 || portnum > 99) { return 0; }
+
+	snprintf(devname, sizeof(devname), "/dev/ttyUSB%d", portnum - 1);
+	if (access(devname, F_OK) == 0) {
+		if (nameout) { strcpy(nameout, devname); }
+		return 1;
+	}
+	else { return 0; }
+}
+#endif
 
 #define COM_START (1)
 #define COM_END (99)
 
+// A new COM port is ready once it opens; give up waiting for that after
+// COM_READY_MS, the fixed wait this used to be
+#define COM_READY_MS (1000)
+#define COM_POLL_MS (10)
+
+// comready(...) returns 1 if COM port portnum exists and can be opened
+static int comready(int portnum) {
+	char name[16];
+	if (!comexists(portnum, name)) { return 0; }
+#ifdef _WIN32
+	char path[24];
+	snprintf(path, sizeof(path), "\\\\.\\%s", name);
+	HANDLE port = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+	if (port == INVALID_HANDLE_VALUE) { return 0; }
+	CloseHandle(port);
+#else
+	int port = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (port < 0) { return 0; }
+	close(port);
+#endif
+	return 1;
+}
+
+// comwait(...) waits until each of the num COM ports in ports can be
+// opened, polling rather than sleeping for the worst case
+static void comwait(const int* ports, int num) {
+	SetupTicks();
+	LONGLONG give_up = GetTicksNow() + COM_READY_MS * ticks_per_ms;
+	for (int i = 0; i < num; ) {
+		if (comready(ports[i])) { i++; }
+		else if (GetTicksNow() >= give_up) { return; }
+		else { Sleep(COM_POLL_MS); }
+	}
+}
+
 // com_found array remembers which COM ports existed when comsearch was called
 static char com_found[COM_END + 1];
 
@@ -49,7 +108,8 @@ void comsearch() {
 // and if one single new COM port has been added since the last comsearch(),
 // then compick(...) returns that single new COM port's number.
 // Otherwise compick(...) returns 0.
-// The portname parameter is an optional pointer to a char[] of length 6.
+// The portname parameter is an optional pointer to a char[] of length 6
+// (16 on Linux, where it receives a /dev/ttyUSB device path).
 // If portname is nonnull and the return value from compick(...) is nonzero
 // (indicating a single new COM port was found), the name of the COM port
 // is stored at portname as a null-terminated string.
@@ -76,7 +136,7 @@ int compick(char* portname) {
 	}
 	if (found == 0) { return 0; } // Fail if nothing found
 
-	Sleep(1000); // Wait 1000 milliseconds.
+	comwait(&found, 1); // Wait until it opens.
 
 	// If we found something, check to make sure it still exists.
 	// Also pass portname to comexists so the portname is written back.
@@ -85,3 +145,29 @@ int compick(char* portname) {
 	// Otherwise if nothing found or it disappeared, return 0.
 	else { return 0; }
 }
+
+// compick_all(...) is compick(...) for several adapters plugged in at once.
+// It stores the names of up to max COM ports added since comsearch() was
+// called in portnames and returns how many there were. Like compick(...),
+// it returns 0 if a COM port found by the last comsearch() has gone away.
+int compick_all(char portnames[][16], int max) {
+	int found[COM_END + 1];
+	int num_found = 0;
+
+	// Collect every COM port that is new since comsearch()
+	for (int i = COM_START; i <= COM_END; i++) {
+		int exists = comexists(i, NULL);
+		if (exists && !com_found[i] && num_found < max) { found[num_found++] = i; }
+		else if (!exists && com_found[i]) { return 0; }
+	}
+	if (num_found == 0) { return 0; } // Fail if nothing found
+
+	comwait(found, num_found); // Wait until they open.
+
+	// Keep the ones that still exist, writing back their names
+	int num_kept = 0;
+	for (int i = 0; i < num_found; i++) {
+		if (comexists(found[i], portnames[num_kept])) { num_kept++; }
+	}
+	return num_kept;
+}
@@ -3,5 +3,6 @@
 
 void comsearch();
 int compick(char* portname);
+int compick_all(char portnames[][16], int max);
 
 #endif
@@ -0,0 +1,64 @@
+#include "gwu_arena.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGN (16) // Every region starts on this boundary
+
+void gwu_marks_merge(gwu_marks_t* m, const gwu_marks_t* other) {
+	if (other->scan_bits > m->scan_bits) { m->scan_bits = other->scan_bits; }
+	for (int i = 0; i < LIBXSVF_MEM_NUM; i++) {
+		if (other->mem[i] > m->mem[i]) { m->mem[i] = other->mem[i]; }
+	}
+}
+
+/* Arena */
+
+int gwu_arena_reserve(gwu_arena_t* a, const gwu_marks_t* m) {
+	gwu_arena_free(a);
+	size_t size = 0;
+	for (int i = 0; i < LIBXSVF_MEM_NUM; i++) {
+		size += (m->mem[i] + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	}
+	if (size == 0) { return 0; }
+
+	a->base = malloc(size);
+	if (!a->base) { return -1; }
+	a->size = size;
+	unsigned char* p = a->base;
+	for (int i = 0; i < LIBXSVF_MEM_NUM; i++) {
+		if (!m->mem[i]) { continue; }
+		a->slot[i] = p;
+		a->slot_size[i] = (int)m->mem[i];
+		p += (m->mem[i] + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	}
+	return 0;
+}
+
+void gwu_arena_free(gwu_arena_t* a) {
+	free(a->base);
+	memset(a, 0, sizeof(gwu_arena_t));
+}
+
+void* gwu_arena_realloc(gwu_arena_t* a, void* ptr, int size, enum libxsvf_mem which) {
+	unsigned char* region = a->slot[which];
+
+	// Slots without a region, and buffers that outgrew theirs, use the heap
+	if (!region || (ptr && ptr != region)) {
+		if (size == 0) {
+			free(ptr);
+			return NULL;
+		}
+		a->heap_allocs++;
+		return realloc(ptr, size);
+	}
+
+	if (size == 0) { return NULL; }
+	if (size <= a->slot_size[which]) { return region; }
+
+	// Too large for the region: move what it holds to the heap
+	void* p = malloc(size);
+	if (p && ptr) { memcpy(p, region, a->slot_size[which]); }
+	a->heap_allocs++;
+	return p;
+}
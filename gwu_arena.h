@@ -0,0 +1,38 @@
+#ifndef _GWU_ARENA_H
+#define _GWU_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "libxsvf.h"
+
+// What playing an image needs in memory: the largest buffer the players
+// ask for in each libxsvf_mem slot and the longest scan. Packager finds
+// these with a dry pass (gwu_profile.h) and stores them in the image
+// header.
+typedef struct gwu_marks_s {
+	uint32_t scan_bits;
+	uint32_t mem[LIBXSVF_MEM_NUM];
+} gwu_marks_t;
+
+// Raises each mark of m to at least the one in other
+void gwu_marks_merge(gwu_marks_t* m, const gwu_marks_t* other);
+
+// One block holding a region for every slot with a mark. Buffers in a
+// slot are handed its region while they fit, so a play allocates
+// nothing. Anything larger goes to the heap and is counted.
+typedef struct gwu_arena_s {
+	unsigned char* base; // NULL if nothing is reserved
+	size_t size;
+	unsigned char* slot[LIBXSVF_MEM_NUM];
+	int slot_size[LIBXSVF_MEM_NUM];
+	long heap_allocs; // Requests the regions could not hold
+} gwu_arena_t;
+
+// Reserves the regions for m. Returns 0 on success, -1 if out of memory.
+int gwu_arena_reserve(gwu_arena_t* a, const gwu_marks_t* m);
+void gwu_arena_free(gwu_arena_t* a);
+
+// realloc() for the libxsvf host. Freeing a region keeps it reserved.
+void* gwu_arena_realloc(gwu_arena_t* a, void* ptr, int size, enum libxsvf_mem which);
+
+#endif
@@ -1,6 +1,12 @@
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <termios.h>
+#include <unistd.h>
+#endif
 #include "gwu_console.h"
 
+#ifdef _WIN32
 int console_disable_echo() {
 	// Disable console echo
 	HANDLE h_stdin = GetStdHandle(STD_INPUT_HANDLE);
@@ -20,6 +26,22 @@ int console_enable_vt() {
 	if (!SetConsoleMode(h_stderr, mode)) { return -1; }
 	return 0;
 }
+#else
+int console_disable_echo() {
+	// Disable terminal echo
+	struct termios tio;
+	if (tcgetattr(STDIN_FILENO, &tio)) { return -1; }
+	tio.c_lflag &= ~ECHO;
+	if (tcsetattr(STDIN_FILENO, TCSANOW, &tio)) { return -1; }
+	return 0;
+}
+
+int console_enable_vt() {
+	// Terminals understand ASCII control codes already
+	if (!isatty(STDERR_FILENO)) { return -1; }
+	return 0;
+}
+#endif
 
 void get_enter() { while (getchar() != '\n'); }
 
@@ -0,0 +1,147 @@
+#include "gwu_dry.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "gwu_scan.h"
+
+#define DRY(_h) ((gwu_dry_t*)(_h)->user_data)
+
+static int d_setup(struct libxsvf_host* h) {
+	gwu_dry_t* d = DRY(h);
+	if (d->peep) { gwu_peep_reset(d->peep); }
+	return 0;
+}
+
+static int d_shutdown(struct libxsvf_host* h) {
+	gwu_dry_t* d = DRY(h);
+	if (d->peep) { gwu_peep_flush(d->peep); }
+	return 0;
+}
+
+static void d_udelay(struct libxsvf_host* h, long usecs, int tms, long num_tck) {
+	gwu_dry_t* d = DRY(h);
+	if (!d->peep) { return; }
+	if (num_tck > 0) { gwu_peep_clock(d->peep, tms, -1, num_tck, 1); }
+	if (usecs > 0) { gwu_peep_delay(d->peep, usecs); }
+}
+
+static int d_getbyte(struct libxsvf_host* h) {
+	gwu_dry_t* d = DRY(h);
+	if (d->src.len == 0) { return EOF; }
+	d->src.len--;
+	return *d->src.p++;
+}
+
+static int d_getbytes(struct libxsvf_host* h, unsigned char* buf, int n) {
+	gwu_dry_t* d = DRY(h);
+	size_t k = d->src.len < (size_t)n ? d->src.len : (size_t)n;
+	memcpy(buf, d->src.p, k);
+	d->src.p += k;
+	d->src.len -= k;
+	return (int)k;
+}
+
+static const unsigned char* d_getspan(struct libxsvf_host* h, long max, long* len) {
+	gwu_dry_t* d = DRY(h);
+	if (!d->lend) { return NULL; }
+	const unsigned char* data = d->src.p;
+	*len = d->src.len < (size_t)max ? (long)d->src.len : max;
+	d->src.p += *len;
+	d->src.len -= *len;
+	return data;
+}
+
+static int d_pulse_tck(struct libxsvf_host* h, int tms, int tdi, int tdo, int rmask, int sync) {
+	gwu_dry_t* d = DRY(h);
+	d->clocks++;
+	if (tdi >= 0) { d->tdi_bits++; }
+	if (!sync && tdo < 0) {
+		if (d->peep) { gwu_peep_clock(d->peep, tms, tdi, 1, 0); }
+		return 0;
+	}
+	if (tdo >= 0) { d->tdo_bits++; }
+	if (d->peep) {
+		gwu_peep_sample(d->peep, tms, tdi);
+		gwu_peep_flush(d->peep);
+	}
+	return tdo >= 0 ? tdo : 0;
+}
+
+// Runs of one TMS value, as h_pulse_tms() sends them
+static void d_pulse_tms(struct libxsvf_host* h, int tms_bits, int count) {
+	gwu_dry_t* d = DRY(h);
+	d->clocks += count;
+	if (!d->peep) { return; }
+	for (int i = 0; i < count; ) {
+		int tms = (tms_bits >> i) & 1;
+		int n = 1;
+		while (i + n < count && ((tms_bits >> (i + n)) & 1) == tms) { n++; }
+		gwu_peep_clock(d->peep, tms, -1, n, 0);
+		i += n;
+	}
+}
+
+static int d_shift_vector(struct libxsvf_host* h, const struct libxsvf_shift* s) {
+	gwu_dry_t* d = DRY(h);
+	if (d->hooks->scan) { d->hooks->scan(d->user, s); }
+	d->clocks += s->len;
+	if (!d->peep) { return 0; }
+
+	int num_sampled = 0;
+	gwu_scan_part_t part;
+	for (int k = 0; k < s->len; k += part.n) {
+		gwu_scan_part(s, k, &part);
+		d->tdi_bits += part.tdi_bits;
+		if (part.sample) {
+			if (part.checked) { d->tdo_bits++; }
+			gwu_peep_sample(d->peep, part.tms, part.tdi);
+			num_sampled++;
+		}
+		else { gwu_peep_clock(d->peep, part.tms, part.tdi, part.n, 0); }
+	}
+	if (num_sampled) { gwu_peep_flush(d->peep); }
+	return 0;
+}
+
+static int d_set_frequency(struct libxsvf_host* h, int v) { return 0; }
+
+static void d_report_error(struct libxsvf_host* h, const char* file, int line, const char* message) {
+	if (DRY(h)->report_errors) { fprintf(stderr, "[%s:%d] %s\n", file, line, message); }
+}
+
+static void* d_realloc(struct libxsvf_host* h, void* ptr, int size, enum libxsvf_mem which) {
+	gwu_dry_t* d = DRY(h);
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+	if (d->hooks->alloc) { d->hooks->alloc(d->user, size, which); }
+	return realloc(ptr, size);
+}
+
+void gwu_dry_init(gwu_dry_t* d, gwu_span_t src, const gwu_dry_hooks_t* hooks, void* user) {
+	static const gwu_dry_hooks_t no_hooks = { 0 };
+	memset(d, 0, sizeof(gwu_dry_t));
+	d->src = src;
+	d->hooks = hooks ? hooks : &no_hooks;
+	d->user = user;
+	struct libxsvf_host* h = &d->h;
+	h->setup = d_setup;
+	h->shutdown = d_shutdown;
+	h->udelay = d_udelay;
+	h->getbyte = d_getbyte;
+	h->getbytes = d_getbytes;
+	h->getspan = d_getspan;
+	h->pulse_tck = d_pulse_tck;
+	h->pulse_tms = d_pulse_tms;
+	h->shift_vector = d_shift_vector;
+	h->set_frequency = d_set_frequency;
+	h->report_error = d_report_error;
+	h->realloc = d_realloc;
+	h->user_data = d;
+}
+
+int gwu_dry_play(gwu_dry_t* d, enum libxsvf_mode mode) {
+	return libxsvf_play(&d->h, mode);
+}
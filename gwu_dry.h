@@ -0,0 +1,48 @@
+#ifndef _GWU_DRY_H
+#define _GWU_DRY_H
+
+#include <stdint.h>
+#include "libxsvf.h"
+#include "gwu_image.h"
+#include "gwu_peep.h"
+
+// A libxsvf host with no adapter behind it, for passes that only look
+// at what a play would do: Packager's profile (gwu_profile.h), the
+// verify planner (gwu_verify.h) and Bench's parser timing. Every
+// compared bit matches, so XSVF retries never happen.
+
+// What the pass sees, each optional
+typedef struct gwu_dry_hooks_s {
+	// Each scan whole, before it is split the way GWUpdate plays it
+	void (*scan)(void* user, const struct libxsvf_shift* s);
+	// Each buffer the players ask for
+	void (*alloc)(void* user, int size, enum libxsvf_mem which);
+} gwu_dry_hooks_t;
+
+typedef struct gwu_dry_s {
+	struct libxsvf_host h;
+	gwu_span_t src; // Consumed as it plays
+	const gwu_dry_hooks_t* hooks;
+	void* user;
+	int lend; // getspan() lends out the input instead of declining
+	int report_errors; // Print the players' errors to stderr
+
+	// If set, gets the clocks, samples and delays the way the GWUpdate
+	// host hands them to its optimizer, with the same flushes. Scans are
+	// only split with gwu_scan_part() if this is set.
+	gwu_peep_t* peep;
+
+	// Counted the way GWUpdate counts progress
+	uint32_t clocks; // RUNTEST clocks excluded
+	uint32_t tdi_bits;
+	uint32_t tdo_bits;
+} gwu_dry_t;
+
+// Sets up d to play src. Callers may clear callbacks of d->h, such as
+// getbytes(), to time the paths libxsvf takes without them.
+void gwu_dry_init(gwu_dry_t* d, gwu_span_t src, const gwu_dry_hooks_t* hooks, void* user);
+
+// Returns what libxsvf_play() returns
+int gwu_dry_play(gwu_dry_t* d, enum libxsvf_mode mode);
+
+#endif
@@ -0,0 +1,403 @@
+#include "gwu_host.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "gwu_time.h"
+#include "gwu_scan.h"
+
+char enable_vt;
+
+// Clocks per second since the play started. The progress line and the
+// summary both show this, so they agree.
+static double get_speed(gwu_session_t* s, double elapsed) {
+	return elapsed > 0.0 ? (double)s->u.clockcount / elapsed : 0.0;
+}
+
+void printinfo(gwu_session_t* s) {
+	LONGLONG end = (s->finish ? s->finish : jtag_ticks(s->jtag)) - s->start;
+	double elapsed = (double)end / ticks_per_ms / 1000.0f;
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Total number of clock cycles: %d\n", s->u.clockcount);
+	fprintf(stderr, "Number of significant TDI bits: %d\n", s->u.bitcount_tdi);
+	fprintf(stderr, "Number of significant TDO bits: %d\n", s->u.bitcount_tdo);
+	fprintf(stderr, "Number of TCK pulsetrains: %ld\n", s->peep.out.count.tck);
+	fprintf(stderr, "Time elapsed: %lf sec.\n", elapsed);
+	fprintf(stderr, "Speed: %lf bits / sec.\n", get_speed(s, elapsed));
+	if (s->verify) { gwu_verify_print(s->verify, stderr); }
+	fprintf(stderr, "Memory: %lu bytes reserved, %ld heap allocations.\n",
+		(unsigned long)s->arena.size, s->arena.heap_allocs);
+	fprintf(stderr, "\n");
+	gwu_peep_print_stats(&s->peep, stderr);
+	jtag_print_stats(s->jtag, stderr);
+	PrintWaitStats(stderr, s->finish ? &s->waits : GetWaitStats());
+	fprintf(stderr, "\n");
+}
+
+static void mark_progress(gwu_session_t* s, LONGLONG ticks) {
+	s->last_clockcount = s->u.clockcount;
+	s->last_ticks = ticks;
+}
+static float get_percent(gwu_session_t* s) {
+	float percent = 100.0f * (float)s->u.clockcount / s->expected_bits;
+	if (percent > 100.0f) { percent = 100.0f; }
+	return percent;
+}
+// Scales the time taken so far by what the dry pass predicts is left.
+// Returns -1 if the image has no prediction.
+static double get_eta(gwu_session_t* s, double elapsed) {
+	if (!s->info || !s->info->predicted_ms) { return -1.0; }
+	double total = s->info->predicted_ms / 1000.0;
+	gwu_profile_t sent;
+	gwu_profile_init(&sent);
+	gwu_profile_sent(&sent, &s->peep);
+	double done = gwu_profile_time(&sent, &s->info->latency);
+	if (done >= total) { return 0.0; }
+	if (done <= 0.0 || elapsed <= 0.0) { return total; }
+	return elapsed * (total - done) / done;
+}
+void printshortinfo_unconditional(gwu_session_t* s, LONGLONG ticks) {
+	LONGLONG end = ticks - s->start;
+	double elapsed = (float)end / ticks_per_ms / 1000.0f;
+	float percent = get_percent(s);
+	char eta[40] = "";
+	double eta_secs = get_eta(s, elapsed);
+	if (eta_secs >= 0.0) { snprintf(eta, sizeof(eta), "      ETA: %.1f sec.", eta_secs); }
+	mark_progress(s, ticks);
+	if (enable_vt && !s->label) {
+		fprintf(stderr,
+			"\033[1A\033[KUpdate in progress... %-4.1f%%      Bits: %d       Time: %.1f sec.      Speed: %.1f b/sec.%s\n",
+			percent, s->u.clockcount, elapsed, get_speed(s, elapsed), eta);
+	}
+	else {
+		fprintf(stderr,
+			"%sUpdate in progress... %-4.1f%%      Bits: %d       Time: %.1f sec.      Speed: %.1f b/sec.%s\n",
+			s->prefix, percent, s->u.clockcount, elapsed, get_speed(s, elapsed), eta);
+	}
+}
+static void printshortinfo(gwu_session_t* s) {
+	if (s->show_progress && s->cur_mode != LIBXSVF_MODE_SCAN) {
+		LONGLONG ticks = jtag_ticks(s->jtag);
+		LONGLONG since_last = ticks - s->last_ticks;
+		float time_since_last = (float)since_last / ticks_per_ms / 1000.0f;
+		int clocks_since_last = s->u.clockcount - s->last_clockcount;
+		if (time_since_last >= 0.09f || clocks_since_last >= 40) {
+			if (s->label) {
+				// Several boards share the console, so keep it to a line per 10%
+				int decile = (int)(get_percent(s) / 10.0f);
+				if (decile == s->last_decile) {
+					mark_progress(s, ticks);
+					return;
+				}
+				s->last_decile = decile;
+			}
+			printshortinfo_unconditional(s, ticks);
+		}
+	}
+}
+
+static int h_setup(struct libxsvf_host* h)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	if (!s->announced) {
+		fprintf(stderr, "%sOpening JTAG connection...\n", s->prefix);
+		fflush(stderr);
+		s->announced = 1;
+	}
+	gwu_peep_reset(&s->peep);
+	return jtag_open(s->jtag);
+}
+
+static int h_shutdown(struct libxsvf_host* h)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	gwu_peep_flush(&s->peep);
+	jtag_close(s->jtag);
+	return jtag_failed(s->jtag) ? -1 : 0;
+}
+
+// Fails the play once the adapter has, even if nothing was compared
+static int h_sync(struct libxsvf_host* h)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	return jtag_failed(s->jtag) ? -1 : 0;
+}
+
+static void h_udelay(struct libxsvf_host* h, long usecs, int tms, long num_tck)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	if (num_tck > 0) {
+		gwu_peep_clock(&s->peep, tms, -1, num_tck, 1);
+		printshortinfo(s);
+	}
+	if (usecs > 0) {
+		gwu_peep_delay(&s->peep, usecs);
+	}
+}
+
+static int h_getbyte(struct libxsvf_host* h)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	if (s->getbyte_lz) { return lz_getc(s->getbyte_lz); }
+	if (s->getbyte_span.len == 0) { return EOF; }
+	s->getbyte_span.len--;
+	return *s->getbyte_span.p++;
+}
+
+static int h_getbytes(struct libxsvf_host* h, unsigned char* buf, int n)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	if (s->getbyte_lz) { return (int)lz_read(s->getbyte_lz, buf, n); }
+	size_t k = s->getbyte_span.len < (size_t)n ? s->getbyte_span.len : (size_t)n;
+	memcpy(buf, s->getbyte_span.p, k);
+	s->getbyte_span.p += k;
+	s->getbyte_span.len -= k;
+	return (int)k;
+}
+
+// Compressed input is decoded a block at a time and cannot be lent out
+static const unsigned char* h_getspan(struct libxsvf_host* h, long max, long* len)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	if (s->getbyte_lz) { return NULL; }
+	const unsigned char* p = s->getbyte_span.p;
+	*len = s->getbyte_span.len < (size_t)max ? (long)s->getbyte_span.len : max;
+	s->getbyte_span.p += *len;
+	s->getbyte_span.len -= *len;
+	return p;
+}
+
+static int h_set_frequency(struct libxsvf_host* h, int v) { return 0; }
+
+static void h_report_tapstate(struct libxsvf_host* h)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	const char* message = libxsvf_state2str(h->tap_state);
+	char newmessage[40];
+	memset(newmessage, ' ', sizeof(newmessage) - 1);
+	newmessage[sizeof(newmessage) - 1] = 0;
+	memcpy(newmessage, message, strlen(message));
+	newmessage[strlen(message)] = ']';
+	//fprintf(stderr, "[%s  ", newmessage);
+	printshortinfo(s);
+}
+
+static void h_report_device(struct libxsvf_host* h, unsigned long idcode)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	if (s->idcode_match == 0 || s->idcode_match == GWU_ANY_IDCODE || idcode == s->idcode_match) {
+		printf("%sFound device on JTAG chain.      IDCODE=0x%08lx, REV=0x%01lx, PART=0x%04lx, MFR=0x%03lx\n",
+			s->prefix, idcode, (idcode >> 28) & 0xf, (idcode >> 12) & 0xffff, (idcode >> 1) & 0x7ff);
+	}
+
+	s->found_devices++;
+	s->found_idcode = idcode;
+	printshortinfo(s);
+}
+
+static void h_report_status(struct libxsvf_host* h, const char* message)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	char newmessage[33];
+	memset(newmessage, ' ', sizeof(newmessage) - 1);
+	newmessage[sizeof(newmessage) - 1] = 0;
+	if (strlen(message) < 33) {
+		memcpy(newmessage, message, strlen(message));
+		//fprintf(stderr, "[STATUS] %s ", newmessage);
+	}
+	else {
+		//fprintf(stderr, "[STATUS] %s ", message);
+	}
+	printshortinfo(s);
+}
+
+static void h_report_error(struct libxsvf_host* h, const char* file, int line, const char* message)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	fprintf(stderr, "%s[%s:%d] %s\n\n", s->prefix, file, line, message);
+}
+
+static void* h_realloc(struct libxsvf_host* h, void* ptr, int size, enum libxsvf_mem which)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	if (size > s->realloc_maxsize[which]) { s->realloc_maxsize[which] = size; }
+	return gwu_arena_realloc(&s->arena, ptr, size, which);
+}
+
+static int h_pulse_tck(struct libxsvf_host* h, int tms, int tdi, int tdo, int rmask, int sync)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+
+	s->u.clockcount++;
+	if (tdi >= 0) { s->u.bitcount_tdi++; }
+
+	if (!sync && tdo < 0) {
+		gwu_peep_clock(&s->peep, tms, tdi, 1, 0);
+		return 1;
+	}
+
+	if (tdo >= 0) { s->u.bitcount_tdo++; }
+	gwu_peep_sample(&s->peep, tms, tdi);
+	gwu_peep_flush(&s->peep);
+	int line_tdo = (jtag_sample_result(s->jtag) & JTAG_TDO) ? 1 : 0;
+	if (jtag_failed(s->jtag)) { return -1; }
+	if (s->jtag->backend->flags & JTAG_NO_TDO) { return tdo < 0 ? line_tdo : tdo; }
+	return tdo < 0 || line_tdo == tdo ? line_tdo : -1;
+}
+
+static void h_pulse_tms(struct libxsvf_host* h, int tms_bits, int count)
+{
+	gwu_session_t* s = (gwu_session_t*)h->user_data;
+	s->u.clockcount += count;
+
+	// The walk goes to the optimizer as runs of one TMS value
+	for (int i = 0; i < count; ) {
+		int tms = (tms_bits >> i) & 1;
+		int n = 1;
+		while (i + n < count && ((tms_bits >> (i + n)) & 1) == tms) { n++; }
+		gwu_peep_clock(&s->peep, tms, -1, n, 0);
+		i += n;
+	}
+}
+
+// Grows the TDO buffers to hold a scan of len bits
+static int reserve_scan(gwu_session_t* ses, int len)
+{
+	int nbytes = (len + 7) / 8;
+	if (nbytes > ses->captured_size) {
+		unsigned char* p = realloc(ses->captured, nbytes);
+		if (!p) { return -1; }
+		ses->captured = p;
+		ses->captured_size = nbytes;
+	}
+	if (len > ses->sampled_size) {
+		int* p = realloc(ses->sampled, len * sizeof(int));
+		if (!p) { return -1; }
+		ses->sampled = p;
+		ses->sampled_size = len;
+	}
+	return 0;
+}
+
+// Plays a whole scan. Bits that keep TMS and TDI and are not compared
+// go to the peephole optimizer as runs, and the TDO sampled on the
+// compared bits is checked against the expected vector in one pass.
+// Samples are only collected at the end, so a pipelined connection
+// keeps going through the scan. The adapter sees the same operations
+// as with one h_pulse_tck() per bit.
+static int h_shift_vector(struct libxsvf_host* h, const struct libxsvf_shift* s)
+{
+	gwu_session_t* ses = (gwu_session_t*)h->user_data;
+	udata_t* u = &ses->u;
+	int nbytes = (s->len + 7) / 8;
+
+	// Scans the verify policy skips are played as if nothing was expected
+	struct libxsvf_shift unchecked;
+	if (ses->verify && ses->cur_mode != LIBXSVF_MODE_SCAN &&
+		!gwu_verify_scan(ses->verify, s->tdo_data != NULL) && s->tdo_data) {
+		unchecked = *s;
+		unchecked.tdo_data = NULL;
+		unchecked.tdo_mask = NULL;
+		s = &unchecked;
+	}
+
+	if (s->len > ses->sampled_size) { ses->arena.heap_allocs++; } // Longer than reserved
+	if (reserve_scan(ses, s->len)) { return -1; }
+	unsigned char* captured = ses->captured;
+	memset(captured, 0, nbytes);
+	int num_sampled = 0;
+
+	u->clockcount += s->len;
+	gwu_scan_part_t part;
+	for (int k = 0; k < s->len; k += part.n) {
+		gwu_scan_part(s, k, &part);
+		u->bitcount_tdi += part.tdi_bits;
+		if (part.sample) {
+			if (part.checked) { u->bitcount_tdo++; }
+			gwu_peep_sample(&ses->peep, part.tms, part.tdi);
+			ses->sampled[num_sampled++] = k;
+		}
+		else {
+			gwu_peep_clock(&ses->peep, part.tms, part.tdi, part.n, 0);
+		}
+	}
+
+	if (num_sampled) { gwu_peep_flush(&ses->peep); }
+	for (int i = 0; i < num_sampled; i++) {
+		int bit = ses->sampled[i];
+		if (jtag_sample_result(ses->jtag) & JTAG_TDO) { captured[nbytes - 1 - bit / 8] |= 1 << (bit % 8); }
+	}
+	if (jtag_failed(ses->jtag)) { return -1; }
+
+	if (!s->tdo_data || (ses->jtag->backend->flags & JTAG_NO_TDO)) { return 0; }
+	for (int i = 0; i < nbytes; i++) {
+		int mask = s->tdo_mask ? s->tdo_mask[i] : 0xFF;
+		if (i == 0 && s->len % 8) { mask &= (1 << (s->len % 8)) - 1; }
+		if ((captured[i] ^ s->tdo_data[i]) & mask) { return -1; }
+	}
+	return 0;
+}
+
+void gwu_session_init(gwu_session_t* s, jtag_t* jtag, const char* label)
+{
+	memset(s, 0, sizeof(gwu_session_t));
+	s->jtag = jtag;
+	s->label = label;
+	if (label) { snprintf(s->prefix, sizeof(s->prefix), "[%s] ", label); }
+	s->show_progress = 1;
+	gwu_peep_init(&s->peep, jtag);
+
+	struct libxsvf_host* h = &s->h;
+	h->udelay = h_udelay;
+	h->setup = h_setup;
+	h->shutdown = h_shutdown;
+	h->sync = h_sync;
+	h->getbyte = h_getbyte;
+	h->getspan = h_getspan;
+	h->getbytes = h_getbytes;
+	h->pulse_tck = h_pulse_tck;
+	h->shift_vector = h_shift_vector;
+	h->pulse_tms = h_pulse_tms;
+	h->pulse_sck = NULL;
+	h->set_trst = NULL;
+	h->set_frequency = h_set_frequency;
+	h->report_tapstate = h_report_tapstate;
+	h->report_device = h_report_device;
+	h->report_status = h_report_status;
+	h->report_error = h_report_error;
+	h->realloc = h_realloc;
+	h->user_data = s;
+}
+
+void gwu_session_free(gwu_session_t* s)
+{
+	free(s->captured);
+	s->captured = NULL;
+	s->captured_size = 0;
+	free(s->sampled);
+	s->sampled = NULL;
+	s->sampled_size = 0;
+	gwu_arena_free(&s->arena);
+}
+
+int gwu_session_reserve(gwu_session_t* s, const gwu_marks_t* m)
+{
+	if (gwu_arena_reserve(&s->arena, m)) { return -1; }
+	return reserve_scan(s, (int)m->scan_bits);
+}
+
+void gwu_session_start(gwu_session_t* s)
+{
+	memset(&s->u, 0, sizeof(udata_t));
+	gwu_peep_clear_stats(&s->peep);
+	s->last_clockcount = 0;
+	s->last_ticks = 0;
+	s->last_decile = 0;
+	s->finish = 0;
+	s->start = jtag_ticks(s->jtag);
+}
+
+void gwu_session_stop(gwu_session_t* s)
+{
+	s->finish = jtag_ticks(s->jtag);
+	s->waits = *GetWaitStats();
+}
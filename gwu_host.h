@@ -0,0 +1,105 @@
+#ifndef _GWU_HOST_H
+#define _GWU_HOST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "libxsvf.h"
+#include "jtag.h"
+#include "gwu_lz.h"
+#include "gwu_verify.h"
+#include "gwu_peep.h"
+#include "gwu_arena.h"
+#include "gwu_profile.h"
+
+// libxsvf host callbacks driving a jtag_t, plus progress reporting.
+// Shared by GWUpdate and the Bench tool.
+
+typedef struct udata_s {
+	int clockcount;
+	int bitcount_tdi;
+	int bitcount_tdo;
+} udata_t;
+
+// Everything one board's play needs. Sessions share nothing but the
+// read-only image their spans point into, so each can run on its own
+// thread.
+typedef struct gwu_session_s {
+	struct libxsvf_host h;
+	jtag_t* jtag;
+	udata_t u;
+
+	// Port name when several sessions run at once, NULL for just one.
+	// Labelled sessions prefix their messages with "[label] " and print
+	// progress every 10% instead of redrawing one line.
+	const char* label;
+	char prefix[24];
+
+	uint32_t expected_devices;
+	uint32_t expected_idcode;
+	uint32_t found_devices;
+	uint32_t found_idcode;
+	uint32_t expected_bits;
+	unsigned long idcode_match;
+	enum libxsvf_mode cur_mode;
+	char show_progress; // Print "Update in progress..." lines
+	char announced; // "Opening JTAG connection..." was printed
+
+	// The (X)SVF or op-stream that h_getbyte() reads, consumed as it goes
+	gwu_span_t getbyte_span;
+	// If set, h_getbyte() decodes a compressed payload through it instead
+	lz_reader_t* getbyte_lz;
+
+	// Which TDO-checked scans to compare, NULL to compare all
+	gwu_verify_t* verify;
+
+	// jtag_ticks() when the current play started and ended, and the
+	// waits of the thread that played it
+	LONGLONG start;
+	LONGLONG finish;
+	wait_stats_t waits;
+
+	// When progress was last printed, or skipped within a 10% step
+	int last_clockcount;
+	LONGLONG last_ticks;
+	int last_decile;
+
+	// Clocks on their way to the adapter
+	gwu_peep_t peep;
+
+	// Packager's dry pass over the image being played, NULL if it has
+	// none. How far along the prediction what peep has sent is gives
+	// the ETA.
+	const gwu_info_t* info;
+
+	// TDO captured by h_shift_vector(), and the bits its samples belong to
+	unsigned char* captured;
+	int captured_size;
+	int* sampled;
+	int sampled_size;
+
+	// Buffers the players ask for come out of the arena. The largest
+	// size asked for in each slot is kept to compare with the marks.
+	gwu_arena_t arena;
+	int realloc_maxsize[LIBXSVF_MEM_NUM];
+} gwu_session_t;
+
+extern char enable_vt;
+
+// Sets up the host callbacks of s to drive jtag. label may be NULL.
+void gwu_session_init(gwu_session_t* s, jtag_t* jtag, const char* label);
+void gwu_session_free(gwu_session_t* s);
+
+// Reserves what playing images with marks m needs up front: the arena
+// and the buffers for the longest scan. Returns 0 on success, -1 if out
+// of memory.
+int gwu_session_reserve(gwu_session_t* s, const gwu_marks_t* m);
+
+// Clears the bit counts and progress history and starts the clock
+void gwu_session_start(gwu_session_t* s);
+// Stops the clock, on the thread that played, for printinfo()
+void gwu_session_stop(gwu_session_t* s);
+
+void printinfo(gwu_session_t* s);
+void printshortinfo_unconditional(gwu_session_t* s, LONGLONG ticks);
+
+#endif
@@ -0,0 +1,120 @@
+#include "gwu_image.h"
+
+#include <string.h>
+
+#define LEN128K (128 * 1024)
+
+#ifdef _WIN32
+#include <Windows.h>
+
+int image_open(gwu_image_t* img, const char* path) {
+	memset(img, 0, sizeof(gwu_image_t));
+
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) { return -1; }
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) {
+		CloseHandle(file);
+		return -1;
+	}
+	img->file = file;
+	if (size.QuadPart == 0) { return 0; } // Empty files cannot be mapped
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping) {
+		image_close(img);
+		return -1;
+	}
+	img->mapping = mapping;
+
+	img->all.p = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!img->all.p) {
+		image_close(img);
+		return -1;
+	}
+	img->all.len = (size_t)size.QuadPart;
+	return 0;
+}
+
+void image_close(gwu_image_t* img) {
+	if (img->all.p) { UnmapViewOfFile(img->all.p); }
+	if (img->mapping) { CloseHandle(img->mapping); }
+	if (img->file) { CloseHandle(img->file); }
+	memset(img, 0, sizeof(gwu_image_t));
+}
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int image_open(gwu_image_t* img, const char* path) {
+	memset(img, 0, sizeof(gwu_image_t));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) { return -1; }
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size > 0) {
+		void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			close(fd);
+			return -1;
+		}
+		img->all.p = p;
+		img->all.len = st.st_size;
+	}
+
+	// The mapping stays valid without the descriptor
+	close(fd);
+	return 0;
+}
+
+void image_close(gwu_image_t* img) {
+	if (img->all.p) { munmap((void*)img->all.p, img->all.len); }
+	memset(img, 0, sizeof(gwu_image_t));
+}
+#endif
+
+int image_find128k(const gwu_image_t* img, const char* sig, gwu_span_t* rest) {
+	for (size_t offset = LEN128K; offset + 4 <= img->all.len; offset += LEN128K) {
+		if (!memcmp(img->all.p + offset, sig, 4)) {
+			rest->p = img->all.p + offset + 4;
+			rest->len = img->all.len - offset - 4;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int span_read(gwu_span_t* s, void* to, size_t n) {
+	if (s->len < n) { return -1; }
+	memcpy(to, s->p, n);
+	s->p += n;
+	s->len -= n;
+	return 0;
+}
+
+int span_take(gwu_span_t* s, size_t n, gwu_span_t* taken) {
+	if (s->len < n) { return -1; }
+	taken->p = s->p;
+	taken->len = n;
+	s->p += n;
+	s->len -= n;
+	return 0;
+}
+
+const char* span_str(gwu_span_t* s) {
+	if (s->len == 0) { return NULL; }
+	const unsigned char* end = memchr(s->p, 0, s->len);
+	if (!end) { return NULL; }
+	const char* str = (const char*)s->p;
+	s->len -= end + 1 - s->p;
+	s->p = end + 1;
+	return str;
+}
@@ -0,0 +1,40 @@
+#ifndef _GWU_IMAGE_H
+#define _GWU_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A run of bytes inside a mapped image. Readers advance p and shrink len.
+typedef struct gwu_span_s {
+	const unsigned char* p;
+	size_t len;
+} gwu_span_t;
+
+// An image IDCODE that accepts any device, as 0 does
+#define GWU_ANY_IDCODE (0xFFFFFFFFu)
+
+// A read-only memory mapping of a whole file
+typedef struct gwu_image_s {
+	gwu_span_t all;
+	void* file;    // Windows file handle
+	void* mapping; // Windows file mapping handle
+} gwu_image_t;
+
+int image_open(gwu_image_t* img, const char* path);
+void image_close(gwu_image_t* img);
+
+// Looks for sig at each 128 kB boundary after the first. Returns 1 and
+// sets *rest to everything after the signature if found, else 0.
+int image_find128k(const gwu_image_t* img, const char* sig, gwu_span_t* rest);
+
+// Copies n bytes out of s and advances it. Returns -1 if s is too short.
+int span_read(gwu_span_t* s, void* to, size_t n);
+
+// Moves the next n bytes of s into *taken. Returns -1 if s is too short.
+int span_take(gwu_span_t* s, size_t n, gwu_span_t* taken);
+
+// Returns the null-terminated string at the start of s and advances past
+// it, or NULL if s holds no terminator.
+const char* span_str(gwu_span_t* s);
+
+#endif
@@ -0,0 +1,223 @@
+#include "gwu_lz.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define MIN_MATCH 4
+#define HASH_BITS 14
+#define MAX_PROBES 32
+#define MAX_OFFSET 65535
+
+static void put_u32(unsigned char* p, uint32_t v) {
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t hash4(const unsigned char* p) {
+	uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static unsigned char* put_length(unsigned char* o, uint32_t len) {
+	while (len >= 255) {
+		*o++ = 255;
+		len -= 255;
+	}
+	*o++ = len;
+	return o;
+}
+
+static unsigned char* put_sequence(unsigned char* o, const unsigned char* lit, uint32_t nlit, uint32_t match, uint32_t offset) {
+	unsigned char* token = o++;
+	*token = (nlit < 15 ? nlit : 15) << 4;
+	if (nlit >= 15) { o = put_length(o, nlit - 15); }
+	memcpy(o, lit, nlit);
+	o += nlit;
+	if (match) {
+		uint32_t m = match - MIN_MATCH;
+		*token |= m < 15 ? m : 15;
+		*o++ = offset;
+		*o++ = offset >> 8;
+		if (m >= 15) { o = put_length(o, m - 15); }
+	}
+	return o;
+}
+
+// Greedy hash-chain LZ77 over one block. Returns the compressed size, or
+// 0 if it would not fit in out_size bytes.
+static uint32_t compress_block(const unsigned char* in, uint32_t len, unsigned char* out, uint32_t out_size) {
+	static int32_t head[1 << HASH_BITS];
+	static uint16_t prev[LZ_BLOCK_SIZE];
+	unsigned char* o = out;
+	unsigned char* o_end = out + out_size;
+	uint32_t anchor = 0;
+	uint32_t i = 0;
+
+	for (int k = 0; k < (1 << HASH_BITS); k++) { head[k] = -1; }
+
+	while (i + MIN_MATCH <= len) {
+		uint32_t h = hash4(in + i);
+		uint32_t best_len = 0;
+		uint32_t best_off = 0;
+		int32_t cand = head[h];
+		for (int probes = 0; cand >= 0 && i - cand <= MAX_OFFSET && probes < MAX_PROBES; probes++) {
+			uint32_t l = 0;
+			while (i + l < len && in[cand + l] == in[i + l]) { l++; }
+			if (l > best_len) {
+				best_len = l;
+				best_off = i - cand;
+			}
+			if (prev[cand] == 0) { break; }
+			cand -= prev[cand];
+		}
+		prev[i] = head[h] >= 0 && i - head[h] <= MAX_OFFSET ? i - head[h] : 0;
+		head[h] = i;
+
+		if (best_len < MIN_MATCH) {
+			i++;
+			continue;
+		}
+
+		// Worst case for a sequence is its literals plus 1/255 overhead
+		if (o + (i - anchor) + (i - anchor) / 255 + best_len / 255 + 8 > o_end) { return 0; }
+		o = put_sequence(o, in + anchor, i - anchor, best_len, best_off);
+
+		// Index the matched bytes so later matches can refer into them
+		uint32_t end = i + best_len;
+		for (i++; i < end && i + MIN_MATCH <= len; i++) {
+			h = hash4(in + i);
+			prev[i] = head[h] >= 0 && i - head[h] <= MAX_OFFSET ? i - head[h] : 0;
+			head[h] = i;
+		}
+		i = end;
+		anchor = i;
+	}
+
+	if (o + (len - anchor) + (len - anchor) / 255 + 2 > o_end) { return 0; }
+	o = put_sequence(o, in + anchor, len - anchor, 0, 0);
+	return (uint32_t)(o - out);
+}
+
+int lz_compress(FILE* to, gwu_span_t from, uint32_t* length) {
+	unsigned char* out = malloc(LZ_BLOCK_SIZE + 8);
+	int rc = -1;
+	*length = 0;
+	if (!out) { goto done; }
+
+	while (from.len) {
+		uint32_t raw = from.len < LZ_BLOCK_SIZE ? (uint32_t)from.len : LZ_BLOCK_SIZE;
+		const unsigned char* in = from.p;
+		from.p += raw;
+		from.len -= raw;
+
+		uint32_t stored = compress_block(in, raw, out + 8, raw);
+		if (stored == 0 || stored >= raw) {
+			stored = raw;
+			memcpy(out + 8, in, raw);
+		}
+		put_u32(out, raw);
+		put_u32(out + 4, stored);
+		if (fwrite(out, 1, stored + 8, to) != stored + 8) { goto done; }
+		*length += stored + 8;
+	}
+	rc = 0;
+
+done:
+	free(out);
+	return rc;
+}
+
+void lz_reader_open(lz_reader_t* r, gwu_span_t payload) {
+	r->src = payload;
+	r->cur = NULL;
+	r->end = NULL;
+}
+
+static int decode_block(const unsigned char* in, uint32_t in_len, unsigned char* out, uint32_t out_len) {
+	const unsigned char* in_end = in + in_len;
+	unsigned char* o = out;
+	unsigned char* o_end = out + out_len;
+
+	while (in < in_end) {
+		int token = *in++;
+		uint32_t nlit = token >> 4;
+		if (nlit == 15) {
+			int c;
+			do {
+				if (in >= in_end) { return -1; }
+				c = *in++;
+				nlit += c;
+			} while (c == 255);
+		}
+		if (nlit > (uint32_t)(in_end - in) || nlit > (uint32_t)(o_end - o)) { return -1; }
+		memcpy(o, in, nlit);
+		o += nlit;
+		in += nlit;
+		if (in == in_end) { break; } // Last sequence has no match
+
+		if (in_end - in < 2) { return -1; }
+		uint32_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		uint32_t match = (token & 15) + MIN_MATCH;
+		if ((token & 15) == 15) {
+			int c;
+			do {
+				if (in >= in_end) { return -1; }
+				c = *in++;
+				match += c;
+			} while (c == 255);
+		}
+		if (offset == 0 || offset > (uint32_t)(o - out) || match > (uint32_t)(o_end - o)) { return -1; }
+
+		// Byte-wise so overlapping matches repeat their pattern
+		const unsigned char* m = o - offset;
+		for (uint32_t k = 0; k < match; k++) { o[k] = m[k]; }
+		o += match;
+	}
+	return o == o_end ? 0 : -1;
+}
+
+int lz_reader_refill(lz_reader_t* r) {
+	gwu_span_t header;
+	gwu_span_t block;
+	if (span_take(&r->src, 8, &header)) { goto fail; }
+	uint32_t raw = get_u32(header.p);
+	uint32_t stored = get_u32(header.p + 4);
+	if (raw == 0 || raw > LZ_BLOCK_SIZE || stored > raw || span_take(&r->src, stored, &block)) { goto fail; }
+
+	if (stored == raw) { r->cur = block.p; }
+	else {
+		if (decode_block(block.p, stored, r->out, raw)) { goto fail; }
+		r->cur = r->out;
+	}
+	r->end = r->cur + raw;
+	return *r->cur++;
+
+fail:
+	// Stay at EOF rather than resync on a later block
+	r->src.len = 0;
+	return EOF;
+}
+
+size_t lz_read(lz_reader_t* r, unsigned char* buf, size_t n) {
+	size_t done = 0;
+	while (done < n) {
+		if (r->cur == r->end) {
+			int c = lz_reader_refill(r);
+			if (c == EOF) { break; }
+			buf[done++] = (unsigned char)c;
+			continue;
+		}
+		size_t k = (size_t)(r->end - r->cur) < n - done ? (size_t)(r->end - r->cur) : n - done;
+		memcpy(buf + done, r->cur, k);
+		r->cur += k;
+		done += k;
+	}
+	return done;
+}
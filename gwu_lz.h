@@ -0,0 +1,47 @@
+#ifndef _GWU_LZ_H
+#define _GWU_LZ_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "gwu_image.h"
+
+// Block-compressed update payloads.
+//
+// A payload is a run of independently decodable blocks of at most
+// LZ_BLOCK_SIZE bytes each:
+//   u32 raw length, u32 stored length, stored bytes
+// A block whose stored length equals its raw length is stored as-is.
+// Otherwise it is LZ77 sequences, each a token byte (high nibble literal
+// count, low nibble match length - 4, 15 meaning more length bytes follow,
+// each added until one is below 255), the literals, and for all but the
+// last sequence a u16 match offset. All integers are little-endian.
+
+#define LZ_BLOCK_SIZE (64 * 1024)
+
+// Compresses from and appends the payload to to. The payload length is
+// stored in *length. Returns 0 on success.
+int lz_compress(FILE* to, gwu_span_t from, uint32_t* length);
+
+// Decodes a payload a block at a time. Stored blocks are read in place.
+typedef struct lz_reader_s {
+	gwu_span_t src;           // Blocks not yet decoded
+	const unsigned char* cur; // Next byte to return
+	const unsigned char* end; // End of the current block
+	unsigned char out[LZ_BLOCK_SIZE];
+} lz_reader_t;
+
+void lz_reader_open(lz_reader_t* r, gwu_span_t payload);
+
+// Returns EOF at the end of the payload or if it is malformed
+int lz_reader_refill(lz_reader_t* r);
+
+static inline int lz_getc(lz_reader_t* r) {
+	if (r->cur < r->end) { return *r->cur++; }
+	return lz_reader_refill(r);
+}
+
+// Copies up to n bytes to buf. Returns the number copied, fewer than n
+// only at the end of the payload.
+size_t lz_read(lz_reader_t* r, unsigned char* buf, size_t n);
+
+#endif
@@ -1,6 +1,8 @@
 #include "gwu_os.h"
 #include <stdint.h>
 #include <stdio.h>
+
+#ifdef _WIN32
 #include <Windows.h>
 
 #define BUF_LEN (16 * 1024 * 1024)
@@ -85,16 +87,14 @@ int driver_finish_check() {
 	else { return 0; }
 }
 
-int driver_install(FILE* driver_src) {
+int driver_install(gwu_span_t driver_src) {
 	// Get driver exe length
 	uint32_t driver_len;
-	if (!fread(&driver_len, sizeof(uint32_t), 1, driver_src)) { return -1; }
-
-	// Fail if driver exe too big
-	if (driver_len > BUF_LEN) { return -1; }
+	if (span_read(&driver_src, &driver_len, sizeof(uint32_t))) { return -1; }
 
-	// Read driver exe into buffer
-	if (fread(buf, 1, driver_len, driver_src) != driver_len) { return -1; }
+	// Get driver exe straight out of the mapped image
+	gwu_span_t driver;
+	if (span_take(&driver_src, driver_len, &driver)) { return -1; }
 
 	// Get temp directory
 	char temp_dir_name[MAX_PATH + 1];
@@ -120,7 +120,7 @@ int driver_install(FILE* driver_src) {
 	if (!temp_file) { return -1; }
 
 	// Write driver exe to temp file
-	if (fwrite(buf, 1, driver_len, temp_file) != driver_len) { return -1; }
+	if (fwrite(driver.p, 1, driver.len, temp_file) != driver.len) { return -1; }
 
 	// Close temp file
 	fclose(temp_file);
@@ -165,3 +165,14 @@ int os_is_wine() {
 	if (pwine_get_version) { return 1; }
 	else { return 0; }
 }
+#else
+// Linux ships the CH340 driver (ch341) in the kernel, so there is
+// never anything to check for or install.
+void driver_start_check() { }
+
+int driver_finish_check() { return 1; }
+
+int driver_install(gwu_span_t driver_src) { return -1; }
+
+int os_is_wine() { return 0; }
+#endif
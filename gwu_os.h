@@ -2,10 +2,11 @@
 #define _GWU_OS_H
 
 #include <stdio.h>
+#include "gwu_image.h"
 
 void driver_start_check();
 int driver_finish_check();
-int driver_install(FILE* driver_src);
+int driver_install(gwu_span_t driver_src);
 int os_is_wine();
 
 #endif
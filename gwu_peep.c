@@ -0,0 +1,253 @@
+#include "gwu_peep.h"
+#include <string.h>
+
+#define PEEP_TCK_MAX (65000) // Longest run handed to jtag_tck()
+
+void gwu_peep_init(gwu_peep_t* p, jtag_t* jtag) {
+	memset(p, 0, sizeof(gwu_peep_t));
+	p->jtag = jtag;
+	gwu_peep_reset(p);
+}
+
+static void lines_reset(gwu_peep_lines_t* l) {
+	l->tms = -1;
+	l->tdi = -1;
+	l->run = 0;
+	l->pending = 0;
+}
+
+void gwu_peep_reset(gwu_peep_t* p) {
+	p->len = 0;
+	p->state = LIBXSVF_TAP_INIT;
+	p->ones = 0;
+	lines_reset(&p->out);
+	lines_reset(&p->plain);
+}
+
+void gwu_peep_clear_stats(gwu_peep_t* p) {
+	memset(&p->out.count, 0, sizeof(gwu_peep_count_t));
+	memset(&p->plain.count, 0, sizeof(gwu_peep_count_t));
+	p->flushes = 0;
+	p->dropped = 0;
+	p->delay_us = 0;
+}
+
+// Only the lines in p->out reach the adapter, if there is one; p->plain
+// is counted the same way to show what the optimizer saved.
+static int lines_emit(const gwu_peep_t* p, const gwu_peep_lines_t* l) {
+	return l == &p->out && p->jtag;
+}
+
+static void lines_settle(gwu_peep_t* p, gwu_peep_lines_t* l, int what) {
+	l->count.settle++;
+	if (lines_emit(p, l)) { jtag_settle(p->jtag, what); }
+}
+
+static void lines_send(gwu_peep_t* p, gwu_peep_lines_t* l) {
+	while (l->run > 0) {
+		long n = l->run < PEEP_TCK_MAX ? l->run : PEEP_TCK_MAX;
+		if (lines_emit(p, l)) { jtag_tck(p->jtag, (uint16_t)n); }
+		l->count.tck++;
+		l->count.clocks += n;
+		l->run -= n;
+		l->pending = 1;
+	}
+}
+
+// A line may only change once the TCK before it has taken effect, and
+// TCK may only run once the lines have
+static void lines_step(gwu_peep_t* p, gwu_peep_lines_t* l, int tms, int tdi, long n, int sample) {
+	int emit = lines_emit(p, l);
+	int set_tms = tms != l->tms;
+	int set_tdi = tdi >= 0 && tdi != l->tdi;
+
+	if (set_tms || set_tdi || (sample && l == &p->plain)) {
+		lines_send(p, l);
+		if (l->pending) {
+			lines_settle(p, l, JTAG_SETTLE_LINES);
+			l->pending = 0;
+		}
+	}
+	if (set_tms) {
+		if (emit) { jtag_tms(p->jtag, tms); }
+		l->count.tms++;
+		l->tms = tms;
+	}
+	if (set_tdi) {
+		if (emit) { jtag_tdi(p->jtag, tdi); }
+		l->count.tdi++;
+		l->tdi = tdi;
+	}
+	if (set_tms || set_tdi) { lines_settle(p, l, JTAG_SETTLE_LINES); }
+
+	l->run += n;
+	if (!sample) { return; }
+
+	// TDO after a run is what its last clock left, so a sample can
+	// end the run before it
+	l->run++;
+	lines_send(p, l);
+	lines_settle(p, l, JTAG_SETTLE_SAMPLE);
+	if (emit) { jtag_sample_queue(p->jtag); }
+	l->count.samples++;
+	l->pending = 0;
+}
+
+static void add_run(gwu_peep_t* p, int tms, int tdi, long n, int sample, int timed) {
+	lines_step(p, &p->plain, tms, tdi, sample ? 0 : n, sample);
+
+	gwu_peep_run_t* last = p->len ? &p->window[p->len - 1] : NULL;
+	if (last && !sample && !last->sample && last->tms == tms &&
+		(tdi < 0 || last->tdi < 0 || tdi == last->tdi)) {
+		if (tdi >= 0) { last->tdi = (signed char)tdi; }
+		last->n += n;
+		last->timed |= timed;
+	}
+	else {
+		if (p->len == GWU_PEEP_WINDOW) { gwu_peep_flush(p); }
+		gwu_peep_run_t* r = &p->window[p->len++];
+		r->n = n;
+		r->tms = (signed char)tms;
+		r->tdi = (signed char)tdi;
+		r->sample = (char)sample;
+		r->timed = (char)timed;
+		r->state = (unsigned char)p->state;
+		r->ones = (unsigned char)p->ones;
+	}
+
+	// Runs of one TMS value settle within six clocks: Test-Logic-Reset
+	// for TMS=1, Run-Test/Idle, Shift or Pause for TMS=0
+	if (tms) {
+		p->ones = p->ones + n < 5 ? p->ones + (int)n : 5;
+		if (p->ones == 5) { p->state = LIBXSVF_TAP_RESET; }
+	}
+	else { p->ones = 0; }
+	if (p->state != LIBXSVF_TAP_INIT) {
+		for (long i = 0; i < n && i < 6; i++) { p->state = libxsvf_tap_next(p->state, tms); }
+	}
+}
+
+void gwu_peep_clock(gwu_peep_t* p, int tms, int tdi, long n, int timed) {
+	if (n > 0) { add_run(p, tms, tdi, n, 0, timed); }
+}
+
+void gwu_peep_sample(gwu_peep_t* p, int tms, int tdi) {
+	add_run(p, tms, tdi, 1, 1, 0);
+}
+
+// TMS=1 clocks that reach Test-Logic-Reset from state. Five reach it
+// from anywhere, so from an unknown state it takes 5 - ones.
+static int clocks_to_reset(int state, int ones) {
+	if (state == LIBXSVF_TAP_INIT) { return 5 - ones; }
+	int k = 0;
+	while (state != LIBXSVF_TAP_RESET) {
+		state = libxsvf_tap_next(state, 1);
+		k++;
+	}
+	return k;
+}
+
+// Drops clocks that leave the TAP where it would have been anyway.
+// Exit1 -> Pause -> Exit2 -> Update ends where Exit1 -> Update does,
+// and none of Pause and Exit2 acts on a register.
+static void drop_clocks(gwu_peep_t* p) {
+	for (int i = 0; i < p->len; i++) {
+		gwu_peep_run_t* r = &p->window[i];
+		if (r->n == 0 || r->sample || r->timed) { continue; }
+
+		if (!r->tms && (r->state == LIBXSVF_TAP_DREXIT1 || r->state == LIBXSVF_TAP_IREXIT1) && i + 1 < p->len) {
+			gwu_peep_run_t* next = &p->window[i + 1];
+			if (next->tms && !next->sample && !next->timed && next->n >= 2) {
+				p->dropped += r->n + 1;
+				next->n--;
+				next->state = r->state;
+				next->ones = r->ones;
+				r->n = 0;
+			}
+		}
+		else if (r->tms) {
+			int k = clocks_to_reset(r->state, r->ones);
+			if (r->n > k) {
+				p->dropped += r->n - k;
+				r->n = k;
+			}
+		}
+	}
+}
+
+// Gives each don't-care TDI between two differing values the one that
+// costs least to change to: where TMS changes anyway, else after a
+// sample, when the lines are settled, else anywhere in the run.
+static void resolve_tdi(gwu_peep_t* p) {
+	int live[GWU_PEEP_WINDOW];
+	int num = 0;
+	for (int i = 0; i < p->len; i++) {
+		if (p->window[i].n > 0) { live[num++] = i; }
+	}
+
+	int tdi = p->out.tdi;
+	int gap = 0; // First don't care since the last significant TDI
+	for (int i = 0; i < num; i++) {
+		gwu_peep_run_t* r = &p->window[live[i]];
+		if (r->tdi < 0) { continue; }
+
+		if (r->tdi != tdi && gap < i) {
+			int best = i;
+			int best_cost = 3;
+			for (int k = gap; k <= i; k++) {
+				gwu_peep_run_t* before = k ? &p->window[live[k - 1]] : NULL;
+				int tms_before = before ? before->tms : p->out.tms;
+				int settled = before ? before->sample : !p->out.pending;
+				int cost = p->window[live[k]].tms != tms_before ? 0 : settled ? 1 : 2;
+				if (cost < best_cost) {
+					best = k;
+					best_cost = cost;
+				}
+			}
+			for (int k = gap; k < best; k++) { p->window[live[k]].tdi = (signed char)tdi; }
+			for (int k = best; k < i; k++) { p->window[live[k]].tdi = r->tdi; }
+		}
+		else {
+			for (int k = gap; k < i; k++) { p->window[live[k]].tdi = r->tdi; }
+		}
+		tdi = r->tdi;
+		gap = i + 1;
+	}
+}
+
+void gwu_peep_flush(gwu_peep_t* p) {
+	if (p->len) {
+		drop_clocks(p);
+		resolve_tdi(p);
+		for (int i = 0; i < p->len; i++) {
+			gwu_peep_run_t* r = &p->window[i];
+			if (r->n == 0) { continue; }
+			lines_step(p, &p->out, r->tms, r->tdi, r->sample ? 0 : r->n, r->sample);
+		}
+		p->len = 0;
+		p->flushes++;
+	}
+	lines_send(p, &p->out);
+	lines_send(p, &p->plain);
+}
+
+void gwu_peep_delay(gwu_peep_t* p, long usecs) {
+	gwu_peep_flush(p);
+	p->delay_us += usecs;
+	if (p->jtag) { jtag_delay(p->jtag, usecs); }
+}
+
+static void print_row(FILE* f, const char* name, long plain, long out) {
+	fprintf(f, "  %-14s %8ld  %8ld  %8ld\n", name, plain, out, plain - out);
+}
+
+void gwu_peep_print_stats(const gwu_peep_t* p, FILE* f) {
+	const gwu_peep_count_t* plain = &p->plain.count;
+	const gwu_peep_count_t* out = &p->out.count;
+	fprintf(f, "Peephole: %ld flushes, %lld clocks dropped\n", p->flushes, p->dropped);
+	fprintf(f, "  %-14s %8s  %8s  %8s\n", "", "played", "sent", "saved");
+	print_row(f, "TMS changes", plain->tms, out->tms);
+	print_row(f, "TDI changes", plain->tdi, out->tdi);
+	print_row(f, "TCK runs", plain->tck, out->tck);
+	print_row(f, "Settle gates", plain->settle, out->settle);
+}
@@ -0,0 +1,87 @@
+#ifndef _GWU_PEEP_H
+#define _GWU_PEEP_H
+
+#include <stdio.h>
+#include "libxsvf.h"
+#include "jtag.h"
+
+// Peephole optimizer between the libxsvf host callbacks and a jtag_t.
+// Clocks are buffered as runs in a window and only turned into line
+// changes, TCK runs and settle waits when a result is needed, a delay
+// is due or the window fills. On the way out it
+//  - drops clocks that cannot change the TAP: a detour through Pause
+//    and Exit2 on the way to Update, and TMS=1 clocks in Test-Logic-Reset
+//  - gives don't-care TDI the next value that matters, so it changes
+//    together with TMS rather than breaking a TCK run of its own
+//  - merges runs on the same lines and clocks a sample at the end of
+//    the run before it, which needs no extra settle
+// Every clock in Shift and every sample is kept, so TDO reads the same.
+// Without a jtag_t it only counts, which is how Packager's dry pass
+// (gwu_profile.h) learns what a play sends.
+
+#define GWU_PEEP_WINDOW (1024) // Runs buffered before a flush
+
+typedef struct gwu_peep_run_s {
+	long n; // Clocks, 0 once dropped
+	signed char tms;
+	signed char tdi; // -1 for don't care
+	char sample; // One clock, sampled afterwards
+	char timed; // Holds udelay() clocks, which are never dropped
+	unsigned char state; // TAP state before the first clock
+	unsigned char ones; // TMS=1 clocks in a row before it, up to 5
+} gwu_peep_run_t;
+
+typedef struct gwu_peep_count_s {
+	long tms; // Line changes
+	long tdi;
+	long tck; // TCK runs
+	long settle; // Settle gates
+	long samples;
+	long long clocks;
+} gwu_peep_count_t;
+
+// Lines as last set and what is still owed on them
+typedef struct gwu_peep_lines_s {
+	int tms; // -1 until first set
+	int tdi;
+	long run; // Clocks on these lines not yet sent
+	char pending; // TCK sent since the last settle
+	gwu_peep_count_t count;
+} gwu_peep_lines_t;
+
+typedef struct gwu_peep_s {
+	jtag_t* jtag;
+	gwu_peep_run_t window[GWU_PEEP_WINDOW];
+	int len;
+	int state; // TAP state after the last clock added, LIBXSVF_TAP_INIT if unknown
+	int ones;
+
+	gwu_peep_lines_t out; // What was sent
+	gwu_peep_lines_t plain; // Counts only: every clock sent as it came
+	long flushes;
+	long long dropped; // Clocks left out
+	long long delay_us; // Waited in gwu_peep_delay()
+} gwu_peep_t;
+
+// jtag may be NULL to count without sending
+void gwu_peep_init(gwu_peep_t* p, jtag_t* jtag);
+
+// Forgets the lines and TAP state, for a freshly opened connection
+void gwu_peep_reset(gwu_peep_t* p);
+void gwu_peep_clear_stats(gwu_peep_t* p);
+
+// Adds n clocks with TMS and TDI (TDI < 0 for don't care). timed
+// marks RUNTEST clocks, which are never dropped.
+void gwu_peep_clock(gwu_peep_t* p, int tms, int tdi, long n, int timed);
+// Adds one clock whose TDO is queued with jtag_sample_queue()
+void gwu_peep_sample(gwu_peep_t* p, int tms, int tdi);
+
+// Sends everything added so far. Queued samples can be collected
+// with jtag_sample_result() afterwards.
+void gwu_peep_flush(gwu_peep_t* p);
+// Sends everything, then waits usecs
+void gwu_peep_delay(gwu_peep_t* p, long usecs);
+
+void gwu_peep_print_stats(const gwu_peep_t* p, FILE* f);
+
+#endif
@@ -0,0 +1,176 @@
+#include "gwu_profile.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include "gwu_dry.h"
+
+// Fitted on the sim backend's fixed timing profile (2 Mbaud, 5 TCK per
+// character) to update.svf and the small test files: a line change with
+// its settle gate, a USB write, a character time per 5 TCK and a status
+// read. Predictions land within about 1% of the sim.
+const gwu_latency_t gwu_latency_default = { 2045000, 1780000, 1000, 1030000 };
+
+int gwu_latency_parse(gwu_latency_t* l, const char* s) {
+	while (*s) {
+		const char* eq = strchr(s, '=');
+		if (!eq) { return -1; }
+		char* end;
+		unsigned long v = strtoul(eq + 1, &end, 10);
+		if (end == eq + 1 || (*end && *end != ',')) { return -1; }
+
+		size_t n = eq - s;
+		if (n == 4 && !strncmp(s, "line", 4)) { l->line_ns = (uint32_t)v; }
+		else if (n == 3 && !strncmp(s, "run", 3)) { l->run_ns = (uint32_t)v; }
+		else if (n == 5 && !strncmp(s, "clock", 5)) { l->clock_ns = (uint32_t)v; }
+		else if (n == 6 && !strncmp(s, "sample", 6)) { l->sample_ns = (uint32_t)v; }
+		else { return -1; }
+		s = *end ? end + 1 : end;
+	}
+	return 0;
+}
+
+/* Counting */
+
+void gwu_profile_init(gwu_profile_t* p) {
+	memset(p, 0, sizeof(gwu_profile_t));
+}
+
+void gwu_profile_sent(gwu_profile_t* p, const gwu_peep_t* peep) {
+	const gwu_peep_count_t* c = &peep->out.count;
+	p->tms_changes = (uint32_t)c->tms;
+	p->tdi_changes = (uint32_t)c->tdi;
+	p->tck_runs = (uint32_t)c->tck;
+	p->samples = (uint32_t)c->samples;
+	p->tck = (uint32_t)c->clocks;
+	p->delay_us = peep->delay_us;
+}
+
+double gwu_profile_time(const gwu_profile_t* p, const gwu_latency_t* l) {
+	double ns = (double)(p->tms_changes + p->tdi_changes) * l->line_ns +
+		(double)p->tck_runs * l->run_ns +
+		(double)p->tck * l->clock_ns +
+		(double)p->samples * l->sample_ns;
+	return ns / 1e9 + (double)p->delay_us / 1e6;
+}
+
+/* Dry pass */
+
+static void on_scan(void* user, const struct libxsvf_shift* s) {
+	gwu_profile_t* p = (gwu_profile_t*)user;
+	if ((uint32_t)s->len > p->marks.scan_bits) { p->marks.scan_bits = s->len; }
+}
+
+static void on_alloc(void* user, int size, enum libxsvf_mem which) {
+	gwu_profile_t* p = (gwu_profile_t*)user;
+	if ((uint32_t)size > p->marks.mem[which]) { p->marks.mem[which] = size; }
+}
+
+static const gwu_dry_hooks_t profile_hooks = { on_scan, on_alloc };
+
+// The input is not lent out, since a compressed payload cannot be, so
+// SVF commands are copied into their buffer as they are when played
+int gwu_profile_measure(gwu_profile_t* p, gwu_span_t payload, enum libxsvf_mode mode) {
+	gwu_peep_t peep;
+	gwu_dry_t d;
+	gwu_profile_init(p);
+	gwu_peep_init(&peep, NULL);
+	gwu_dry_init(&d, payload, &profile_hooks, p);
+	d.report_errors = 1;
+	d.peep = &peep;
+	int rc = gwu_dry_play(&d, mode);
+	p->clocks = d.clocks;
+	p->tdi_bits = d.tdi_bits;
+	p->tdo_bits = d.tdo_bits;
+	gwu_profile_sent(p, &peep);
+	return rc < 0 ? -1 : 0;
+}
+
+void gwu_profile_print(const gwu_profile_t* p, const gwu_latency_t* l, FILE* f) {
+	unsigned long mem = 0;
+	for (int i = 0; i < LIBXSVF_MEM_NUM; i++) { mem += p->marks.mem[i]; }
+	fprintf(f, "Dry pass: %lu clocks, %lu TDI bits, %lu TDO bits compared\n",
+		(unsigned long)p->clocks, (unsigned long)p->tdi_bits, (unsigned long)p->tdo_bits);
+	fprintf(f, "  %-14s %10lu\n", "TMS changes", (unsigned long)p->tms_changes);
+	fprintf(f, "  %-14s %10lu\n", "TDI changes", (unsigned long)p->tdi_changes);
+	fprintf(f, "  %-14s %10lu\n", "TCK runs", (unsigned long)p->tck_runs);
+	fprintf(f, "  %-14s %10lu\n", "Samples", (unsigned long)p->samples);
+	fprintf(f, "  %-14s %10lu\n", "TCK pulses", (unsigned long)p->tck);
+	fprintf(f, "  %-14s %10.3lf ms\n", "Delays", (double)p->delay_us / 1000.0);
+	fprintf(f, "  %-14s %10lu bytes, longest scan %lu bits\n", "Buffers", mem, (unsigned long)p->marks.scan_bits);
+	fprintf(f, "  %-14s %10.1lf sec. (line %lu, run %lu, clock %lu, sample %lu ns)\n", "Predicted",
+		gwu_profile_time(p, l), (unsigned long)l->line_ns, (unsigned long)l->run_ns,
+		(unsigned long)l->clock_ns, (unsigned long)l->sample_ns);
+}
+
+/* Image info */
+
+#define INFO_PROFILE_WORDS (9)
+
+int gwu_info_write(FILE* f, const gwu_info_t* info) {
+	const gwu_profile_t* p = &info->profile;
+	uint32_t words[2 + LIBXSVF_MEM_NUM + INFO_PROFILE_WORDS + 5];
+	int n = 0;
+	words[n++] = p->marks.scan_bits;
+	words[n++] = LIBXSVF_MEM_NUM;
+	for (int i = 0; i < LIBXSVF_MEM_NUM; i++) { words[n++] = p->marks.mem[i]; }
+	words[n++] = p->clocks;
+	words[n++] = p->tdi_bits;
+	words[n++] = p->tdo_bits;
+	words[n++] = p->tms_changes;
+	words[n++] = p->tdi_changes;
+	words[n++] = p->tck_runs;
+	words[n++] = p->samples;
+	words[n++] = p->tck;
+	words[n++] = (uint32_t)(p->delay_us / 1000);
+	words[n++] = info->latency.line_ns;
+	words[n++] = info->latency.run_ns;
+	words[n++] = info->latency.clock_ns;
+	words[n++] = info->latency.sample_ns;
+	words[n++] = info->predicted_ms;
+
+	uint32_t size = n * sizeof(uint32_t);
+	if (fwrite(&size, sizeof(uint32_t), 1, f) != 1 || fwrite(words, sizeof(uint32_t), n, f) != (size_t)n) { return -1; }
+	return 0;
+}
+
+// Takes the next word of info if there is one, else leaves *to alone
+static void info_word(gwu_span_t* info, uint32_t* to) {
+	if (info->len >= sizeof(uint32_t)) { span_read(info, to, sizeof(uint32_t)); }
+	else { info->len = 0; }
+}
+
+int gwu_info_read(gwu_span_t* data, gwu_info_t* info) {
+	memset(info, 0, sizeof(gwu_info_t));
+	gwu_profile_init(&info->profile);
+
+	uint32_t size;
+	gwu_span_t block;
+	if (span_read(data, &size, sizeof(uint32_t)) || span_take(data, size, &block)) { return -1; }
+
+	gwu_profile_t* p = &info->profile;
+	uint32_t num_slots = 0;
+	info_word(&block, &p->marks.scan_bits);
+	info_word(&block, &num_slots);
+	for (uint32_t i = 0; i < num_slots; i++) {
+		uint32_t mark = 0;
+		info_word(&block, &mark);
+		if (i < LIBXSVF_MEM_NUM) { p->marks.mem[i] = mark; }
+	}
+	info_word(&block, &p->clocks);
+	info_word(&block, &p->tdi_bits);
+	info_word(&block, &p->tdo_bits);
+	info_word(&block, &p->tms_changes);
+	info_word(&block, &p->tdi_changes);
+	info_word(&block, &p->tck_runs);
+	info_word(&block, &p->samples);
+	info_word(&block, &p->tck);
+	uint32_t delay_ms = 0;
+	info_word(&block, &delay_ms);
+	p->delay_us = delay_ms * 1000LL;
+	info_word(&block, &info->latency.line_ns);
+	info_word(&block, &info->latency.run_ns);
+	info_word(&block, &info->latency.clock_ns);
+	info_word(&block, &info->latency.sample_ns);
+	info_word(&block, &info->predicted_ms);
+	return 0;
+}
@@ -0,0 +1,81 @@
+#ifndef _GWU_PROFILE_H
+#define _GWU_PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "libxsvf.h"
+#include "gwu_image.h"
+#include "gwu_arena.h"
+#include "gwu_peep.h"
+
+// What a play costs. Packager fills one in with a dry pass over each
+// image, and GWUpdate takes one from its optimizer while playing to see
+// how far along the prediction it is.
+typedef struct gwu_profile_s {
+	// Counted the way GWUpdate counts progress (dry pass only)
+	uint32_t clocks; // RUNTEST clocks excluded
+	uint32_t tdi_bits;
+	uint32_t tdo_bits;
+
+	// Adapter operations as the peephole optimizer sends them
+	uint32_t tms_changes;
+	uint32_t tdi_changes;
+	uint32_t tck_runs;
+	uint32_t samples;
+	uint32_t tck; // RUNTEST clocks included, dropped clocks not
+	long long delay_us;
+
+	gwu_marks_t marks; // Dry pass only
+} gwu_profile_t;
+
+// What each adapter operation takes, in ns
+typedef struct gwu_latency_s {
+	uint32_t line_ns; // TMS or TDI change
+	uint32_t run_ns; // Starting a TCK run
+	uint32_t clock_ns; // Each TCK
+	uint32_t sample_ns; // Reading TDO
+} gwu_latency_t;
+
+// A CH340 at 2 Mbaud with the fixed timing profile, as the sim backend
+// models it
+extern const gwu_latency_t gwu_latency_default;
+
+// Parses "line=NS,run=NS,clock=NS,sample=NS", any of them, over l.
+// Returns 0 if valid.
+int gwu_latency_parse(gwu_latency_t* l, const char* s);
+
+void gwu_profile_init(gwu_profile_t* p);
+
+// Takes the adapter operations peep has sent so far
+void gwu_profile_sent(gwu_profile_t* p, const gwu_peep_t* peep);
+
+// Time the operations counted so far take under l, in seconds
+double gwu_profile_time(const gwu_profile_t* p, const gwu_latency_t* l);
+
+// Plays payload through the dry host (gwu_dry.h) and an optimizer that
+// only counts, every compared bit matching. Returns 0 on success, -1 if
+// the payload does not play.
+int gwu_profile_measure(gwu_profile_t* p, gwu_span_t payload, enum libxsvf_mode mode);
+
+void gwu_profile_print(const gwu_profile_t* p, const gwu_latency_t* l, FILE* f);
+
+// Image info, stored after each image header in "UPD9" update files as
+// a u32 size and that many bytes of u32 words: the longest scan, the
+// number of memory slots and the mark of each, then the profile counts
+// with delays in ms, the latency it was predicted under and the
+// prediction in ms. Readers take the fields they know and skip the
+// rest.
+typedef struct gwu_info_s {
+	gwu_profile_t profile;
+	gwu_latency_t latency;
+	uint32_t predicted_ms; // 0 if not known
+} gwu_info_t;
+
+// Returns 0 on success, -1 if the file could not be written
+int gwu_info_write(FILE* f, const gwu_info_t* info);
+
+// Reads an info block from data, leaving fields it does not hold zero.
+// Returns 0 on success, -1 if data is too short.
+int gwu_info_read(gwu_span_t* data, gwu_info_t* info);
+
+#endif
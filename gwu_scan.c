@@ -0,0 +1,46 @@
+#include "gwu_scan.h"
+
+static int vector_bit(const unsigned char* data, int nbytes, int k)
+{
+	return (data[nbytes - 1 - k / 8] >> (k % 8)) & 1;
+}
+
+static int vector_tdi(const struct libxsvf_shift* s, int nbytes, int k)
+{
+	if (!s->tdi_data) { return -1; }
+	if (s->tdi_mask && !vector_bit(s->tdi_mask, nbytes, k)) { return -1; }
+	return vector_bit(s->tdi_data, nbytes, k);
+}
+
+static int vector_checked(const struct libxsvf_shift* s, int nbytes, int k)
+{
+	return s->tdo_data && (!s->tdo_mask || vector_bit(s->tdo_mask, nbytes, k));
+}
+
+void gwu_scan_part(const struct libxsvf_shift* s, int k, gwu_scan_part_t* part)
+{
+	int nbytes = (s->len + 7) / 8;
+	int last = s->len - 1;
+	int tdi = vector_tdi(s, nbytes, k);
+	part->tms = s->exit_tms && k == last;
+	part->checked = vector_checked(s, nbytes, k);
+	part->sample = part->checked || (s->sync && k == last);
+	part->tdi_bits = tdi >= 0;
+
+	// Extend a run over following bits with the same lines
+	int n = 1;
+	int run_end = (s->exit_tms || s->sync) ? last : s->len;
+	if (!part->sample && k < run_end) {
+		while (k + n < run_end && !vector_checked(s, nbytes, k + n)) {
+			int next_tdi = vector_tdi(s, nbytes, k + n);
+			if (next_tdi >= 0 && tdi >= 0 && next_tdi != tdi) { break; }
+			if (next_tdi >= 0) {
+				part->tdi_bits++;
+				tdi = next_tdi;
+			}
+			n++;
+		}
+	}
+	part->n = n;
+	part->tdi = tdi;
+}
@@ -0,0 +1,22 @@
+#ifndef _GWU_SCAN_H
+#define _GWU_SCAN_H
+
+#include "libxsvf.h"
+
+// How a scan goes to the adapter: runs of clocks that keep TMS and TDI,
+// and single sampled bits where TDO is compared or the scan syncs. The
+// GWUpdate host plays scans this way and the dry pass counts them this
+// way, so the two cannot drift apart.
+typedef struct gwu_scan_part_s {
+	int n; // Bits, 1 for a sample
+	int tms;
+	int tdi; // -1 if no bit of the part gives TDI
+	int sample;
+	int checked; // The sample compares TDO
+	int tdi_bits; // Bits of the part that give TDI
+} gwu_scan_part_t;
+
+// Fills in the part of s that starts at bit k
+void gwu_scan_part(const struct libxsvf_shift* s, int k, gwu_scan_part_t* part);
+
+#endif
@@ -0,0 +1,92 @@
+#include "gwu_thread.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <sched.h>
+#endif
+
+// Threads are started through a trampoline that carries fn and arg
+typedef struct thread_start_s {
+	int (*fn)(void*);
+	void* arg;
+} thread_start_t;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID param) {
+	thread_start_t start = *(thread_start_t*)param;
+	free(param);
+	int code = start.fn(start.arg);
+	ReleaseWaitTimer();
+	return (DWORD)code;
+}
+
+int thread_start(gwu_thread_t* t, int (*fn)(void*), void* arg) {
+	thread_start_t* start = malloc(sizeof(thread_start_t));
+	if (!start) { return -1; }
+	start->fn = fn;
+	start->arg = arg;
+	*t = CreateThread(NULL, 0, thread_main, start, 0, NULL);
+	if (!*t) {
+		free(start);
+		return -1;
+	}
+	return 0;
+}
+
+int thread_join(gwu_thread_t t) {
+	DWORD code = (DWORD)-1;
+	WaitForSingleObject(t, INFINITE);
+	GetExitCodeThread(t, &code);
+	CloseHandle(t);
+	return (int)code;
+}
+
+static void thread_yield() { SwitchToThread(); }
+#else
+static void* thread_main(void* param) {
+	thread_start_t start = *(thread_start_t*)param;
+	free(param);
+	int code = start.fn(start.arg);
+	ReleaseWaitTimer();
+	return (void*)(intptr_t)code;
+}
+
+int thread_start(gwu_thread_t* t, int (*fn)(void*), void* arg) {
+	thread_start_t* start = malloc(sizeof(thread_start_t));
+	if (!start) { return -1; }
+	start->fn = fn;
+	start->arg = arg;
+	if (pthread_create(t, NULL, thread_main, start)) {
+		free(start);
+		return -1;
+	}
+	return 0;
+}
+
+int thread_join(gwu_thread_t t) {
+	void* code = (void*)(intptr_t)-1;
+	pthread_join(t, &code);
+	return (int)(intptr_t)code;
+}
+
+static void thread_yield() { sched_yield(); }
+#endif
+
+// The other side of a ring usually answers within microseconds, so
+// spinning and yielding cover the common case. A side that stays
+// stalled, like a producer ahead of a slow adapter, ends up sleeping.
+#define BACKOFF_SPINS 64
+#define BACKOFF_YIELDS 4096
+
+void thread_backoff(unsigned* round) {
+	if (*round < BACKOFF_SPINS) {
+		for (volatile int i = 0; i < 16; i++) { }
+	}
+	else if (*round < BACKOFF_SPINS + BACKOFF_YIELDS) { thread_yield(); }
+	else {
+		Sleep(1);
+		return;
+	}
+	(*round)++;
+}
@@ -0,0 +1,44 @@
+#ifndef _GWU_THREAD_H
+#define _GWU_THREAD_H
+
+#include "gwu_time.h"
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+// Runs fn(arg) on a new thread; thread_join() returns what fn returned
+#ifdef _WIN32
+typedef void* gwu_thread_t; // HANDLE
+#else
+typedef pthread_t gwu_thread_t;
+#endif
+int thread_start(gwu_thread_t* t, int (*fn)(void*), void* arg);
+int thread_join(gwu_thread_t t);
+
+// Index loads and stores for single-producer/single-consumer rings. A
+// release store publishes everything written before it to the thread
+// that reads the index back with an acquire load.
+#ifdef _WIN32
+#include <intrin.h>
+#if defined(_M_ARM) || defined(_M_ARM64)
+#define RING_FENCE() MemoryBarrier()
+#else
+#define RING_FENCE() _ReadWriteBarrier() // x86 keeps loads and stores in order
+#endif
+static __inline long load_acquire(volatile long* p) { long v = *p; RING_FENCE(); return v; }
+static __inline void store_release(volatile long* p, long v) { RING_FENCE(); *p = v; }
+static __inline LONGLONG load_ticks(volatile LONGLONG* p) { return InterlockedCompareExchange64(p, 0, 0); }
+static __inline void store_ticks(volatile LONGLONG* p, LONGLONG v) { InterlockedExchange64(p, v); }
+#else
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define load_ticks(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+#define store_ticks(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#endif
+
+// Waits a little longer on each call while a ring stays full or empty:
+// spins first, then yields, then sleeps a millisecond at a time. Start
+// with *round = 0 and reset it once the ring moves.
+void thread_backoff(unsigned* round);
+
+#endif
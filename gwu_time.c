@@ -0,0 +1,145 @@
+#include "gwu_time.h"
+#ifndef _WIN32
+#include <time.h>
+#include <errno.h>
+#endif
+
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+LONGLONG ticks_per_ms;
+static LONGLONG spin_ticks;
+static long spin_usecs = -1; // Platform default until SetWaitSpin()
+static THREAD_LOCAL wait_stats_t wait_stats;
+
+#ifdef _WIN32
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION (0x00000002)
+#endif
+#pragma comment(lib, "winmm.lib") // timeBeginPeriod()
+static THREAD_LOCAL HANDLE wait_timer;
+static int high_resolution = -1;
+#endif
+
+void SetupTicks() {
+#ifdef _WIN32
+	LARGE_INTEGER ticks_per_sec;
+	QueryPerformanceFrequency(&ticks_per_sec);
+	ticks_per_ms = ticks_per_sec.QuadPart / 1000;
+#else
+	ticks_per_ms = 1000000; // CLOCK_MONOTONIC ticks are nanoseconds
+#endif
+	long usecs = spin_usecs;
+	if (usecs < 0) {
+#ifdef _WIN32
+		// High-resolution waitable timers wake within about 0.5 ms
+		usecs = 1000;
+#else
+		// clock_nanosleep() usually wakes within 50 us
+		usecs = 100;
+#endif
+	}
+	spin_ticks = usecs * ticks_per_ms / 1000;
+}
+
+void SetWaitSpin(long usecs) {
+	spin_usecs = usecs;
+	if (ticks_per_ms) { spin_ticks = usecs * ticks_per_ms / 1000; }
+}
+
+LONGLONG GetTicksNow() {
+#ifdef _WIN32
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return now.QuadPart;
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (LONGLONG)now.tv_sec * 1000000000LL + now.tv_nsec;
+#endif
+}
+
+// Sleeps until about wake, which is at least spin_ticks in the future
+static void SleepUntil(LONGLONG wake, LONGLONG now) {
+#ifdef _WIN32
+	if (!wait_timer) {
+		if (high_resolution) {
+			wait_timer = CreateWaitableTimerExW(NULL, NULL,
+				CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+		}
+		if (!wait_timer) {
+			// Before Windows 10 1803 timers follow the system tick
+			if (high_resolution) { timeBeginPeriod(1); }
+			high_resolution = 0;
+			wait_timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+			if (!wait_timer) { return; }
+		}
+		else { high_resolution = 1; }
+	}
+	// Relative due time in 100 ns units
+	LARGE_INTEGER due;
+	due.QuadPart = -((wake - now) * 10000 / ticks_per_ms);
+	if (!high_resolution) { due.QuadPart += 20000; } // Wake 2 ms early
+	if (due.QuadPart >= 0) { return; }
+	if (SetWaitableTimer(wait_timer, &due, 0, NULL, NULL, FALSE)) {
+		WaitForSingleObject(wait_timer, INFINITE);
+	}
+#else
+	struct timespec ts;
+	ts.tv_sec = wake / 1000000000LL;
+	ts.tv_nsec = wake % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+#endif
+}
+
+void WaitTicks(LONGLONG end) {
+	LONGLONG now = GetTicksNow();
+	if (now >= end) { return; }
+	wait_stats.waits++;
+	if (end - now > spin_ticks) {
+		SleepUntil(end - spin_ticks, now);
+		wait_stats.sleeps++;
+	}
+	while ((now = GetTicksNow()) < end);
+
+	LONGLONG overshoot = now - end;
+	wait_stats.overshoot_total += overshoot;
+	if (overshoot > wait_stats.overshoot_max) { wait_stats.overshoot_max = overshoot; }
+}
+
+void WaitUsecs(long usecs) {
+	WaitTicks(GetTicksNow() + (LONGLONG)usecs * ticks_per_ms / 1000);
+}
+
+void ReleaseWaitTimer() {
+#ifdef _WIN32
+	if (wait_timer) {
+		CloseHandle(wait_timer);
+		wait_timer = NULL;
+	}
+#endif
+}
+
+wait_stats_t* GetWaitStats() {
+	return &wait_stats;
+}
+
+void PrintWaitStats(FILE* f, const wait_stats_t* stats) {
+	if (!stats->waits) { return; }
+	fprintf(f, "Waits: %ld (%ld slept), overshoot avg %.3lf us, max %.3lf us\n",
+		stats->waits, stats->sleeps,
+		(double)stats->overshoot_total / stats->waits * 1000.0 / ticks_per_ms,
+		(double)stats->overshoot_max * 1000.0 / ticks_per_ms);
+}
+
+#ifndef _WIN32
+void Sleep(unsigned long ms) {
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) && errno == EINTR);
+}
+#endif
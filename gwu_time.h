@@ -1,36 +1,41 @@
-#include <Windows.h>
-#include <string.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <errno.h>
-
 #ifndef _GWU_TIME_H
 #define _GWU_TIME_H
 
-LONGLONG ticks_per_ms;
-static void SetupTicks() {
-	LARGE_INTEGER ticks_per_sec;
-	QueryPerformanceFrequency(&ticks_per_sec);
-	ticks_per_ms = ticks_per_sec.QuadPart / 1000;
-}
-
-static LONGLONG GetTicksNow() {
-	LARGE_INTEGER now;
-	QueryPerformanceCounter(&now);
-	return now.QuadPart;
-}
-
-LONGLONG last;
-static void SetGate() {
-	last = GetTicksNow();
-}
-static void Gate() {
-	LONGLONG end = last + ticks_per_ms;
-	while (GetTicksNow() < end);
-}
-static void Gate2() {
-	LONGLONG end = last + 2 * ticks_per_ms;
-	while (GetTicksNow() < end);
-}
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+typedef long long LONGLONG;
+
+void Sleep(unsigned long ms);
+#endif
+
+extern LONGLONG ticks_per_ms;
+void SetupTicks();
+LONGLONG GetTicksNow();
+
+// Waits until GetTicksNow() reaches end. Sleeps on a high-resolution
+// timer for most of the interval and spins only for the last slice.
+void WaitTicks(LONGLONG end);
+void WaitUsecs(long usecs);
+
+// Closes the timer WaitTicks() keeps for the calling thread. Threads
+// started with thread_start() call this as they exit.
+void ReleaseWaitTimer();
+
+// Length of the final spin, tunable for the machine's timer precision
+void SetWaitSpin(long usecs);
+
+// How late WaitTicks() returned, kept per thread
+typedef struct wait_stats_s {
+	long waits; // Calls that had to wait at all
+	long sleeps; // Of those, how many slept before spinning
+	LONGLONG overshoot_total;
+	LONGLONG overshoot_max;
+} wait_stats_t;
+
+wait_stats_t* GetWaitStats();
+void PrintWaitStats(FILE* f, const wait_stats_t* stats);
 
 #endif
@@ -0,0 +1,235 @@
+#include "gwu_toc.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define CRC_BUF (64 * 1024) // Bytes read back at a time for checksums
+
+/* CRC-32 */
+
+// A nibble at a time, so the table is small enough to write out
+static const uint32_t crc_nibble[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+uint32_t gwu_crc32(uint32_t crc, const unsigned char* p, size_t n) {
+	crc = ~crc;
+	for (size_t i = 0; i < n; i++) {
+		crc ^= p[i];
+		crc = (crc >> 4) ^ crc_nibble[crc & 15];
+		crc = (crc >> 4) ^ crc_nibble[crc & 15];
+	}
+	return ~crc;
+}
+
+/* Writing */
+
+static int checksum_back(FILE* f, gwu_toc_entry_t* e) {
+	static unsigned char buf[CRC_BUF];
+	if (fseek(f, e->offset, SEEK_SET)) { return -1; }
+	uint32_t crc = 0;
+	for (uint32_t left = e->length; left > 0; ) {
+		size_t n = left < CRC_BUF ? left : CRC_BUF;
+		if (fread(buf, 1, n, f) != n) { return -1; }
+		crc = gwu_crc32(crc, buf, n);
+		left -= (uint32_t)n;
+	}
+	e->checksum = crc;
+	return 0;
+}
+
+int gwu_toc_write(FILE* f, uint32_t update_offset, gwu_toc_entry_t* entries, uint32_t num_entries) {
+	if (fflush(f)) { return -1; }
+	for (uint32_t i = 0; i < num_entries; i++) {
+		if (checksum_back(f, &entries[i])) { return -1; }
+	}
+
+	if (fseek(f, 0L, SEEK_END)) { return -1; }
+	uint32_t toc_offset = (uint32_t)ftell(f);
+	for (uint32_t i = 0; i < num_entries; i++) {
+		gwu_toc_entry_t* e = &entries[i];
+		fwrite(e->type, 1, 4, f);
+		fwrite(&e->offset, sizeof(uint32_t), 1, f);
+		fwrite(&e->length, sizeof(uint32_t), 1, f);
+		fwrite(e->boardid, 1, 4, f);
+		fwrite(&e->idcode, sizeof(uint32_t), 1, f);
+		fwrite(&e->checksum, sizeof(uint32_t), 1, f);
+	}
+
+	uint16_t entry_size = GWU_TOC_ENTRY_SIZE;
+	uint16_t version = GWU_TOC_VERSION;
+	fwrite(&update_offset, sizeof(uint32_t), 1, f);
+	fwrite(&toc_offset, sizeof(uint32_t), 1, f);
+	fwrite(&num_entries, sizeof(uint32_t), 1, f);
+	fwrite(&entry_size, sizeof(uint16_t), 1, f);
+	fwrite(&version, sizeof(uint16_t), 1, f);
+	fwrite("GTOC", 1, 4, f);
+	return ferror(f) ? -1 : 0;
+}
+
+/* Reading */
+
+int gwu_toc_read(gwu_span_t file, gwu_toc_t* toc) {
+	memset(toc, 0, sizeof(gwu_toc_t));
+	if (file.len < GWU_TOC_FOOTER_SIZE) { return -1; }
+	gwu_span_t footer = { file.p + file.len - GWU_TOC_FOOTER_SIZE, GWU_TOC_FOOTER_SIZE };
+	uint32_t toc_offset, num_entries;
+	uint16_t entry_size, version;
+	char sig[4];
+	span_read(&footer, &toc->update_offset, sizeof(uint32_t));
+	span_read(&footer, &toc_offset, sizeof(uint32_t));
+	span_read(&footer, &num_entries, sizeof(uint32_t));
+	span_read(&footer, &entry_size, sizeof(uint16_t));
+	span_read(&footer, &version, sizeof(uint16_t));
+	span_read(&footer, sig, 4);
+	if (memcmp(sig, "GTOC", 4) || version != GWU_TOC_VERSION || entry_size < GWU_TOC_ENTRY_SIZE) { return -1; }
+
+	// Entries must lie between the update signature and the footer
+	size_t end = file.len - GWU_TOC_FOOTER_SIZE;
+	if (toc->update_offset >= end || toc_offset > end ||
+		num_entries > (end - toc_offset) / entry_size) { return -1; }
+
+	toc->entries = calloc(num_entries ? num_entries : 1, sizeof(gwu_toc_entry_t));
+	if (!toc->entries) { return -1; }
+	toc->num_entries = num_entries;
+	gwu_span_t data = { file.p + toc_offset, (size_t)num_entries * entry_size };
+	for (uint32_t i = 0; i < num_entries; i++) {
+		gwu_toc_entry_t* e = &toc->entries[i];
+		gwu_span_t rest;
+		span_read(&data, e->type, 4);
+		span_read(&data, &e->offset, sizeof(uint32_t));
+		span_read(&data, &e->length, sizeof(uint32_t));
+		span_read(&data, e->boardid, 4);
+		span_read(&data, &e->idcode, sizeof(uint32_t));
+		span_read(&data, &e->checksum, sizeof(uint32_t));
+		span_take(&data, entry_size - GWU_TOC_ENTRY_SIZE, &rest);
+	}
+	return 0;
+}
+
+void gwu_toc_free(gwu_toc_t* toc) {
+	free(toc->entries);
+	memset(toc, 0, sizeof(gwu_toc_t));
+}
+
+int gwu_toc_is_image(const gwu_toc_entry_t* e) {
+	return memcmp(e->type, "DRVR", 4) && memcmp(e->type, "INST", 4);
+}
+
+const gwu_toc_entry_t* gwu_toc_find(const gwu_toc_t* toc, const char* type) {
+	for (uint32_t i = 0; i < toc->num_entries; i++) {
+		if (!memcmp(toc->entries[i].type, type, 4)) { return &toc->entries[i]; }
+	}
+	return NULL;
+}
+
+int gwu_toc_span(gwu_span_t file, const gwu_toc_entry_t* e, gwu_span_t* bytes) {
+	if (e->offset > file.len || e->length > file.len - e->offset) { return -1; }
+	bytes->p = file.p + e->offset;
+	bytes->len = e->length;
+	return 0;
+}
+
+int gwu_toc_verify(const gwu_toc_entry_t* e, gwu_span_t bytes) {
+	return gwu_crc32(0, bytes.p, bytes.len) == e->checksum ? 0 : -1;
+}
+
+/* Index */
+
+// 0 and GWU_ANY_IDCODE both accept any IDCODE
+static uint32_t any_idcode(uint32_t idcode) {
+	return idcode == GWU_ANY_IDCODE ? 0 : idcode;
+}
+
+static uint32_t key_hash(int dsr, int ri, int dcd, uint32_t idcode) {
+	uint32_t h = idcode * 0x9E3779B1u;
+	h ^= ((uint32_t)(dsr & 0xFF) << 16) | ((uint32_t)(ri & 0xFF) << 8) | (uint32_t)(dcd & 0xFF);
+	h ^= h >> 15;
+	h *= 0x85EBCA6Bu;
+	h ^= h >> 13;
+	return h;
+}
+
+static int key_equal(const gwu_toc_entry_t* e, int dsr, int ri, int dcd, uint32_t idcode) {
+	return e->boardid[0] == dsr && e->boardid[1] == ri && e->boardid[2] == dcd &&
+		any_idcode(e->idcode) == idcode;
+}
+
+int gwu_toc_index_build(gwu_toc_index_t* index, const gwu_toc_t* toc) {
+	memset(index, 0, sizeof(gwu_toc_index_t));
+	uint32_t size = 8;
+	while (size < toc->num_entries * 2) { size *= 2; }
+	index->images = calloc(toc->num_entries ? toc->num_entries : 1, sizeof(gwu_toc_entry_t*));
+	index->slots = malloc(size * sizeof(int32_t));
+	if (!index->images || !index->slots) {
+		gwu_toc_index_free(index);
+		return -1;
+	}
+	index->mask = size - 1;
+	for (uint32_t i = 0; i < size; i++) { index->slots[i] = -1; }
+
+	for (uint32_t i = 0; i < toc->num_entries; i++) {
+		const gwu_toc_entry_t* e = &toc->entries[i];
+		if (!gwu_toc_is_image(e)) { continue; }
+		int image = index->num_images++;
+		index->images[image] = e;
+
+		// Images with the same key after the first can never be chosen
+		uint32_t idcode = any_idcode(e->idcode);
+		uint32_t slot = key_hash(e->boardid[0], e->boardid[1], e->boardid[2], idcode) & index->mask;
+		while (index->slots[slot] >= 0 &&
+			!key_equal(index->images[index->slots[slot]], e->boardid[0], e->boardid[1], e->boardid[2], idcode)) {
+			slot = (slot + 1) & index->mask;
+		}
+		if (index->slots[slot] < 0) { index->slots[slot] = image; }
+	}
+	return 0;
+}
+
+void gwu_toc_index_free(gwu_toc_index_t* index) {
+	free(index->images);
+	free(index->slots);
+	memset(index, 0, sizeof(gwu_toc_index_t));
+}
+
+static int probe(const gwu_toc_index_t* index, int dsr, int ri, int dcd, uint32_t idcode) {
+	uint32_t slot = key_hash(dsr, ri, dcd, idcode) & index->mask;
+	while (index->slots[slot] >= 0) {
+		int image = index->slots[slot];
+		if (key_equal(index->images[image], dsr, ri, dcd, idcode)) { return image; }
+		slot = (slot + 1) & index->mask;
+	}
+	return -1;
+}
+
+static int digit_accepts(int8_t digit, int value) {
+	return digit == GWU_TOC_ANY_DIGIT || digit == value;
+}
+
+int gwu_toc_lookup(const gwu_toc_index_t* index, int dsr, int ri, int dcd, uint32_t idcode, int idcode_known) {
+	int found = -1;
+
+	// Without an IDCODE to compare the key is incomplete, so go through all
+	if (!idcode_known) {
+		for (int i = 0; i < index->num_images; i++) {
+			const gwu_toc_entry_t* e = index->images[i];
+			if (digit_accepts(e->boardid[0], dsr) && digit_accepts(e->boardid[1], ri) &&
+				digit_accepts(e->boardid[2], dcd)) { return i; }
+		}
+		return -1;
+	}
+
+	// Each key the board matches: every digit as read or a wildcard, the
+	// IDCODE as read or any. The first image in file order wins.
+	for (int wild = 0; wild < 16; wild++) {
+		if ((wild & 8) && !any_idcode(idcode)) { continue; }
+		int image = probe(index,
+			(wild & 1) ? GWU_TOC_ANY_DIGIT : dsr,
+			(wild & 2) ? GWU_TOC_ANY_DIGIT : ri,
+			(wild & 4) ? GWU_TOC_ANY_DIGIT : dcd,
+			(wild & 8) ? 0 : any_idcode(idcode));
+		if (image >= 0 && (found < 0 || image < found)) { found = image; }
+	}
+	return found;
+}
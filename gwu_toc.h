@@ -0,0 +1,91 @@
+#ifndef _GWU_TOC_H
+#define _GWU_TOC_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "gwu_image.h"
+
+// Table of contents at the end of an update file, so readers find every
+// part with one seek instead of probing 128k boundaries for signatures.
+// Files without one still carry the signatures and are scanned.
+//
+// The file ends with a footer:
+//   u32 offset of the "UPD9" signature, u32 offset of the first entry,
+//   u32 number of entries, u16 entry size, u16 version, "GTOC"
+// and the entries before it are each:
+//   type (4 chars), u32 offset, u32 length, boardid digits (4 bytes),
+//   u32 IDCODE, u32 CRC-32 of the bytes at offset
+// Entries of a larger size carry fields this version does not know,
+// after these. Offsets are from the start of the file.
+
+#define GWU_TOC_VERSION (1)
+#define GWU_TOC_ENTRY_SIZE (24)
+#define GWU_TOC_FOOTER_SIZE (20)
+
+#define GWU_TOC_ANY_DIGIT (-1) // BOARDID_DIGIT_DONTCARE
+
+typedef struct gwu_toc_entry_s {
+	// "DRVR" for the driver (its u32 length, then the installer), "INST"
+	// for both instruction strings, or the type tag of a firmware image
+	// (header, info and payload)
+	char type[4];
+	uint32_t offset;
+	uint32_t length;
+	int8_t boardid[4]; // DSR, RI, DCD, reserved; firmware images only
+	uint32_t idcode; // Firmware images only, 0 or GWU_ANY_IDCODE for any
+	uint32_t checksum;
+} gwu_toc_entry_t;
+
+typedef struct gwu_toc_s {
+	uint32_t update_offset;
+	uint32_t num_entries;
+	gwu_toc_entry_t* entries;
+} gwu_toc_t;
+
+// CRC-32 (the zlib one) of n bytes, continuing from crc (0 to start)
+uint32_t gwu_crc32(uint32_t crc, const unsigned char* p, size_t n);
+
+// Appends the table for entries to f, which must be open for reading as
+// well, filling in each checksum from what f holds at its offset.
+// Returns 0 on success, -1 on a read or write error.
+int gwu_toc_write(FILE* f, uint32_t update_offset, gwu_toc_entry_t* entries, uint32_t num_entries);
+
+// Reads the table at the end of file. Returns 0 on success, -1 if file
+// has none or it is not one this version reads.
+int gwu_toc_read(gwu_span_t file, gwu_toc_t* toc);
+void gwu_toc_free(gwu_toc_t* toc);
+
+// Returns 1 for firmware image entries
+int gwu_toc_is_image(const gwu_toc_entry_t* e);
+
+// Returns the first entry of type, or NULL
+const gwu_toc_entry_t* gwu_toc_find(const gwu_toc_t* toc, const char* type);
+
+// Sets *bytes to what e covers in file. Returns 0 on success, -1 if it
+// is out of the file.
+int gwu_toc_span(gwu_span_t file, const gwu_toc_entry_t* e, gwu_span_t* bytes);
+
+// Returns 0 if bytes match the checksum of e, -1 if they are corrupt
+int gwu_toc_verify(const gwu_toc_entry_t* e, gwu_span_t bytes);
+
+// Hash index over the firmware images of a table, keyed by boardid
+// digits and IDCODE
+typedef struct gwu_toc_index_s {
+	const gwu_toc_entry_t** images; // In file order
+	int num_images;
+	uint32_t mask; // Table size - 1
+	int32_t* slots; // Image numbers, -1 if free
+} gwu_toc_index_t;
+
+// Returns 0 on success, -1 if out of memory
+int gwu_toc_index_build(gwu_toc_index_t* index, const gwu_toc_t* toc);
+void gwu_toc_index_free(gwu_toc_index_t* index);
+
+// Finds the first firmware image, in file order, that accepts a board
+// with boardid digits dsr, ri and dcd and the given IDCODE. An image
+// accepts any value where it holds a wildcard. With idcode_known 0 the
+// IDCODE is not compared. Returns the image's number among the firmware
+// images, or -1.
+int gwu_toc_lookup(const gwu_toc_index_t* index, int dsr, int ri, int dcd, uint32_t idcode, int idcode_known);
+
+#endif
@@ -0,0 +1,467 @@
+#include "gwu_verify.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "gwu_lz.h"
+#include "ops.h"
+#include "gwu_dry.h"
+
+#define DEFAULT_EVERY (8)
+
+// Deferred replays nothing that waits this long; such waits are erase
+// and program pulses, and replaying them would write the device again.
+#define MAX_REPLAY_TCK (100000)
+#define MAX_REPLAY_USECS (100000)
+
+int gwu_verify_parse(gwu_verify_t* v, const char* spec) {
+	memset(v, 0, sizeof(gwu_verify_t));
+	v->every = DEFAULT_EVERY;
+	if (!strcmp(spec, "full")) { v->policy = GWU_VERIFY_FULL; }
+	else if (!strcmp(spec, "deferred")) { v->policy = GWU_VERIFY_DEFERRED; }
+	else if (!strncmp(spec, "sampled", 7) && (spec[7] == 0 || spec[7] == ':')) {
+		v->policy = GWU_VERIFY_SAMPLED;
+		if (spec[7] == ':') {
+			char* end;
+			v->every = strtol(spec + 8, &end, 0);
+			if (v->every < 1) { return -1; }
+			if (*end == ':') { v->seed = strtoul(end + 1, &end, 0); }
+			if (*end) { return -1; }
+		}
+	}
+	else { return -1; }
+	return 0;
+}
+
+/* Dry run */
+
+typedef struct planner_s {
+	gwu_verify_t* v;
+	int alloced;
+} planner_t;
+
+static void plan_scan(planner_t* p, int checked) {
+	gwu_verify_t* v = p->v;
+	if (!checked) {
+		v->in_section = 0;
+		return;
+	}
+	if (!v->in_section) {
+		if (v->num_sections == p->alloced) {
+			int alloced = p->alloced ? p->alloced * 2 : 64;
+			int* sections = realloc(v->sections, alloced * sizeof(int));
+			if (!sections) { return; }
+			v->sections = sections;
+			p->alloced = alloced;
+		}
+		v->sections[v->num_sections++] = 0;
+		v->in_section = 1;
+	}
+	v->sections[v->num_sections - 1]++;
+}
+
+static void on_scan(void* user, const struct libxsvf_shift* s) {
+	plan_scan((planner_t*)user, s->tdo_data != NULL);
+}
+
+static const gwu_dry_hooks_t planner_hooks = { on_scan, NULL };
+
+/* Deferred verify pass */
+
+typedef struct op_rec_s {
+	size_t start, end; // Byte range in the op-stream
+	unsigned char op;
+	unsigned char checked; // A shift that compares TDO
+	unsigned char ir; // A shift of the instruction register
+	unsigned char state_before, state_after;
+	unsigned long usecs, tck; // OPS_UDELAY
+} op_rec_t;
+
+typedef struct walker_s {
+	gwu_span_t src;
+	size_t pos;
+	op_rec_t* recs;
+	int num_recs;
+	int alloced;
+	size_t ops_start; // End of the dictionary
+	int failed;
+} walker_t;
+
+static int w_byte(walker_t* w) {
+	if (w->pos >= w->src.len) {
+		w->failed = 1;
+		return 0;
+	}
+	return w->src.p[w->pos++];
+}
+
+static unsigned long w_varint(walker_t* w) {
+	unsigned long v = 0;
+	for (int shift = 0; shift < 32 && !w->failed; shift += 7) {
+		int c = w_byte(w);
+		v |= (unsigned long)(c & 0x7f) << shift;
+		if (!(c & 0x80)) { return v; }
+	}
+	w->failed = 1;
+	return 0;
+}
+
+// Splits an op-stream into ops, tracking the TAP state around each
+static int walk_ops(walker_t* w) {
+	if (w_byte(w) != OPS_VERSION) { return -1; }
+	unsigned long num = w_varint(w);
+	for (unsigned long i = 0; i < num && !w->failed; i++) {
+		unsigned long len = w_varint(w);
+		w->pos += (len + 7) / 8;
+	}
+	w->ops_start = w->pos;
+
+	int state = LIBXSVF_TAP_INIT;
+	while (!w->failed) {
+		if (w->num_recs == w->alloced) {
+			int alloced = w->alloced ? w->alloced * 2 : 1024;
+			op_rec_t* recs = realloc(w->recs, alloced * sizeof(op_rec_t));
+			if (!recs) { return -1; }
+			w->recs = recs;
+			w->alloced = alloced;
+		}
+		op_rec_t* r = &w->recs[w->num_recs];
+		memset(r, 0, sizeof(op_rec_t));
+		r->start = w->pos;
+		r->op = w_byte(w);
+		r->state_before = state;
+
+		int flags, count;
+		switch (r->op) {
+		case OPS_END:
+			return w->failed ? -1 : 0;
+		case OPS_TMS:
+			count = w_byte(w);
+			state = w_byte(w);
+			w->pos += (count + 7) / 8;
+			break;
+		case OPS_SHIFT:
+			flags = w_byte(w);
+			w_varint(w);
+			for (int bit = OPS_SHIFT_TDI_DATA; bit <= OPS_SHIFT_RET_MASK; bit <<= 1) {
+				if (flags & bit) { w_varint(w); }
+			}
+			r->checked = (flags & OPS_SHIFT_TDO_DATA) != 0;
+			r->ir = state == LIBXSVF_TAP_IRSHIFT;
+			if (flags & OPS_SHIFT_EXIT_TMS) { state = libxsvf_tap_next(state, 1); }
+			break;
+		case OPS_PULSE:
+			state = libxsvf_tap_next(state, w_byte(w) & OPS_PULSE_TMS);
+			break;
+		case OPS_UDELAY:
+			w_byte(w);
+			r->usecs = w_varint(w);
+			r->tck = w_varint(w);
+			break;
+		case OPS_FREQUENCY:
+			w_varint(w);
+			break;
+		default:
+			return -1;
+		}
+		r->end = w->pos;
+		r->state_after = state;
+		w->num_recs++;
+	}
+	return -1;
+}
+
+// Shortest TMS sequence from one TAP state to another, as an OPS_TMS op
+static void put_path(unsigned char* out, size_t* len, int from, int to) {
+	int prev[LIBXSVF_TAP_IRUPDATE + 1], prev_tms[LIBXSVF_TAP_IRUPDATE + 1];
+	int queue[LIBXSVF_TAP_IRUPDATE + 1], head = 0, tail = 0;
+	for (int i = 0; i <= LIBXSVF_TAP_IRUPDATE; i++) { prev[i] = -1; }
+	prev[from] = from;
+	queue[tail++] = from;
+	while (head < tail && prev[to] < 0) {
+		int s = queue[head++];
+		for (int tms = 0; tms < 2; tms++) {
+			int n = libxsvf_tap_next(s, tms);
+			if (prev[n] < 0) {
+				prev[n] = s;
+				prev_tms[n] = tms;
+				queue[tail++] = n;
+			}
+		}
+	}
+	if (from == to || prev[to] < 0) { return; }
+
+	int bits[LIBXSVF_TAP_IRUPDATE + 1], count = 0;
+	for (int s = to; s != from; s = prev[s]) { bits[count++] = prev_tms[s]; }
+	out[(*len)++] = OPS_TMS;
+	out[(*len)++] = count;
+	out[(*len)++] = to;
+	for (int i = 0; i < (count + 7) / 8; i++) { out[*len + i] = 0; }
+	for (int i = 0; i < count; i++) {
+		if (bits[count - 1 - i]) { out[*len + i / 8] |= 1 << (i % 8); }
+	}
+	*len += (count + 7) / 8;
+}
+
+static int tap_stable(int state) {
+	return state == LIBXSVF_TAP_RESET || state == LIBXSVF_TAP_IDLE ||
+		state == LIBXSVF_TAP_DRPAUSE || state == LIBXSVF_TAP_IRPAUSE;
+}
+
+// Copies an OPS_TMS op up to the first stable state it reaches and
+// returns that state
+static int trim_tms(unsigned char* out, size_t* len, const unsigned char* op, int state) {
+	int count = op[1];
+	int n = 0;
+	while (n < count) {
+		state = libxsvf_tap_next(state, (op[3 + n / 8] >> (n % 8)) & 1);
+		n++;
+		if (tap_stable(state)) { break; }
+	}
+	out[(*len)++] = OPS_TMS;
+	out[(*len)++] = n;
+	out[(*len)++] = state;
+	memcpy(out + *len, op + 3, (n + 7) / 8);
+	if (n % 8) { out[*len + n / 8] &= (1 << (n % 8)) - 1; }
+	*len += (n + 7) / 8;
+	return state;
+}
+
+// Marks the ops from first to last for the verify pass. Fails if they
+// would wait like an erase or program pulse.
+static int keep_range(op_rec_t* recs, char* keep, int first, int last) {
+	for (int i = first; i <= last; i++) {
+		if (recs[i].op == OPS_UDELAY && (recs[i].tck > MAX_REPLAY_TCK || recs[i].usecs > MAX_REPLAY_USECS)) {
+			return -1;
+		}
+		keep[i] = 1;
+	}
+	return 0;
+}
+
+// Writes the kept ops as an op-stream, joining them up with TMS paths
+static unsigned char* put_ops(walker_t* w, const char* keep, size_t* out_len) {
+	// Worst case every kept op gets a TMS path op of up to 5 bytes
+	size_t size = w->ops_start + w->src.len + 5 * (size_t)w->num_recs + 2;
+	unsigned char* out = malloc(size);
+	if (!out) { return NULL; }
+	memcpy(out, w->src.p, w->ops_start);
+	size_t len = w->ops_start;
+	int state = LIBXSVF_TAP_INIT;
+	for (int i = 0; i < w->num_recs; i++) {
+		op_rec_t* r = &w->recs[i];
+		if (!keep[i]) { continue; }
+		if (r->state_before != state) { put_path(out, &len, state, r->state_before); }
+		if (r->op == OPS_TMS && (i + 1 == w->num_recs || !keep[i + 1])) {
+			// The moves after a kept run head for the next, dropped,
+			// scan. Stop them where the TAP first rests instead, so no
+			// register is updated with what was captured for that scan.
+			state = trim_tms(out, &len, w->src.p + r->start, r->state_before);
+			continue;
+		}
+		memcpy(out + len, w->src.p + r->start, r->end - r->start);
+		len += r->end - r->start;
+		state = r->state_after;
+	}
+	out[len++] = OPS_END;
+	out[len++] = state;
+	*out_len = len;
+	return out;
+}
+
+// Splits an op-stream in two. The program part runs up to the end of the
+// last checked section, without the sections. The verify pass holds each
+// checked section with its lead-in, the ops since the previous section
+// or the previous write, whichever is later, followed by the rest of the
+// update. A write is an unchecked data register scan followed by a wait.
+// Anything the update writes after verifying, such as done bits, is so
+// only written once the verify pass has passed.
+//
+// Lead-ins stay in the program too, as they may also enable the device
+// for programming. A section is only left out if it just reads: a
+// checked instruction scan, or a checked scan followed by a wait as a
+// program pulse with its status, keeps the update on full verify.
+static int build_pass(gwu_verify_t* v, gwu_span_t src) {
+	walker_t w = { src, 0, NULL, 0, 0, 0, 0 };
+	char* keep = NULL;
+	char* section = NULL; // Ops of a section, with the moves into it
+	int rc = -1;
+
+	if (walk_ops(&w) || w.num_recs == 0) { goto done; }
+	keep = calloc(w.num_recs, 1);
+	section = calloc(w.num_recs, 1);
+	if (!keep || !section) { goto done; }
+
+	int from = 0; // First op that may belong to a lead-in
+	int last_shift = -1;
+	int tail = -1; // First op after the last section
+	for (int i = 0; i < w.num_recs; i++) {
+		op_rec_t* r = &w.recs[i];
+		if (r->op == OPS_UDELAY && last_shift >= 0 &&
+			!w.recs[last_shift].checked && !w.recs[last_shift].ir) {
+			from = i + 1;
+		}
+		if (r->op == OPS_SHIFT) { last_shift = i; }
+		if (r->op != OPS_SHIFT || !r->checked) { continue; }
+
+		// Take the section and the TAP moves that end it
+		int end = i;
+		while (end + 1 < w.num_recs &&
+			(w.recs[end + 1].op == OPS_TMS ||
+				(w.recs[end + 1].op == OPS_SHIFT && w.recs[end + 1].checked))) {
+			end++;
+		}
+		if (end + 1 < w.num_recs && w.recs[end + 1].op == OPS_UDELAY) { goto done; }
+		for (int k = i; k <= end; k++) {
+			if (w.recs[k].ir) { goto done; }
+			section[k] = 1;
+		}
+		if (i > 0 && w.recs[i - 1].op == OPS_TMS) { section[i - 1] = 1; }
+		if (keep_range(w.recs, keep, from, end)) { goto done; }
+		from = end + 1;
+		tail = end + 1;
+		last_shift = -1;
+		i = end;
+	}
+	if (tail < 0) { goto done; } // Nothing to verify
+	for (int i = tail; i < w.num_recs; i++) { keep[i] = 1; }
+
+	v->pass = put_ops(&w, keep, &v->pass_len);
+	if (!v->pass) { goto done; }
+	for (int i = 0; i < w.num_recs; i++) { keep[i] = i < tail && !section[i]; }
+	v->program = put_ops(&w, keep, &v->program_len);
+	if (!v->program) { goto done; }
+	rc = 0;
+
+done:
+	if (rc) {
+		free(v->pass);
+		free(v->program);
+		v->pass = NULL;
+		v->program = NULL;
+	}
+	free(keep);
+	free(section);
+	free(w.recs);
+	return rc;
+}
+
+int gwu_verify_plan(gwu_verify_t* v, enum libxsvf_mode mode, gwu_span_t payload, int compressed) {
+	unsigned char* raw = NULL;
+	int rc = GWU_VERIFY_PLAN_OK;
+
+	if (v->policy == GWU_VERIFY_FULL) { return GWU_VERIFY_PLAN_OK; }
+
+	// Decode a compressed payload in full; the plan may need to copy from it
+	if (compressed) {
+		lz_reader_t* lz = malloc(sizeof(lz_reader_t));
+		size_t alloced = 64 * 1024, len = 0;
+		raw = malloc(alloced);
+		if (!lz || !raw) {
+			free(lz);
+			free(raw);
+			return GWU_VERIFY_PLAN_ERROR;
+		}
+		lz_reader_open(lz, payload);
+		for (int c; (c = lz_getc(lz)) != EOF; ) {
+			if (len == alloced) {
+				unsigned char* p = realloc(raw, alloced *= 2);
+				if (!p) { rc = GWU_VERIFY_PLAN_ERROR; break; }
+				raw = p;
+			}
+			raw[len++] = c;
+		}
+		free(lz);
+		payload.p = raw;
+		payload.len = len;
+		if (rc) {
+			free(raw);
+			return rc;
+		}
+	}
+
+	// Count the checked scans in each section
+	gwu_dry_t d;
+	planner_t p = { v, 0 };
+	gwu_dry_init(&d, payload, &planner_hooks, &p);
+	d.lend = 1;
+	v->num_sections = 0;
+	v->in_section = 0;
+	if (gwu_dry_play(&d, mode) < 0) { rc = GWU_VERIFY_PLAN_ERROR; }
+
+	// Only an op-stream can be cut into a verify pass
+	if (!rc && v->policy == GWU_VERIFY_DEFERRED &&
+		(mode != LIBXSVF_MODE_OPS || build_pass(v, payload))) {
+		v->policy = GWU_VERIFY_FULL;
+		rc = GWU_VERIFY_PLAN_FULL;
+	}
+
+	v->section = -1;
+	v->index = 0;
+	v->in_section = 0;
+	v->rng = v->seed;
+	free(raw);
+	return rc;
+}
+
+int gwu_verify_scan(gwu_verify_t* v, int checked) {
+	if (!checked) {
+		v->in_section = 0;
+		return 0;
+	}
+	if (!v->in_section) {
+		v->in_section = 1;
+		v->section++;
+		v->index = 0;
+	}
+	else { v->index++; }
+
+	int verify = 1;
+	if (v->policy == GWU_VERIFY_SAMPLED) {
+		int len = v->section < v->num_sections ? v->sections[v->section] : 0;
+		if (v->index != 0 && v->index != len - 1) {
+			if (v->seed) {
+				// xorshift32
+				v->rng ^= v->rng << 13;
+				v->rng ^= (v->rng & 0xFFFFFFFFUL) >> 17;
+				v->rng ^= v->rng << 5;
+				v->rng &= 0xFFFFFFFFUL;
+				verify = v->rng % v->every == 0;
+			}
+			else { verify = v->index % v->every == 0; }
+		}
+	}
+	else if (v->policy == GWU_VERIFY_DEFERRED) { verify = v->in_pass; }
+
+	v->scans++;
+	if (verify) { v->verified++; }
+	return verify;
+}
+
+void gwu_verify_start_pass(gwu_verify_t* v) {
+	v->in_pass = 1;
+	v->section = -1;
+	v->index = 0;
+	v->in_section = 0;
+}
+
+void gwu_verify_print(const gwu_verify_t* v, FILE* f) {
+	static const char* names[] = { "full", "sampled", "deferred" };
+	fprintf(f, "Verify: %s", names[v->policy]);
+	if (v->policy == GWU_VERIFY_SAMPLED) {
+		if (v->seed) { fprintf(f, ", random 1 in %d, seed %lu", v->every, v->seed); }
+		else { fprintf(f, ", 1 in %d", v->every); }
+	}
+	fprintf(f, ", %ld of %ld checked scans compared (%.1lf%%)",
+		v->verified, v->scans, v->scans ? 100.0 * v->verified / v->scans : 100.0);
+	if (v->num_sections) { fprintf(f, " in %d sections", v->num_sections); }
+	fputc('\n', f);
+}
+
+void gwu_verify_free(gwu_verify_t* v) {
+	free(v->sections);
+	free(v->program);
+	free(v->pass);
+	v->sections = NULL;
+	v->program = NULL;
+	v->pass = NULL;
+}
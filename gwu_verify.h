@@ -0,0 +1,78 @@
+#ifndef _GWU_VERIFY_H
+#define _GWU_VERIFY_H
+
+#include <stdio.h>
+#include "libxsvf.h"
+#include "gwu_image.h"
+
+// Verification policy: which TDO-checked scans of an update are compared.
+// On the CH340 every compared bit costs a modem status round trip, so the
+// verify sections dominate the time of most updates.
+//
+//   full      every checked scan (the default)
+//   sampled   the first and last scan of each section and one in every N
+//             of the rest, by stride or picked from a random seed
+//   deferred  programs without the checked sections, then plays them
+//             in a separate pass that finishes the update (op-stream
+//             updates only). It takes about as long as full.
+//
+// A section is a run of checked scans with no unchecked scan between them.
+
+enum gwu_verify_policy {
+	GWU_VERIFY_FULL = 0,
+	GWU_VERIFY_SAMPLED = 1,
+	GWU_VERIFY_DEFERRED = 2
+};
+
+#define GWU_VERIFY_PLAN_OK    0
+#define GWU_VERIFY_PLAN_FULL  1 // Deferred is not safe for this update, verifying in full
+#define GWU_VERIFY_PLAN_ERROR -1
+
+typedef struct gwu_verify_s {
+	enum gwu_verify_policy policy;
+	int every; // Sampled: one in every N scans
+	unsigned long seed; // Sampled: 0 takes every Nth, else random from seed
+
+	// Checked scans in each section, from a dry run of the update
+	int* sections;
+	int num_sections;
+
+	// Deferred: the update up to its last checked section without the
+	// sections and the verify pass with them and the rest, as op-streams,
+	// and whether the pass is playing
+	unsigned char* program;
+	size_t program_len;
+	unsigned char* pass;
+	size_t pass_len;
+	int in_pass;
+
+	// Position in the update
+	int section;
+	int index;
+	int in_section;
+	unsigned long rng;
+
+	// Coverage
+	long scans;
+	long verified;
+} gwu_verify_t;
+
+// Parses "full", "sampled[:N[:SEED]]" or "deferred" into a fresh v.
+// Returns 0 if valid.
+int gwu_verify_parse(gwu_verify_t* v, const char* spec);
+
+// Dry-runs the update to find its sections and, for deferred, builds the
+// verify pass. Returns GWU_VERIFY_PLAN_*; on GWU_VERIFY_PLAN_FULL the
+// policy has been changed to full.
+int gwu_verify_plan(gwu_verify_t* v, enum libxsvf_mode mode, gwu_span_t payload, int compressed);
+
+// Called for each scan in play order. Returns 1 if its TDO should be compared.
+int gwu_verify_scan(gwu_verify_t* v, int checked);
+
+// Starts playing the deferred verify pass
+void gwu_verify_start_pass(gwu_verify_t* v);
+
+void gwu_verify_print(const gwu_verify_t* v, FILE* f);
+void gwu_verify_free(gwu_verify_t* v);
+
+#endif
@@ -0,0 +1,208 @@
+#include "jtag.h"
+#include "jtag_pipe.h"
+#include <string.h>
+#include <stdlib.h>
+
+jtag_t* jtag_new(const jtag_backend_t* backend, const char* portname) {
+	jtag_t* j = calloc(1, sizeof(jtag_t));
+	if (!j) { return NULL; }
+	j->backend = backend;
+	if (backend->priv_size) {
+		j->priv = calloc(1, backend->priv_size);
+		if (!j->priv) {
+			free(j);
+			return NULL;
+		}
+	}
+	if (portname) { strncpy(j->portname, portname, sizeof(j->portname) - 1); }
+	return j;
+}
+
+void jtag_free(jtag_t* j) {
+	if (!j) { return; }
+	jtag_set_pipeline(j, 0);
+	free(j->spill);
+	free(j->priv);
+	free(j);
+}
+
+int jtag_configure(jtag_t* j, const char* option) {
+	char key[32];
+	const char* eq = strchr(option, '=');
+	if (!eq || eq == option || eq - option >= (int)sizeof(key)) { return -1; }
+	if (!j->backend->configure) { return -1; }
+	memcpy(key, option, eq - option);
+	key[eq - option] = 0;
+	return j->backend->configure(j, key, eq + 1);
+}
+
+int jtag_set_timing(jtag_t* j, const char* profile) {
+	if (!j->backend->configure) { return -1; }
+	return j->backend->configure(j, "timing", profile);
+}
+
+static int open_backend(jtag_t* j) {
+	SetupTicks();
+	j->failed = 0;
+	if (j->pipe) { return jtag_pipe_open(j); }
+	return j->backend->open(j);
+}
+
+static void close_backend(jtag_t* j) {
+	if (j->pipe) { jtag_pipe_close(j); }
+	else { j->backend->close(j); }
+}
+
+int jtag_open(jtag_t* j) {
+	if (!j->held) { return open_backend(j); }
+
+	// Lines as a fresh open leaves them, and once they have settled five
+	// TMS=1 clocks take the TAP to Test-Logic-Reset from any state
+	jtag_tms(j, 1);
+	jtag_tdi(j, 1);
+	jtag_settle(j, JTAG_SETTLE_LINES);
+	jtag_tck(j, 5);
+	return 0;
+}
+
+void jtag_close(jtag_t* j) {
+	if (!j->held) { close_backend(j); }
+	else { jtag_sync(j); }
+}
+
+int jtag_session_begin(jtag_t* j) {
+	if (j->held) { return 0; }
+	if (open_backend(j)) { return -1; }
+	j->held = 1;
+	return 0;
+}
+
+void jtag_session_end(jtag_t* j) {
+	if (!j->held) { return; }
+	j->held = 0;
+	close_backend(j);
+}
+
+void jtag_sync(jtag_t* j) {
+	if (j->pipe) { jtag_pipe_sync(j); }
+	else if (j->backend->flush) { j->backend->flush(j); }
+}
+
+static LONGLONG backend_ticks(jtag_t* j) {
+	if (j->backend->ticks) { return j->backend->ticks(j); }
+	return GetTicksNow();
+}
+
+// Each operation is counted and timed so that backends and host-side
+// queuing strategies can be compared on the same workload.
+#define TIMED(_op, _call) do {                \
+	LONGLONG _start = backend_ticks(j);       \
+	_call;                                    \
+	j->stats.ticks[_op] += backend_ticks(j) - _start; \
+	j->stats.count[_op]++;                    \
+} while (0)
+
+int jtag_exec(jtag_t* j, int op, long arg) {
+	int lines = 0;
+	if (j->failed) { return 0; }
+	switch (op) {
+	case JTAG_OP_TMS: TIMED(op, j->backend->set_tms(j, (int)arg)); break;
+	case JTAG_OP_TDI: TIMED(op, j->backend->set_tdi(j, (int)arg)); break;
+	case JTAG_OP_TCK:
+		TIMED(op, j->backend->send_tck(j, (uint16_t)arg));
+		j->stats.tck += arg;
+		break;
+	case JTAG_OP_SAMPLE: TIMED(op, lines = j->backend->sample(j)); break;
+	case JTAG_OP_SETTLE: TIMED(op, j->backend->settle(j, (int)arg)); break;
+	case JTAG_PIPE_DELAY:
+		if (j->backend->delay) { j->backend->delay(j, arg); }
+		else { WaitUsecs(arg); }
+		break;
+	case JTAG_PIPE_SYNC:
+		if (j->backend->flush) { j->backend->flush(j); }
+		break;
+	}
+	return lines;
+}
+
+// Without a pipeline, operations run right here on the caller's thread
+#define RUN(_op, _arg) (j->pipe ? jtag_pipe_push(j, _op, _arg) : (void)jtag_exec(j, _op, _arg))
+
+void jtag_tms(jtag_t* j, int val) { RUN(JTAG_OP_TMS, val); }
+
+void jtag_tdi(jtag_t* j, int val) { RUN(JTAG_OP_TDI, val); }
+
+void jtag_tck(jtag_t* j, uint16_t count) { RUN(JTAG_OP_TCK, count); }
+
+void jtag_settle(jtag_t* j, int what) { RUN(JTAG_OP_SETTLE, what); }
+
+void jtag_delay(jtag_t* j, long usecs) { RUN(JTAG_PIPE_DELAY, usecs); }
+
+int jtag_sample(jtag_t* j) {
+	if (!j->pipe) { return jtag_exec(j, JTAG_OP_SAMPLE, 0); }
+	jtag_sample_queue(j);
+	return jtag_sample_result(j);
+}
+
+void jtag_spill(jtag_t* j, int lines) {
+	if (j->spill_len == j->spill_size) {
+		int size = j->spill_size ? j->spill_size * 2 : 256;
+		unsigned char* p = malloc(size);
+		if (!p) {
+			// Dropping the sample would shift every later result by a bit
+			fprintf(stderr, "Error! Out of memory for JTAG samples on %s.\n", j->portname);
+			jtag_fail(j);
+			return;
+		}
+		for (int i = 0; i < j->spill_len; i++) { p[i] = j->spill[(j->spill_head + i) % j->spill_size]; }
+		free(j->spill);
+		j->spill = p;
+		j->spill_head = 0;
+		j->spill_size = size;
+	}
+	j->spill[(j->spill_head + j->spill_len++) % j->spill_size] = (unsigned char)lines;
+}
+
+void jtag_sample_queue(jtag_t* j) {
+	if (j->pipe) { jtag_pipe_sample_queue(j); }
+	else { jtag_spill(j, jtag_exec(j, JTAG_OP_SAMPLE, 0)); }
+}
+
+int jtag_sample_result(jtag_t* j) {
+	if (j->spill_len > 0) {
+		int lines = j->spill[j->spill_head];
+		j->spill_head = (j->spill_head + 1) % j->spill_size;
+		j->spill_len--;
+		return lines;
+	}
+	if (j->pipe) { return jtag_pipe_sample_result(j); }
+	return 0;
+}
+
+int jtag_failed(jtag_t* j) {
+	return j->failed;
+}
+
+void jtag_fail(jtag_t* j) {
+	j->failed = 1;
+}
+
+LONGLONG jtag_ticks(jtag_t* j) {
+	if (j->pipe) { return jtag_pipe_ticks(j); }
+	return backend_ticks(j);
+}
+
+void jtag_print_stats(jtag_t* j, FILE* f) {
+	static const char* names[JTAG_OP_NUM] = {
+		"TMS changes", "TDI changes", "TCK runs", "Line samples", "Settle waits"
+	};
+	fprintf(f, "JTAG backend: %s%s%s\n", j->backend->name,
+		j->portname[0] ? " on " : "", j->portname);
+	for (int i = 0; i < JTAG_OP_NUM; i++) {
+		fprintf(f, "  %-14s %8ld  %10.3lf ms\n", names[i], j->stats.count[i],
+			(double)j->stats.ticks[i] / ticks_per_ms);
+	}
+	fprintf(f, "  %-14s %8lld\n", "TCK pulses", j->stats.tck);
+	if (j->backend->print_stats) { j->backend->print_stats(j, f); }
+	if (j->pipe) { jtag_pipe_print_stats(j, f); }
+}
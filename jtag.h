@@ -0,0 +1,145 @@
+#ifndef _JTAG_H
+#define _JTAG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "gwu_time.h"
+
+// Lines reported by jtag_sample(), as logic levels
+#define JTAG_TDO (1 << 0)
+#define JTAG_DSR (1 << 1)
+#define JTAG_RI (1 << 2)
+#define JTAG_DCD (1 << 3)
+
+// Backend flags
+#define JTAG_NEEDS_PORT (1 << 0) // Drives a serial port picked by compick()
+#define JTAG_NO_TDO (1 << 1) // TDO is not connected, so never compare it
+
+// What jtag_settle() waits for
+#define JTAG_SETTLE_LINES (0) // TMS/TDI changes and TCK runs have taken effect
+#define JTAG_SETTLE_SAMPLE (1) // TDO and boardid lines can be sampled
+
+enum jtag_op {
+	JTAG_OP_TMS = 0,
+	JTAG_OP_TDI = 1,
+	JTAG_OP_TCK = 2,
+	JTAG_OP_SAMPLE = 3,
+	JTAG_OP_SETTLE = 4,
+	JTAG_OP_NUM = 5
+};
+
+typedef struct jtag_s jtag_t;
+typedef struct jtag_pipe_s jtag_pipe_t;
+
+// A JTAG transport. Backends keep all of their state in jtag_t.priv,
+// which is allocated with priv_size bytes zeroed by jtag_new().
+typedef struct jtag_backend_s {
+	const char* name;
+	const char* description;
+	int flags;
+	size_t priv_size;
+
+	int (*open)(jtag_t* j); // Returns 0 on success
+	void (*close)(jtag_t* j);
+	void (*set_tms)(jtag_t* j, int val);
+	void (*set_tdi)(jtag_t* j, int val);
+	void (*send_tck)(jtag_t* j, uint16_t count);
+	int (*sample)(jtag_t* j); // Returns JTAG_TDO | JTAG_DSR | ... levels
+	void (*settle)(jtag_t* j, int what);
+
+	// Optional, may be NULL
+	int (*configure)(jtag_t* j, const char* key, const char* value); // Returns 0 if accepted
+	LONGLONG (*ticks)(jtag_t* j); // Backend clock, for backends that keep virtual time
+	void (*delay)(jtag_t* j, long usecs);
+	void (*print_stats)(jtag_t* j, FILE* f);
+	void (*flush)(jtag_t* j); // Waits for operations still on their way
+} jtag_backend_t;
+
+typedef struct jtag_stats_s {
+	long count[JTAG_OP_NUM];
+	LONGLONG ticks[JTAG_OP_NUM];
+	long long tck;
+} jtag_stats_t;
+
+struct jtag_s {
+	const jtag_backend_t* backend;
+	void* priv;
+	char portname[16];
+	jtag_stats_t stats;
+	jtag_pipe_t* pipe; // Set by jtag_set_pipeline()
+	int held; // Between jtag_session_begin() and jtag_session_end()
+	volatile int failed; // See jtag_failed()
+
+	// Queued samples already taken, oldest at spill_head
+	unsigned char* spill;
+	int spill_head;
+	int spill_len;
+	int spill_size;
+};
+
+extern const jtag_backend_t jtag_ch340_backend;
+extern const jtag_backend_t jtag_null_backend;
+extern const jtag_backend_t jtag_sim_backend;
+
+// The backends above by name (jtag_backends.c)
+const jtag_backend_t* jtag_find_backend(const char* name);
+void jtag_list_backends(FILE* f);
+
+jtag_t* jtag_new(const jtag_backend_t* backend, const char* portname);
+void jtag_free(jtag_t* j);
+
+// Applies a "KEY=VALUE" backend option. Returns 0 if accepted.
+int jtag_configure(jtag_t* j, const char* option);
+
+// Picks a settle timing profile (fixed, baud or drain, see jtag_timing.h)
+// through the "timing" option. Returns 0 if accepted.
+int jtag_set_timing(jtag_t* j, const char* profile);
+
+// Runs the backend on an I/O thread of its own from the next jtag_open()
+// on. Operations reach it through a lock-free ring, so the caller can
+// parse and encode ahead while the adapter works, and samples come back
+// through a second ring. Returns 0 on success; call it while closed.
+int jtag_set_pipeline(jtag_t* j, int enable);
+
+int jtag_open(jtag_t* j);
+void jtag_close(jtag_t* j);
+
+// Keeps the adapter open from here to jtag_session_end(), so that the
+// boardid check, the chain scan and every play of one board share one
+// connection. In between, jtag_open() only resets the TAP through TMS
+// and jtag_close() only waits for the operations queued so far.
+// Returns 0 on success.
+int jtag_session_begin(jtag_t* j);
+void jtag_session_end(jtag_t* j);
+
+// Waits until every operation queued so far has reached the adapter
+void jtag_sync(jtag_t* j);
+void jtag_tms(jtag_t* j, int val);
+void jtag_tdi(jtag_t* j, int val);
+void jtag_tck(jtag_t* j, uint16_t count);
+int jtag_sample(jtag_t* j);
+void jtag_settle(jtag_t* j, int what);
+
+// Takes a sample without waiting for its result. jtag_sample_result()
+// returns queued samples in order; collect all of them before the next
+// jtag_sample().
+void jtag_sample_queue(jtag_t* j);
+int jtag_sample_result(jtag_t* j);
+
+// Returns 1 once an operation has failed, after which samples no longer
+// read what the lines held. Plays check it and fail.
+int jtag_failed(jtag_t* j);
+
+// Backends call this on an adapter error instead of quitting, so that
+// with several boards only the one behind it fails. Operations after it
+// are not run.
+void jtag_fail(jtag_t* j);
+
+// Time as seen by the backend, in GetTicksNow() units. Backends without
+// a clock of their own use GetTicksNow().
+LONGLONG jtag_ticks(jtag_t* j);
+void jtag_delay(jtag_t* j, long usecs);
+
+void jtag_print_stats(jtag_t* j, FILE* f);
+
+#endif
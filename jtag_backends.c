@@ -0,0 +1,24 @@
+#include "jtag.h"
+#include <string.h>
+
+// Kept apart from jtag.c so that tools which only count operations, such
+// as Packager's dry pass, can link the JTAG layer without any backend
+static const jtag_backend_t* backends[] = {
+	&jtag_ch340_backend,
+	&jtag_null_backend,
+	&jtag_sim_backend,
+	NULL
+};
+
+const jtag_backend_t* jtag_find_backend(const char* name) {
+	for (int i = 0; backends[i]; i++) {
+		if (!strcmp(backends[i]->name, name)) { return backends[i]; }
+	}
+	return NULL;
+}
+
+void jtag_list_backends(FILE* f) {
+	for (int i = 0; backends[i]; i++) {
+		fprintf(f, "  %-8s %s\n", backends[i]->name, backends[i]->description);
+	}
+}
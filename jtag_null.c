@@ -0,0 +1,36 @@
+#include "jtag.h"
+
+// The null backend talks to no hardware. Every operation returns at
+// once and samples read all lines high. TDO is never compared, so a
+// run measures the host's own overhead and the operations it issues.
+
+static int null_open(jtag_t* j) { return 0; }
+
+static void null_close(jtag_t* j) { }
+
+static void null_set_line(jtag_t* j, int val) { }
+
+static void null_send_tck(jtag_t* j, uint16_t count) { }
+
+static int null_sample(jtag_t* j) { return JTAG_TDO | JTAG_DSR | JTAG_RI | JTAG_DCD; }
+
+static void null_settle(jtag_t* j, int what) { }
+
+const jtag_backend_t jtag_null_backend = {
+	"null",
+	"No hardware; counts and times operations only",
+	JTAG_NO_TDO,
+	0,
+	null_open,
+	null_close,
+	null_set_line,
+	null_set_line,
+	null_send_tck,
+	null_sample,
+	null_settle,
+	NULL,
+	NULL,
+	NULL,
+	NULL,
+	NULL
+};
@@ -0,0 +1,230 @@
+#include "jtag_pipe.h"
+#include <stdlib.h>
+#include "gwu_thread.h"
+
+// With a pipeline the host thread only queues operations. An I/O thread
+// started by jtag_open() owns the backend and runs them in order, so
+// parsing and encoding the next scan overlaps with the adapter clocking
+// the last one. Each side only ever writes its own ring index.
+
+#define PIPE_OPS 16384 // Ring sizes, powers of two
+#define PIPE_RESULTS 4096
+
+typedef struct pipe_op_s {
+	int op;
+	long arg;
+} pipe_op_t;
+
+struct jtag_pipe_s {
+	// Operations, from the host to the I/O thread
+	pipe_op_t ops[PIPE_OPS];
+	volatile long ops_tail; // Written by the host
+	char pad1[64];
+	volatile long ops_head; // Written by the I/O thread
+	char pad2[64];
+
+	// Sample results, from the I/O thread back to the host
+	unsigned char results[PIPE_RESULTS];
+	volatile long results_tail; // Written by the I/O thread
+	char pad3[64];
+	volatile long results_head; // Written by the host
+	char pad4[64];
+
+	volatile LONGLONG ticks; // Backend clock as of the last operation run
+	volatile long opened;
+	volatile long synced; // Last JTAG_PIPE_SYNC run, written by the I/O thread
+	long syncs; // JTAG_PIPE_SYNC pushed
+	int open_result;
+	int running;
+	int outstanding; // Samples queued and not yet taken from the results
+	gwu_thread_t thread;
+
+	// Host side
+	long long queued;
+	long full_waits;
+	LONGLONG full_ticks;
+	long sample_waits;
+	LONGLONG sample_ticks;
+
+	// I/O thread side, added up over all opens
+	long idle_waits;
+	LONGLONG idle_ticks;
+	wait_stats_t waits;
+};
+
+int jtag_set_pipeline(jtag_t* j, int enable) {
+	if (!enable) {
+		free(j->pipe);
+		j->pipe = NULL;
+		return 0;
+	}
+	if (!j->pipe) { j->pipe = calloc(1, sizeof(jtag_pipe_t)); }
+	return j->pipe ? 0 : -1;
+}
+
+static void add_waits(wait_stats_t* total, const wait_stats_t* w) {
+	total->waits += w->waits;
+	total->sleeps += w->sleeps;
+	total->overshoot_total += w->overshoot_total;
+	if (w->overshoot_max > total->overshoot_max) { total->overshoot_max = w->overshoot_max; }
+}
+
+static int pipe_main(void* arg) {
+	jtag_t* j = (jtag_t*)arg;
+	jtag_pipe_t* p = j->pipe;
+	int has_ticks = j->backend->ticks != NULL;
+
+	p->open_result = j->backend->open(j);
+	if (has_ticks) { store_ticks(&p->ticks, j->backend->ticks(j)); }
+	store_release(&p->opened, 1);
+	if (p->open_result) { return 0; }
+
+	for (;;) {
+		long head = p->ops_head;
+		if (head == load_acquire(&p->ops_tail)) {
+			LONGLONG start = GetTicksNow();
+			unsigned round = 0;
+			while (head == load_acquire(&p->ops_tail)) { thread_backoff(&round); }
+			p->idle_waits++;
+			p->idle_ticks += GetTicksNow() - start;
+		}
+		pipe_op_t op = p->ops[head];
+		store_release(&p->ops_head, (head + 1) & (PIPE_OPS - 1));
+		if (op.op == JTAG_PIPE_CLOSE) { break; }
+
+		int lines = jtag_exec(j, op.op, op.arg);
+		if (op.op == JTAG_OP_SAMPLE) {
+			// The host keeps fewer samples outstanding than the ring
+			// holds, so this slot is always free
+			long tail = p->results_tail;
+			p->results[tail] = (unsigned char)lines;
+			store_release(&p->results_tail, (tail + 1) & (PIPE_RESULTS - 1));
+		}
+		if (has_ticks) { store_ticks(&p->ticks, j->backend->ticks(j)); }
+		if (op.op == JTAG_PIPE_SYNC) { store_release(&p->synced, op.arg); }
+	}
+
+	j->backend->close(j);
+	add_waits(&p->waits, GetWaitStats());
+	return 0;
+}
+
+int jtag_pipe_open(jtag_t* j) {
+	jtag_pipe_t* p = j->pipe;
+	p->ops_head = p->ops_tail = 0;
+	p->results_head = p->results_tail = 0;
+	p->outstanding = 0;
+	p->opened = 0;
+	p->synced = p->syncs = 0;
+	if (thread_start(&p->thread, pipe_main, j)) { return -1; }
+
+	unsigned round = 0;
+	while (!load_acquire(&p->opened)) { thread_backoff(&round); }
+	if (p->open_result) {
+		thread_join(p->thread);
+		return p->open_result;
+	}
+	p->running = 1;
+	return 0;
+}
+
+void jtag_pipe_push(jtag_t* j, int op, long arg) {
+	jtag_pipe_t* p = j->pipe;
+	if (!p->running) {
+		jtag_exec(j, op, arg);
+		return;
+	}
+
+	long tail = p->ops_tail;
+	long next = (tail + 1) & (PIPE_OPS - 1);
+	if (next == load_acquire(&p->ops_head)) {
+		LONGLONG start = GetTicksNow();
+		unsigned round = 0;
+		while (next == load_acquire(&p->ops_head)) { thread_backoff(&round); }
+		p->full_waits++;
+		p->full_ticks += GetTicksNow() - start;
+	}
+	p->ops[tail].op = op;
+	p->ops[tail].arg = arg;
+	store_release(&p->ops_tail, next);
+	p->queued++;
+}
+
+static int take_result(jtag_pipe_t* p) {
+	long head = p->results_head;
+	if (head == load_acquire(&p->results_tail)) {
+		LONGLONG start = GetTicksNow();
+		unsigned round = 0;
+		while (head == load_acquire(&p->results_tail)) { thread_backoff(&round); }
+		p->sample_waits++;
+		p->sample_ticks += GetTicksNow() - start;
+	}
+	int lines = p->results[head];
+	store_release(&p->results_head, (head + 1) & (PIPE_RESULTS - 1));
+	p->outstanding--;
+	return lines;
+}
+
+void jtag_pipe_sample_queue(jtag_t* j) {
+	jtag_pipe_t* p = j->pipe;
+	if (!p->running) {
+		jtag_spill(j, jtag_exec(j, JTAG_OP_SAMPLE, 0));
+		return;
+	}
+
+	// A long compared scan can queue more samples than the result ring
+	// holds. Move the oldest aside rather than let the I/O thread stall.
+	if (p->outstanding == PIPE_RESULTS - 1) { jtag_spill(j, take_result(p)); }
+	jtag_pipe_push(j, JTAG_OP_SAMPLE, 0);
+	p->outstanding++;
+}
+
+int jtag_pipe_sample_result(jtag_t* j) {
+	jtag_pipe_t* p = j->pipe;
+	if (p->outstanding == 0) { return 0; }
+	return take_result(p);
+}
+
+void jtag_pipe_close(jtag_t* j) {
+	jtag_pipe_t* p = j->pipe;
+	if (!p->running) {
+		j->backend->close(j);
+		return;
+	}
+	jtag_pipe_push(j, JTAG_PIPE_CLOSE, 0);
+	thread_join(p->thread);
+	p->running = 0;
+	p->outstanding = 0;
+}
+
+// Waits for the I/O thread to run everything queued before the sync,
+// so that the backend clock is current when it returns
+void jtag_pipe_sync(jtag_t* j) {
+	jtag_pipe_t* p = j->pipe;
+	if (!p->running) {
+		jtag_exec(j, JTAG_PIPE_SYNC, 0);
+		return;
+	}
+	jtag_pipe_push(j, JTAG_PIPE_SYNC, ++p->syncs);
+	unsigned round = 0;
+	while (load_acquire(&p->synced) != p->syncs) { thread_backoff(&round); }
+}
+
+LONGLONG jtag_pipe_ticks(jtag_t* j) {
+	if (!j->backend->ticks) { return GetTicksNow(); }
+	if (j->pipe->running) { return load_ticks(&j->pipe->ticks); }
+	return j->backend->ticks(j);
+}
+
+void jtag_pipe_print_stats(jtag_t* j, FILE* f) {
+	jtag_pipe_t* p = j->pipe;
+	fprintf(f, "JTAG pipeline: %lld operations queued\n", p->queued);
+	fprintf(f, "  %-14s %8ld  %10.3lf ms\n", "Ring full", p->full_waits,
+		(double)p->full_ticks / ticks_per_ms);
+	fprintf(f, "  %-14s %8ld  %10.3lf ms\n", "Sample waits", p->sample_waits,
+		(double)p->sample_ticks / ticks_per_ms);
+	fprintf(f, "  %-14s %8ld  %10.3lf ms\n", "I/O idle", p->idle_waits,
+		(double)p->idle_ticks / ticks_per_ms);
+	if (p->waits.waits) { fprintf(f, "I/O thread "); }
+	PrintWaitStats(f, &p->waits);
+}
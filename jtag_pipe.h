@@ -0,0 +1,29 @@
+#ifndef _JTAG_PIPE_H
+#define _JTAG_PIPE_H
+
+#include "jtag.h"
+
+// Internal to jtag.c and jtag_pipe.c, which runs a backend on an I/O
+// thread behind jtag_set_pipeline().
+
+// Operations beyond enum jtag_op that travel through the ring
+#define JTAG_PIPE_DELAY (JTAG_OP_NUM)
+#define JTAG_PIPE_CLOSE (JTAG_OP_NUM + 1)
+#define JTAG_PIPE_SYNC (JTAG_OP_NUM + 2)
+
+// Runs one operation on the backend and returns what a sample read
+int jtag_exec(jtag_t* j, int op, long arg);
+
+// Keeps a sample result for jtag_sample_result() to return later
+void jtag_spill(jtag_t* j, int lines);
+
+int jtag_pipe_open(jtag_t* j);
+void jtag_pipe_close(jtag_t* j);
+void jtag_pipe_sync(jtag_t* j);
+void jtag_pipe_push(jtag_t* j, int op, long arg);
+void jtag_pipe_sample_queue(jtag_t* j);
+int jtag_pipe_sample_result(jtag_t* j);
+LONGLONG jtag_pipe_ticks(jtag_t* j);
+void jtag_pipe_print_stats(jtag_t* j, FILE* f);
+
+#endif
@@ -0,0 +1,618 @@
+#include "jtag.h"
+#include "jtag_timing.h"
+#include "jtag_wave.h"
+#include "libxsvf.h"
+#include <string.h>
+#include <stdlib.h>
+
+// The sim backend is a software EPM240 behind a latency-modelled CH340.
+// It runs the IEEE 1149.1 TAP state machine on every TCK edge and keeps
+// the register file update.svf exercises: the 10-bit IR, IDCODE, BYPASS,
+// the 240-bit boundary scan register, the 13-bit ISC address register
+// and the 16-bit ISC program/read register over a word-addressed flash.
+//
+// Time is virtual. Every operation advances the clock by what it would
+// cost on the adapter, so runs are repeatable and bits/sec figures can
+// be compared between host strategies. TCK pulses leave the UART at the
+// configured baud after a USB latency, TMS/TDI changes take effect when
+// their control transfer completes and status reads see TDO as it was
+// one status interval earlier. A host that changes a line while TCK is
+// still on the wire, or samples too early, gets the same wrong answer
+// real hardware would give it.
+
+#define SIM_IR_LEN (10)
+#define SIM_IR_CAPTURE (0x155)
+#define SIM_IR_SAMPLE (0x005)
+#define SIM_IR_IDCODE (0x006)
+#define SIM_IR_EXTEST (0x00F)
+#define SIM_IR_ISC_DISABLE (0x201)
+#define SIM_IR_ISC_ADDRESS_SHIFT (0x203)
+#define SIM_IR_ISC_READ (0x205)
+#define SIM_IR_ISC_ENABLE (0x2CC)
+#define SIM_IR_ISC_ERASE (0x2F2)
+#define SIM_IR_ISC_PROGRAM (0x2F4)
+
+#define SIM_BSR_LEN (240)
+#define SIM_ADDR_LEN (13)
+#define SIM_DATA_LEN (16)
+
+// Flash is kept per ISC start address, which selects a sector that the
+// data register then walks word by word.
+#define SIM_SECTORS (8)
+#define SIM_SECTOR_WORDS (8192)
+#define SIM_SILICON_ID_ADDR (0x0089)
+
+#define SIM_RUNS (256)
+#define SIM_TDO_HIST (4096)
+
+static const uint16_t silicon_id[] = { 0x8232, 0x2AA2, 0x4A82, 0x0C2C, 0x0000 };
+
+typedef struct sim_reg_s {
+	uint64_t w[(SIM_BSR_LEN + 63) / 64];
+	int len;
+} sim_reg_t;
+
+typedef struct sim_sector_s {
+	int used;
+	uint16_t addr;
+	uint16_t words[SIM_SECTOR_WORDS];
+} sim_sector_t;
+
+// A TCK write on its way through the UART. With n pulses to a full
+// character, pulse k is pulse k % n of character k / n.
+typedef struct sim_run_s {
+	long long t; // When the first character starts on the wire
+	int count;
+	int edges; // Edges already applied, two per pulse
+} sim_run_t;
+
+typedef struct sim_edge_s {
+	long long t;
+	int tdo;
+} sim_edge_t;
+
+enum sim_pending {
+	SIM_PENDING_NONE = 0,
+	SIM_PENDING_PROGRAM = 1,
+	SIM_PENDING_ERASE = 2
+};
+
+typedef struct sim_s {
+	int configured;
+
+	// Adapter model, all times in ns
+	long baud;
+	long long line_ns; // TMS/TDI control transfer
+	long long write_ns; // Host cost of a TCK write
+	long long usb_ns; // Until written characters reach the UART
+	long long status_ns; // Age of the modem status the host reads
+	long long sample_ns; // Host cost of a status read
+	long long gate_ns; // Fixed profile settling time after an operation
+	long long gate2_ns; // Fixed profile settling time before a sample
+	int fifo; // Characters the adapter takes before a write blocks
+	int profile; // JTAG_TIMING_*; drain makes writes return once the UART is idle
+	char frame[8]; // Frame format asked for, or empty to pick the fastest
+	long min_pulse_ns; // Shortest TCK high or low the target takes
+	jtag_wave_t wave;
+
+	// Target model
+	uint32_t idcode;
+	int boardid[3]; // DSR, RI, DCD digits
+	long program_tck; // Run-Test/Idle clocks a word program needs
+	long erase_tck; // Run-Test/Idle clocks a sector erase needs
+	int blank; // Start with erased flash instead of an older design
+
+	// Adapter state
+	long long now;
+	jtag_timing_t timing; // What the host knows, in ns
+	long long tx_free; // When the UART goes idle
+	long long last_fall; // When TDO last had a chance to change
+	sim_run_t runs[SIM_RUNS];
+	int run_head;
+	int run_num;
+	int tms;
+	int tdi;
+	sim_edge_t hist[SIM_TDO_HIST]; // TDO changes, oldest first
+	int hist_head;
+	int hist_num;
+	int tdo;
+
+	// TAP and registers
+	int state;
+	int ir;
+	sim_reg_t irreg;
+	sim_reg_t dr;
+	sim_reg_t bsr;
+	int isc;
+	uint16_t addr;
+	int offset;
+	int pending;
+	long pending_tck;
+	uint16_t pending_addr;
+	int pending_offset;
+	uint16_t pending_value;
+	sim_sector_t sectors[SIM_SECTORS];
+
+	// Statistics
+	long line_hazards;
+	long stale_samples;
+	long failed_ops;
+	long programmed_words;
+	long erased_sectors;
+} sim_t;
+
+#define SIM(_j) ((sim_t*)(_j)->priv)
+
+static void sim_defaults(sim_t* s)
+{
+	s->configured = 1;
+	s->baud = 2000000;
+	s->line_ns = 1000000;
+	s->write_ns = 50000;
+	s->usb_ns = 1000000;
+	s->status_ns = 1000000;
+	s->sample_ns = 20000;
+	s->gate_ns = 1000000;
+	s->gate2_ns = 2000000;
+	s->fifo = 32;
+	s->profile = JTAG_TIMING_FIXED;
+
+	s->idcode = 0x020A10DD;
+	s->boardid[0] = s->boardid[1] = s->boardid[2] = 0xF;
+	s->program_tck = 100;
+	s->erase_tck = 500000;
+	s->blank = 0;
+
+	s->tms = 1;
+	s->tdi = 1;
+	s->tdo = 1;
+	s->state = LIBXSVF_TAP_RESET;
+	s->ir = SIM_IR_IDCODE;
+	s->dr.len = 1;
+	s->bsr.len = SIM_BSR_LEN;
+}
+
+static long long char_ns(sim_t* s) { return s->wave.frame_halves * 1000000000LL / (2LL * s->baud); }
+
+// When pulse k of a write starting at t falls, or rises if rise is set
+static long long pulse_ns(sim_t* s, long long t, int k, int rise)
+{
+	int n = s->wave.max_pulses;
+	int halves = rise ? s->wave.rise[k % n] : s->wave.fall[k % n];
+	return t + (long long)(k / n) * char_ns(s) + halves * 1000000000LL / (2LL * s->baud);
+}
+
+static int pulse_chars(sim_t* s, int count) { return (count + s->wave.max_pulses - 1) / s->wave.max_pulses; }
+
+/* Registers, shifted LSB first with TDI entering at the top */
+
+static void reg_load(sim_reg_t* r, int len, uint64_t value)
+{
+	memset(r->w, 0, sizeof(r->w));
+	r->len = len;
+	r->w[0] = len < 64 ? value & ((1ULL << len) - 1) : value;
+}
+
+static void reg_shift(sim_reg_t* r, int in)
+{
+	int words = (r->len + 63) / 64;
+	for (int i = 0; i < words; i++) {
+		r->w[i] >>= 1;
+		if (i + 1 < words) { r->w[i] |= r->w[i + 1] << 63; }
+	}
+	int top = r->len - 1;
+	r->w[top / 64] &= ~(1ULL << (top % 64));
+	r->w[top / 64] |= (uint64_t)(in & 1) << (top % 64);
+}
+
+/* Flash */
+
+static sim_sector_t* sim_sector(sim_t* s, uint16_t addr, int create)
+{
+	sim_sector_t* free_sector = NULL;
+	for (int i = 0; i < SIM_SECTORS; i++) {
+		if (s->sectors[i].used && s->sectors[i].addr == addr) { return &s->sectors[i]; }
+		if (!s->sectors[i].used && !free_sector) { free_sector = &s->sectors[i]; }
+	}
+	if (!create || !free_sector) { return NULL; }
+	free_sector->used = 1;
+	free_sector->addr = addr;
+	memset(free_sector->words, 0xFF, sizeof(free_sector->words));
+	return free_sector;
+}
+
+static uint16_t flash_read(sim_t* s, uint16_t addr, int offset)
+{
+	if (addr == SIM_SILICON_ID_ADDR) {
+		return offset < (int)(sizeof(silicon_id) / sizeof(silicon_id[0])) ? silicon_id[offset] : 0xFFFF;
+	}
+	sim_sector_t* sector = sim_sector(s, addr, 0);
+	if (!sector || offset >= SIM_SECTOR_WORDS) { return 0xFFFF; }
+	return sector->words[offset];
+}
+
+// Fills the design sectors with an older design, so that an update
+// which skips the erase or a program pulse fails verification.
+static void flash_preload(sim_t* s)
+{
+	uint32_t seed = 0x12345678;
+	for (uint16_t addr = 0; addr < 2; addr++) {
+		sim_sector_t* sector = sim_sector(s, addr, 1);
+		for (int i = 0; i < SIM_SECTOR_WORDS; i++) {
+			seed = seed * 1103515245 + 12345;
+			sector->words[i] = (uint16_t)(seed >> 16);
+		}
+	}
+}
+
+static void pending_complete(sim_t* s)
+{
+	if (s->pending == SIM_PENDING_PROGRAM) {
+		sim_sector_t* sector = sim_sector(s, s->pending_addr, 1);
+		if (sector && s->pending_offset < SIM_SECTOR_WORDS) {
+			sector->words[s->pending_offset] &= s->pending_value;
+			s->programmed_words++;
+		}
+		else { s->failed_ops++; }
+	}
+	else if (s->pending == SIM_PENDING_ERASE) {
+		sim_sector_t* sector = sim_sector(s, s->pending_addr, 0);
+		if (sector) { memset(sector->words, 0xFF, sizeof(sector->words)); }
+		s->erased_sectors++;
+	}
+	s->pending = SIM_PENDING_NONE;
+}
+
+// Leaving Run-Test/Idle before a program or erase has had its clocks
+// aborts it, which later shows up as a verify failure.
+static void pending_abort(sim_t* s)
+{
+	if (s->pending != SIM_PENDING_NONE) { s->failed_ops++; }
+	s->pending = SIM_PENDING_NONE;
+}
+
+/* TAP */
+
+static void capture_dr(sim_t* s)
+{
+	switch (s->ir) {
+	case SIM_IR_IDCODE: reg_load(&s->dr, 32, s->idcode); break;
+	case SIM_IR_SAMPLE:
+	case SIM_IR_EXTEST: s->dr = s->bsr; break;
+	case SIM_IR_ISC_ADDRESS_SHIFT: reg_load(&s->dr, SIM_ADDR_LEN, s->addr); break;
+	case SIM_IR_ISC_READ:
+		reg_load(&s->dr, SIM_DATA_LEN, s->isc ? flash_read(s, s->addr, s->offset) : 0xFFFF);
+		break;
+	case SIM_IR_ISC_PROGRAM: reg_load(&s->dr, SIM_DATA_LEN, 0xFFFF); break;
+	default: reg_load(&s->dr, 1, 0); break; // BYPASS and ISC instructions without data
+	}
+}
+
+static void update_dr(sim_t* s)
+{
+	switch (s->ir) {
+	case SIM_IR_SAMPLE:
+	case SIM_IR_EXTEST: s->bsr = s->dr; break;
+	case SIM_IR_ISC_ADDRESS_SHIFT:
+		s->addr = (uint16_t)(s->dr.w[0] & ((1 << SIM_ADDR_LEN) - 1));
+		s->offset = 0;
+		break;
+	case SIM_IR_ISC_READ: s->offset++; break;
+	case SIM_IR_ISC_PROGRAM:
+		// Programming can only clear bits, so an all-ones word is a no-op
+		if (s->isc && (uint16_t)s->dr.w[0] != 0xFFFF) {
+			s->pending = SIM_PENDING_PROGRAM;
+			s->pending_tck = 0;
+			s->pending_addr = s->addr;
+			s->pending_offset = s->offset;
+			s->pending_value = (uint16_t)s->dr.w[0];
+		}
+		s->offset++;
+		break;
+	default: break;
+	}
+}
+
+static void update_ir(sim_t* s)
+{
+	s->ir = (int)(s->irreg.w[0] & ((1 << SIM_IR_LEN) - 1));
+	switch (s->ir) {
+	case SIM_IR_ISC_ENABLE: s->isc = 1; break;
+	case SIM_IR_ISC_DISABLE: s->isc = 0; break;
+	case SIM_IR_ISC_ERASE:
+		if (s->isc) {
+			s->pending = SIM_PENDING_ERASE;
+			s->pending_tck = 0;
+			s->pending_addr = s->addr;
+		}
+		break;
+	default: break;
+	}
+}
+
+// TDO changes on the falling edge and is only driven in the shift states.
+// Otherwise the pull-up makes it read high.
+static void tck_fall(sim_t* s, long long t)
+{
+	int tdo = 1;
+	if (s->state == LIBXSVF_TAP_DRSHIFT) { tdo = (int)(s->dr.w[0] & 1); }
+	else if (s->state == LIBXSVF_TAP_IRSHIFT) { tdo = (int)(s->irreg.w[0] & 1); }
+	if (tdo == s->tdo) { return; }
+	s->tdo = tdo;
+	if (s->hist_num == SIM_TDO_HIST) {
+		s->hist_head = (s->hist_head + 1) % SIM_TDO_HIST;
+		s->hist_num--;
+	}
+	sim_edge_t* e = &s->hist[(s->hist_head + s->hist_num) % SIM_TDO_HIST];
+	e->t = t;
+	e->tdo = tdo;
+	s->hist_num++;
+}
+
+static void tck_rise(sim_t* s)
+{
+	switch (s->state) {
+	case LIBXSVF_TAP_RESET:
+		s->ir = SIM_IR_IDCODE;
+		pending_abort(s);
+		break;
+	case LIBXSVF_TAP_IDLE:
+		if (s->pending != SIM_PENDING_NONE) {
+			long need = s->pending == SIM_PENDING_ERASE ? s->erase_tck : s->program_tck;
+			if (++s->pending_tck >= need) { pending_complete(s); }
+		}
+		break;
+	case LIBXSVF_TAP_DRCAPTURE: pending_abort(s); capture_dr(s); break;
+	case LIBXSVF_TAP_DRSHIFT: reg_shift(&s->dr, s->tdi); break;
+	case LIBXSVF_TAP_DRUPDATE: update_dr(s); break;
+	case LIBXSVF_TAP_IRCAPTURE: pending_abort(s); reg_load(&s->irreg, SIM_IR_LEN, SIM_IR_CAPTURE); break;
+	case LIBXSVF_TAP_IRSHIFT: reg_shift(&s->irreg, s->tdi); break;
+	case LIBXSVF_TAP_IRUPDATE: update_ir(s); break;
+	default: break;
+	}
+	s->state = libxsvf_tap_next(s->state, s->tms);
+}
+
+/* Adapter */
+
+// Applies every TCK edge that happens before t
+static void sim_advance(sim_t* s, long long t)
+{
+	while (s->run_num > 0) {
+		sim_run_t* r = &s->runs[s->run_head];
+		while (r->edges < 2 * r->count) {
+			long long e = pulse_ns(s, r->t, r->edges / 2, r->edges & 1);
+			if (e >= t) { return; }
+			if (r->edges & 1) { tck_rise(s); }
+			else { tck_fall(s, e); }
+			r->edges++;
+		}
+		s->run_head = (s->run_head + 1) % SIM_RUNS;
+		s->run_num--;
+	}
+}
+
+static int sim_tdo_at(sim_t* s, long long t)
+{
+	for (int i = s->hist_num - 1; i >= 0; i--) {
+		sim_edge_t* e = &s->hist[(s->hist_head + i) % SIM_TDO_HIST];
+		if (e->t <= t) { return e->tdo; }
+	}
+	// Older than anything recorded
+	if (s->hist_num == 0) { return s->tdo; }
+	return !s->hist[s->hist_head].tdo;
+}
+
+static void sim_line(sim_t* s, int* line, int val)
+{
+	s->now += s->line_ns;
+	if (s->tx_free > s->now) { s->line_hazards++; }
+	sim_advance(s, s->now);
+	*line = val;
+	jtag_timing_line(&s->timing, s->now);
+}
+
+static int sim_open(jtag_t* j)
+{
+	sim_t* s = SIM(j);
+	if (!s->configured) { sim_defaults(s); }
+	if (!s->blank && !s->sectors[0].used) { flash_preload(s); }
+
+	// Like the ch340 backend, use the fastest frame a CH340 can send
+	int failed = 0;
+	if (s->frame[0]) {
+		failed = jtag_wave_parse(&s->wave, s->frame) || !jtag_wave_build(&s->wave, s->baud, s->min_pulse_ns);
+	}
+	else { failed = jtag_wave_pick(&s->wave, jtag_wave_ch340_formats, s->baud, s->min_pulse_ns); }
+	if (failed) {
+		fprintf(stderr, "Error! No frame format can clock TCK at %ld baud.\n", s->baud);
+		return -1;
+	}
+
+	// A drained one-character write returns once it reaches the UART,
+	// so that is what calibrating the transport overhead would measure
+	jtag_timing_init(&s->timing, s->baud, s->fifo, 1000.0);
+	s->timing.char_time = (LONGLONG)jtag_wave_char_time(&s->wave, s->baud, 1000.0);
+	s->timing.profile = s->profile;
+	s->timing.overhead = s->usb_ns;
+	s->timing.gate = s->gate_ns;
+	s->timing.gate2 = s->gate2_ns;
+	return 0;
+}
+
+static void sim_close(jtag_t* j) { }
+
+static void sim_set_tms(jtag_t* j, int val) { sim_line(SIM(j), &SIM(j)->tms, val); }
+
+static void sim_set_tdi(jtag_t* j, int val) { sim_line(SIM(j), &SIM(j)->tdi, val); }
+
+static void sim_send_tck(jtag_t* j, uint16_t count)
+{
+	sim_t* s = SIM(j);
+	long long issued = s->now;
+	long long start = s->now + s->write_ns;
+	if (count == 0) {
+		s->now = start;
+		jtag_timing_write(&s->timing, issued, s->now, 0);
+		return;
+	}
+
+	// The adapter cannot take more writes than the run queue holds
+	if (s->run_num == SIM_RUNS) {
+		sim_run_t* r = &s->runs[s->run_head];
+		long long end = r->t + pulse_chars(s, r->count) * char_ns(s);
+		if (end > s->now) { s->now = end; }
+	}
+	sim_advance(s, s->now);
+
+	int chars = pulse_chars(s, count);
+	long long wire = s->now + s->usb_ns;
+	if (wire < s->tx_free) { wire = s->tx_free; }
+	sim_run_t* r = &s->runs[(s->run_head + s->run_num) % SIM_RUNS];
+	r->t = wire;
+	r->count = count;
+	r->edges = 0;
+	s->run_num++;
+	s->tx_free = wire + chars * char_ns(s);
+	s->last_fall = pulse_ns(s, wire, count - 1, 0);
+
+	// The write returns once all but the adapter FIFO has been taken.
+	// A draining write also waits for its characters to reach the UART.
+	int held = chars < s->fifo ? chars : s->fifo;
+	int drain = s->timing.profile == JTAG_TIMING_DRAIN;
+	long long ret = s->tx_free - (long long)(drain ? held : s->fifo) * char_ns(s);
+	if (ret < start) { ret = start; }
+	s->now = ret;
+	jtag_timing_write(&s->timing, issued, s->now, chars);
+}
+
+static int sim_sample(jtag_t* j)
+{
+	sim_t* s = SIM(j);
+	s->now += s->sample_ns;
+	sim_advance(s, s->now);
+
+	long long seen = s->now - s->status_ns;
+	if (s->last_fall > seen) { s->stale_samples++; }
+
+	int lines = sim_tdo_at(s, seen) ? JTAG_TDO : 0;
+	int combo = 3 - ((s->tms << 1) | s->tdi);
+	if ((s->boardid[0] >> combo) & 1) { lines |= JTAG_DSR; }
+	if ((s->boardid[1] >> combo) & 1) { lines |= JTAG_RI; }
+	if ((s->boardid[2] >> combo) & 1) { lines |= JTAG_DCD; }
+	return lines;
+}
+
+static void sim_settle(jtag_t* j, int what)
+{
+	sim_t* s = SIM(j);
+	long long end = jtag_timing_until(&s->timing, what);
+	if (end > s->now) { s->now = end; }
+}
+
+static LONGLONG sim_ticks(jtag_t* j)
+{
+	if (!ticks_per_ms) { SetupTicks(); }
+	return (LONGLONG)(SIM(j)->now / 1000000.0 * ticks_per_ms);
+}
+
+static void sim_delay(jtag_t* j, long usecs) { SIM(j)->now += (long long)usecs * 1000; }
+
+// sim_send_tck() already returns when the modelled write would, so no
+// write is left in flight to wait for
+static void sim_flush(jtag_t* j) { }
+
+static int sim_boardid_digit(const char* value)
+{
+	if (strlen(value) != 1) { return -1; }
+	switch (value[0]) {
+	case '0': return 0x0;
+	case '1': return 0xF;
+	case 'D': return 0xA;
+	case 'd': return 0x5;
+	case 'M': return 0xC;
+	case 'm': return 0x3;
+	default: return -1;
+	}
+}
+
+static int sim_configure(jtag_t* j, const char* key, const char* value)
+{
+	sim_t* s = SIM(j);
+	if (!s->configured) { sim_defaults(s); }
+
+	if (!strcmp(key, "timing")) {
+		int profile = jtag_timing_parse(value);
+		if (profile < 0) { return -1; }
+		s->profile = profile == JTAG_TIMING_DEFAULT ? JTAG_TIMING_FIXED : profile;
+		return 0;
+	}
+	if (!strcmp(key, "dsr") || !strcmp(key, "ri") || !strcmp(key, "dcd")) {
+		int digit = sim_boardid_digit(value);
+		if (digit < 0) { return -1; }
+		s->boardid[key[0] == 'd' ? (key[1] == 's' ? 0 : 2) : 1] = digit;
+		return 0;
+	}
+	if (!strcmp(key, "idcode")) {
+		s->idcode = (uint32_t)strtoul(value, NULL, 16);
+		return 0;
+	}
+	if (!strcmp(key, "frame")) {
+		jtag_wave_t wave;
+		if (jtag_wave_parse(&wave, value)) { return -1; }
+		jtag_wave_name(&wave, s->frame, sizeof(s->frame));
+		return 0;
+	}
+
+	char* end;
+	double v = strtod(value, &end);
+	if (end == value || *end || v < 0) { return -1; }
+	if (!strcmp(key, "baud") && v >= 1) { s->baud = (long)v; }
+	else if (!strcmp(key, "line_us")) { s->line_ns = (long long)(v * 1000); }
+	else if (!strcmp(key, "write_us")) { s->write_ns = (long long)(v * 1000); }
+	else if (!strcmp(key, "usb_us")) { s->usb_ns = (long long)(v * 1000); }
+	else if (!strcmp(key, "status_us")) { s->status_ns = (long long)(v * 1000); }
+	else if (!strcmp(key, "sample_us")) { s->sample_ns = (long long)(v * 1000); }
+	else if (!strcmp(key, "gate_us")) { s->gate_ns = (long long)(v * 1000); }
+	else if (!strcmp(key, "gate2_us")) { s->gate2_ns = (long long)(v * 1000); }
+	else if (!strcmp(key, "fifo")) { s->fifo = (int)v; }
+	else if (!strcmp(key, "program_tck")) { s->program_tck = (long)v; }
+	else if (!strcmp(key, "erase_tck")) { s->erase_tck = (long)v; }
+	else if (!strcmp(key, "blank")) { s->blank = v != 0; }
+	else if (!strcmp(key, "min_pulse_ns")) { s->min_pulse_ns = (long)v; }
+	else { return -1; }
+	return 0;
+}
+
+static void sim_print_stats(jtag_t* j, FILE* f)
+{
+	sim_t* s = SIM(j);
+	char frame[8];
+	jtag_wave_name(&s->wave, frame, sizeof(frame));
+	fprintf(f, "Simulated EPM240: IDCODE=0x%08x, %ld baud %s (%d TCK per character), %s timing\n",
+		s->idcode, s->baud, frame, s->wave.max_pulses, jtag_timing_name(s->timing.profile));
+	fprintf(f, "  %-14s %8ld  (TMS/TDI changed with TCK still on the wire)\n", "Line hazards", s->line_hazards);
+	fprintf(f, "  %-14s %8ld  (TDO read before the last pulse was visible)\n", "Stale samples", s->stale_samples);
+	fprintf(f, "  %-14s %8ld  (program or erase cut short)\n", "Failed ISC ops", s->failed_ops);
+	fprintf(f, "  %-14s %8ld\n", "Words written", s->programmed_words);
+	fprintf(f, "  %-14s %8ld\n", "Sector erases", s->erased_sectors);
+}
+
+const jtag_backend_t jtag_sim_backend = {
+	"sim",
+	"Simulated EPM240 behind a CH340 with modelled latencies; runs in virtual time",
+	0,
+	sizeof(sim_t),
+	sim_open,
+	sim_close,
+	sim_set_tms,
+	sim_set_tdi,
+	sim_send_tck,
+	sim_sample,
+	sim_settle,
+	sim_configure,
+	sim_ticks,
+	sim_delay,
+	sim_print_stats,
+	sim_flush
+};
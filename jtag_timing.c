@@ -0,0 +1,59 @@
+#include "jtag_timing.h"
+#include <string.h>
+
+static const char* names[] = { "default", "fixed", "baud", "drain" };
+
+int jtag_timing_parse(const char* name) {
+	for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+		if (!strcmp(name, names[i])) { return i; }
+	}
+	return -1;
+}
+
+const char* jtag_timing_name(int profile) {
+	if (profile < 0 || profile >= (int)(sizeof(names) / sizeof(names[0]))) { return "?"; }
+	return names[profile];
+}
+
+void jtag_timing_init(jtag_timing_t* t, long baud, int fifo, double units_per_us) {
+	t->units_per_us = units_per_us;
+	t->char_time = (LONGLONG)(10 * 1000000.0 / baud * units_per_us);
+	t->fifo = fifo;
+	// A full-speed USB adapter reports modem status once per 1 ms frame
+	t->overhead = (LONGLONG)(1000 * units_per_us);
+	t->status = (LONGLONG)(1000 * units_per_us);
+	t->gate = (LONGLONG)(1000 * units_per_us);
+	t->gate2 = (LONGLONG)(2000 * units_per_us);
+	t->tx_end = 0;
+	t->last = 0;
+}
+
+void jtag_timing_line(jtag_timing_t* t, LONGLONG done) {
+	t->last = done;
+}
+
+void jtag_timing_write(jtag_timing_t* t, LONGLONG issued, LONGLONG done, int chars) {
+	t->last = done;
+	if (chars == 0) { return; }
+	if (t->profile == JTAG_TIMING_DRAIN) {
+		// Only what the adapter FIFO held is still to go
+		int held = chars < t->fifo ? chars : t->fifo;
+		t->tx_end = done + held * t->char_time;
+	}
+	else {
+		// Characters start once the transfer lands and queue behind
+		// whatever is still going out
+		LONGLONG start = issued + t->overhead;
+		if (start < t->tx_end) { start = t->tx_end; }
+		t->tx_end = start + chars * t->char_time;
+	}
+}
+
+LONGLONG jtag_timing_until(const jtag_timing_t* t, int what) {
+	if (t->profile == JTAG_TIMING_FIXED) {
+		return t->last + (what == JTAG_SETTLE_SAMPLE ? t->gate2 : t->gate);
+	}
+	LONGLONG end = t->tx_end > t->last ? t->tx_end : t->last;
+	if (what == JTAG_SETTLE_SAMPLE) { end += t->status; }
+	return end;
+}
@@ -0,0 +1,44 @@
+#ifndef _JTAG_TIMING_H
+#define _JTAG_TIMING_H
+
+#include "jtag.h"
+
+// How long a serial backend waits in jtag_settle(). Times are in the
+// backend's own clock, units_per_us of it to the microsecond.
+enum jtag_timing_profile {
+	JTAG_TIMING_DEFAULT = 0, // Whatever the backend picks on this OS
+	JTAG_TIMING_FIXED = 1, // 1 ms after every operation, 2 ms before a sample
+	JTAG_TIMING_BAUD = 2, // Until queued characters have left the UART at the baud rate
+	JTAG_TIMING_DRAIN = 3 // Writes block until the OS reports the UART idle
+};
+
+typedef struct jtag_timing_s {
+	int profile;
+	double units_per_us;
+	LONGLONG char_time; // One 8N1 character on the wire
+	int fifo; // Characters the adapter holds after the OS reports them sent
+	LONGLONG overhead; // Write call until its first character is on the wire
+	LONGLONG status; // Age of the modem status a sample reads
+	LONGLONG gate; // Fixed profile: settling time after an operation
+	LONGLONG gate2; // Fixed profile: settling time before a sample
+	LONGLONG tx_end; // When the queued characters will have left the UART
+	LONGLONG last; // When the last line change or write returned
+} jtag_timing_t;
+
+// Returns a JTAG_TIMING_* profile, or -1 for an unknown name
+int jtag_timing_parse(const char* name);
+const char* jtag_timing_name(int profile);
+
+// Keeps t->profile; the backend sets it before or after as it likes
+void jtag_timing_init(jtag_timing_t* t, long baud, int fifo, double units_per_us);
+
+// Record a line change or a TCK write of chars characters. issued is
+// when the call was made, done when it returned (for the drain profile,
+// when the OS reported its buffer empty).
+void jtag_timing_line(jtag_timing_t* t, LONGLONG done);
+void jtag_timing_write(jtag_timing_t* t, LONGLONG issued, LONGLONG done, int chars);
+
+// When jtag_settle(what) may return
+LONGLONG jtag_timing_until(const jtag_timing_t* t, int what);
+
+#endif
@@ -0,0 +1,128 @@
+#include "jtag_wave.h"
+#include <stdio.h>
+#include <string.h>
+
+const char* const jtag_wave_ch340_formats[] = {
+	"8N1", "8E1", "8O1", "8M1", "8S1", "8N2", "8E2", "8O2", "8M2", "8S2",
+	"7N1", "7E1", "7O1", "7M1", "7S1", "7N2", "7E2", "7O2", "7M2", "7S2",
+	"6N1", "6E1", "6O1", "6M1", "6S1", "6N2", "6E2", "6O2", "6M2", "6S2",
+	"5N1", "5E1", "5O1", "5M1", "5S1", "5N2", "5E2", "5O2", "5M2", "5S2",
+	NULL
+};
+
+int jtag_wave_parse(jtag_wave_t* w, const char* name) {
+	memset(w, 0, sizeof(jtag_wave_t));
+	if (name[0] < '5' || name[0] > '8' || !name[1] || !strchr("NEOMS", name[1])) { return -1; }
+	w->data_bits = name[0] - '0';
+	w->parity = name[1];
+	if (!strcmp(name + 2, "1")) { w->stop_halves = 2; }
+	else if (!strcmp(name + 2, "1.5")) { w->stop_halves = 3; }
+	else if (!strcmp(name + 2, "2")) { w->stop_halves = 4; }
+	else { return -1; }
+	w->frame_halves = 2 * (1 + w->data_bits + (w->parity != 'N')) + w->stop_halves;
+	return 0;
+}
+
+void jtag_wave_name(const jtag_wave_t* w, char* buf, int size) {
+	const char* stop = w->stop_halves == 3 ? "1.5" : w->stop_halves == 4 ? "2" : "1";
+	snprintf(buf, size, "%d%c%s", w->data_bits, w->parity, stop);
+}
+
+// Lays out the character for value in half bit times: start bit, data
+// LSB first, parity, then the stop bits. Returns the number of halves.
+static int frame_levels(const jtag_wave_t* w, int value, unsigned char* level) {
+	int n = 0;
+	int ones = 0;
+	level[n++] = 0;
+	level[n++] = 0;
+	for (int i = 0; i < w->data_bits; i++) {
+		int bit = (value >> i) & 1;
+		ones += bit;
+		level[n++] = bit;
+		level[n++] = bit;
+	}
+	if (w->parity != 'N') {
+		int bit = w->parity == 'E' ? ones & 1 : w->parity == 'O' ? !(ones & 1) : w->parity == 'M';
+		level[n++] = bit;
+		level[n++] = bit;
+	}
+	for (int i = 0; i < w->stop_halves; i++) { level[n++] = 1; }
+	return n;
+}
+
+// Finds the pulses of the character for value. The run before the start
+// bit is the previous character's last one, so checking every run in the
+// character covers it too. Returns the count, or -1 if a run is too short.
+static int frame_pulses(const jtag_wave_t* w, int value, int min_halves,
+	unsigned char* fall, unsigned char* rise, int* lead)
+{
+	unsigned char level[32];
+	int n = frame_levels(w, value, level);
+	int pulses = 0;
+	for (int i = 0; i < n; ) {
+		int start = i;
+		while (i < n && level[i] == level[start]) { i++; }
+		if (i - start < min_halves) { return -1; }
+		if (level[start]) { continue; }
+		if (pulses == JTAG_WAVE_MAX_PULSES) { return -1; }
+		if (!pulses) { *lead = i - start; }
+		fall[pulses] = (unsigned char)start;
+		rise[pulses] = (unsigned char)i;
+		pulses++;
+	}
+	return pulses;
+}
+
+int jtag_wave_build(jtag_wave_t* w, long baud, long min_pulse_ns) {
+	// Stop bits can leave half a bit, but only at the end of a high run
+	// that also holds a whole one, so a bit time is the floor
+	int min_halves = (int)((min_pulse_ns * 2.0 * baud + 999999999.0) / 1000000000.0);
+	if (min_halves < 2) { min_halves = 2; }
+
+	// Of the characters with the same count, keep the one that puts its
+	// pulses last, after the longest first low
+	int best_lead[JTAG_WAVE_MAX_PULSES + 1];
+	memset(best_lead, 0, sizeof(best_lead));
+	memset(w->chars, 0, sizeof(w->chars));
+	for (int value = 0; value < (1 << w->data_bits); value++) {
+		unsigned char fall[JTAG_WAVE_MAX_PULSES];
+		unsigned char rise[JTAG_WAVE_MAX_PULSES];
+		int lead = 0;
+		int pulses = frame_pulses(w, value, min_halves, fall, rise, &lead);
+		if (pulses > 0 && lead > best_lead[pulses]) {
+			w->chars[pulses] = (unsigned char)value;
+			best_lead[pulses] = lead;
+		}
+	}
+
+	// Every count up to the maximum needs a character of its own
+	w->max_pulses = 0;
+	while (w->max_pulses < JTAG_WAVE_MAX_PULSES && best_lead[w->max_pulses + 1]) { w->max_pulses++; }
+	if (w->max_pulses) {
+		int lead;
+		frame_pulses(w, w->chars[w->max_pulses], min_halves, w->fall, w->rise, &lead);
+	}
+	return w->max_pulses;
+}
+
+int jtag_wave_pick(jtag_wave_t* w, const char* const* formats, long baud, long min_pulse_ns) {
+	jtag_wave_t best;
+	memset(&best, 0, sizeof(best));
+	for (int i = 0; formats[i]; i++) {
+		jtag_wave_t t;
+		if (jtag_wave_parse(&t, formats[i]) || !jtag_wave_build(&t, baud, min_pulse_ns)) { continue; }
+		// Pulses per bit time, compared without dividing
+		long rate = (long)t.max_pulses * best.frame_halves;
+		long best_rate = (long)best.max_pulses * t.frame_halves;
+		if (!best.max_pulses || rate > best_rate || (rate == best_rate && t.max_pulses > best.max_pulses)) {
+			best = t;
+		}
+	}
+	if (!best.max_pulses) { return -1; }
+	*w = best;
+	return 0;
+}
+
+double jtag_wave_char_time(const jtag_wave_t* w, long baud, double units_per_us) {
+	return w->frame_halves * 1000000.0 / (2.0 * baud) * units_per_us;
+}
@@ -0,0 +1,47 @@
+#ifndef _JTAG_WAVE_H
+#define _JTAG_WAVE_H
+
+// UART characters that clock TCK. With TCK on TXD, every low run in a
+// character (the start bit and any data or parity bits that follow it)
+// is one pulse: it falls into the run and rises out of it. The frame
+// format sets how many bit times a character takes and how many
+// alternations fit into it. For 8N1 this is the classic 0x00 (one
+// pulse), 0x40, 0x50, 0x54 and 0x55 (five pulses in ten bit times).
+
+#define JTAG_WAVE_MAX_PULSES (6)
+
+typedef struct jtag_wave_s {
+	int data_bits; // 5 to 8
+	char parity; // 'N'one, 'E'ven, 'O'dd, 'M'ark or 'S'pace
+	int stop_halves; // Stop bits in half bit times: 2, 3 or 4
+	int frame_halves; // Whole character, in half bit times
+
+	int max_pulses; // Pulses in a full character, 0 if the format cannot clock
+	unsigned char chars[JTAG_WAVE_MAX_PULSES + 1]; // chars[n] clocks n pulses
+
+	// Edges of pulse k in a full character, in half bit times from its start
+	unsigned char fall[JTAG_WAVE_MAX_PULSES];
+	unsigned char rise[JTAG_WAVE_MAX_PULSES];
+} jtag_wave_t;
+
+// Frame formats a CH340 sends: 5 to 8 data bits, any parity, 1 or 2 stop
+// bits. Plain 8N1 comes first.
+extern const char* const jtag_wave_ch340_formats[];
+
+// Parses "8N1", "7E2", "5N1.5" and the like. Returns 0 if valid.
+int jtag_wave_parse(jtag_wave_t* w, const char* name);
+void jtag_wave_name(const jtag_wave_t* w, char* buf, int size);
+
+// Fills in the character table for w's frame format at baud, keeping
+// every low and high run at least min_pulse_ns long. Returns max_pulses.
+int jtag_wave_build(jtag_wave_t* w, long baud, long min_pulse_ns);
+
+// Picks the format among the NULL-terminated formats that clocks the
+// most pulses per second at baud. Ties go to more pulses per character,
+// then to the earlier format. Returns 0 on success, -1 if none can clock.
+int jtag_wave_pick(jtag_wave_t* w, const char* const* formats, long baud, long min_pulse_ns);
+
+// One character on the wire, in units of which units_per_us make 1 us
+double jtag_wave_char_time(const jtag_wave_t* w, long baud, double units_per_us);
+
+#endif
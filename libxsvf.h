@@ -24,7 +24,8 @@
 enum libxsvf_mode {
 	LIBXSVF_MODE_SVF = 1,
 	LIBXSVF_MODE_XSVF = 2,
-	LIBXSVF_MODE_SCAN = 3
+	LIBXSVF_MODE_SCAN = 3,
+	LIBXSVF_MODE_OPS = 4
 };
 
 enum libxsvf_tap_state {
@@ -87,16 +88,57 @@ enum libxsvf_mem {
 	LIBXSVF_MEM_SVF_TIR_TDO_DATA = 33,
 	LIBXSVF_MEM_SVF_TIR_TDO_MASK = 34,
 	LIBXSVF_MEM_SVF_TIR_RET_MASK = 35,
-	LIBXSVF_MEM_NUM = 36
+	LIBXSVF_MEM_OPS_DICT_INDEX = 36,
+	LIBXSVF_MEM_OPS_DICT_DATA = 37,
+	LIBXSVF_MEM_XSVF_IR_DATA = 38,
+	LIBXSVF_MEM_SVF_TOKENS = 39,
+	LIBXSVF_MEM_NUM = 40
 };
 
+/* A whole scan for the optional shift_vector() callback. Bit k of the
+ * scan (bit 0 is shifted first) is bit k%8 of byte (len+7)/8-1-k/8,
+ * the layout the players keep their bit vectors in. */
+struct libxsvf_shift {
+	int len;
+	const unsigned char *tdi_data;	/* NULL: TDI is don't care */
+	const unsigned char *tdi_mask;	/* NULL: every TDI bit is significant */
+	const unsigned char *tdo_data;	/* NULL: TDO is not compared */
+	const unsigned char *tdo_mask;	/* NULL: every TDO bit is compared */
+	const unsigned char *ret_mask;	/* SVF RMASK, may be NULL */
+	int exit_tms;			/* Clock the last bit with TMS=1 */
+	int sync;			/* Sync on the last bit (see pulse_tck) */
+};
+
+/* The optional pulse_tms() callback clocks count (up to 16) TCK with
+ * TMS from bit i of tms_bits on clock i and TDI don't care. TAP walks
+ * use it to hand over a whole path at once.
+ *
+ * The optional getspan() callback lends out up to max bytes of the
+ * input in place and consumes them, setting *len to the number lent.
+ * It returns NULL if the input is not in memory, in which case the
+ * players read it with getbyte(). The bytes must stay valid until the
+ * player returns.
+ *
+ * The optional getbytes() callback reads up to n bytes into buf and
+ * returns the number read, fewer only at the end of the input. The XSVF
+ * and op-stream players read whole vectors with it, and a byte at a
+ * time with getbyte() if it is not set.
+ *
+ * Each slot of enum libxsvf_mem holds at most one buffer at a time.
+ * The players only grow a buffer with realloc() and keep it across
+ * commands while it is large enough, so the largest size asked for in
+ * each slot bounds what a play needs. realloc() with size 0 frees. */
 struct libxsvf_host {
 	int (*setup)(struct libxsvf_host *h);
 	int (*shutdown)(struct libxsvf_host *h);
 	void (*udelay)(struct libxsvf_host *h, long usecs, int tms, long num_tck);
 	int (*getbyte)(struct libxsvf_host *h);
+	const unsigned char *(*getspan)(struct libxsvf_host *h, long max, long *len);
+	int (*getbytes)(struct libxsvf_host *h, unsigned char *buf, int n);
 	int (*sync)(struct libxsvf_host *h);
 	int (*pulse_tck)(struct libxsvf_host *h, int tms, int tdi, int tdo, int rmask, int sync);
+	int (*shift_vector)(struct libxsvf_host *h, const struct libxsvf_shift *s);
+	void (*pulse_tms)(struct libxsvf_host *h, int tms_bits, int count);
 	void (*pulse_sck)(struct libxsvf_host *h);
 	void (*set_trst)(struct libxsvf_host *h, int v);
 	int (*set_frequency)(struct libxsvf_host *h, int v);
@@ -117,15 +159,22 @@ const char *libxsvf_mem2str(enum libxsvf_mem which);
 int libxsvf_svf(struct libxsvf_host *h);
 int libxsvf_xsvf(struct libxsvf_host *h);
 int libxsvf_scan(struct libxsvf_host *h);
+int libxsvf_ops(struct libxsvf_host *h);
 int libxsvf_tap_walk(struct libxsvf_host *, enum libxsvf_tap_state);
+int libxsvf_read(struct libxsvf_host *h, unsigned char *buf, int n);
+enum libxsvf_tap_state libxsvf_tap_next(enum libxsvf_tap_state s, int tms);
 
 /* Host accessor macros (see README) */
 #define LIBXSVF_HOST_SETUP() h->setup(h)
 #define LIBXSVF_HOST_SHUTDOWN() h->shutdown(h)
 #define LIBXSVF_HOST_UDELAY(_usecs, _tms, _num_tck) h->udelay(h, _usecs, _tms, _num_tck)
 #define LIBXSVF_HOST_GETBYTE() h->getbyte(h)
+#define LIBXSVF_HOST_GETBYTES(_buf, _n) h->getbytes(h, _buf, _n)
+#define LIBXSVF_HOST_GETSPAN(_max, _len) (h->getspan ? h->getspan(h, _max, _len) : (const unsigned char*)0)
 #define LIBXSVF_HOST_SYNC() (h->sync ? h->sync(h) : 0)
 #define LIBXSVF_HOST_PULSE_TCK(_tms, _tdi, _tdo, _rmask, _sync) h->pulse_tck(h, _tms, _tdi, _tdo, _rmask, _sync)
+#define LIBXSVF_HOST_SHIFT_VECTOR(_s) h->shift_vector(h, _s)
+#define LIBXSVF_HOST_PULSE_TMS(_bits, _count) h->pulse_tms(h, _bits, _count)
 #define LIBXSVF_HOST_PULSE_SCK() do { if (h->pulse_sck) h->pulse_sck(h); } while (0)
 #define LIBXSVF_HOST_SET_TRST(_v) do { if (h->set_trst) h->set_trst(h, _v); } while (0)
 #define LIBXSVF_HOST_SET_FREQUENCY(_v) (h->set_frequency ? h->set_frequency(h, _v) : -1)
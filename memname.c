@@ -28,7 +28,9 @@ const char *libxsvf_mem2str(enum libxsvf_mem which)
 	X(XSVF_TDO_MASK, xsvf_tdo_mask)
 	X(XSVF_ADDR_MASK, xsvf_addr_mask)
 	X(XSVF_DATA_MASK, xsvf_data_mask)
+	X(XSVF_IR_DATA, xsvf_ir_data)
 	X(SVF_COMMANDBUF, svf_commandbuf)
+	X(SVF_TOKENS, svf_tokens)
 	X(SVF_HDR_TDI_DATA, svf_hdr_tdi_data)
 	X(SVF_HDR_TDI_MASK, svf_hdr_tdi_mask)
 	X(SVF_HDR_TDO_DATA, svf_hdr_tdo_data)
@@ -59,6 +61,8 @@ const char *libxsvf_mem2str(enum libxsvf_mem which)
 	X(SVF_SIR_TDO_DATA, svf_sir_tdo_data)
 	X(SVF_SIR_TDO_MASK, svf_sir_tdo_mask)
 	X(SVF_SIR_RET_MASK, svf_sir_ret_mask)
+	X(OPS_DICT_INDEX, ops_dict_index)
+	X(OPS_DICT_DATA, ops_dict_data)
 #undef X
 	return (void*)0;
 }
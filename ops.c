@@ -0,0 +1,243 @@
+/*
+ *  GWUpdate op-stream player
+ *  Plays a precompiled (X)SVF file (see ops.h) through the libxsvf host
+ *  callbacks, so nothing needs to be lexed, parsed or hex-decoded.
+ */
+
+#include "libxsvf.h"
+#include "ops.h"
+
+struct ops_dict {
+	int num;
+	int *index;	/* Byte offset and bit length of each vector */
+	unsigned char *data;	/* Vectors in libxsvf layout */
+	int data_len, data_alloced;
+};
+
+static int read_varint(struct libxsvf_host *h, unsigned long *v)
+{
+	unsigned long result = 0;
+	int shift;
+	for (shift = 0; shift < 32; shift += 7) {
+		int c = LIBXSVF_HOST_GETBYTE();
+		if (c < 0)
+			return -1;
+		result |= (unsigned long)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*v = result;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Vectors are stored in shift order and kept in memory in the layout
+ * the players use, which is the same bytes in reverse order. */
+static int read_dict(struct libxsvf_host *h, struct ops_dict *d)
+{
+	unsigned long num, len;
+	int i, j;
+
+	if (read_varint(h, &num) < 0 || num > 0x100000)
+		return -1;
+	d->num = num;
+	d->index = LIBXSVF_HOST_REALLOC(d->index, (num ? num : 1) * 2 * sizeof(int), LIBXSVF_MEM_OPS_DICT_INDEX);
+	if (!d->index)
+		return -1;
+
+	for (i = 0; i < d->num; i++) {
+		if (read_varint(h, &len) < 0 || len == 0 || len > 0x1000000)
+			return -1;
+		int nbytes = (len + 7) / 8;
+		if (d->data_len + nbytes > d->data_alloced) {
+			d->data_alloced = (d->data_len + nbytes) * 2;
+			d->data = LIBXSVF_HOST_REALLOC(d->data, d->data_alloced, LIBXSVF_MEM_OPS_DICT_DATA);
+			if (!d->data)
+				return -1;
+		}
+		d->index[2*i] = d->data_len;
+		d->index[2*i+1] = len;
+		unsigned char *v = d->data + d->data_len;
+		if (libxsvf_read(h, v, nbytes) < 0)
+			return -1;
+		for (j = 0; j < nbytes/2; j++) {
+			unsigned char c = v[j];
+			v[j] = v[nbytes-1-j];
+			v[nbytes-1-j] = c;
+		}
+		d->data_len += nbytes;
+	}
+	return 0;
+}
+
+static int read_vector(struct libxsvf_host *h, struct ops_dict *d, int len, const unsigned char **v)
+{
+	unsigned long i;
+	if (read_varint(h, &i) < 0 || i >= (unsigned long)d->num || d->index[2*i+1] != len)
+		return -1;
+	*v = d->data + d->index[2*i];
+	return 0;
+}
+
+static int getbit(const unsigned char *data, int n)
+{
+	return (data[n/8] & (1 << (7 - n%8))) ? 1 : 0;
+}
+
+static int play_shift(struct libxsvf_host *h, struct ops_dict *d, int *tdo_error)
+{
+	struct libxsvf_shift s = { 0, (void*)0, (void*)0, (void*)0, (void*)0, (void*)0, 0, 0 };
+	unsigned long len;
+	int flags = LIBXSVF_HOST_GETBYTE();
+
+	if (flags < 0 || read_varint(h, &len) < 0 || len == 0)
+		return -1;
+	s.len = len;
+	if ((flags & OPS_SHIFT_TDI_DATA) && read_vector(h, d, s.len, &s.tdi_data) < 0)
+		return -1;
+	if ((flags & OPS_SHIFT_TDI_MASK) && read_vector(h, d, s.len, &s.tdi_mask) < 0)
+		return -1;
+	if ((flags & OPS_SHIFT_TDO_DATA) && read_vector(h, d, s.len, &s.tdo_data) < 0)
+		return -1;
+	if ((flags & OPS_SHIFT_TDO_MASK) && read_vector(h, d, s.len, &s.tdo_mask) < 0)
+		return -1;
+	if ((flags & OPS_SHIFT_RET_MASK) && read_vector(h, d, s.len, &s.ret_mask) < 0)
+		return -1;
+	s.exit_tms = (flags & OPS_SHIFT_EXIT_TMS) != 0;
+
+	if (s.exit_tms)
+		h->tap_state++;
+
+	if (h->shift_vector) {
+		if (LIBXSVF_HOST_SHIFT_VECTOR(&s) < 0)
+			*tdo_error = 1;
+	} else {
+		int left_padding = (8 - s.len % 8) % 8;
+		int i;
+		for (i=s.len+left_padding-1; i >= left_padding; i--) {
+			int tms = s.exit_tms && i == left_padding;
+			int tdi = -1;
+			if (s.tdi_data && (!s.tdi_mask || getbit(s.tdi_mask, i)))
+				tdi = getbit(s.tdi_data, i);
+			int tdo = -1;
+			if (s.tdo_data && (!s.tdo_mask || getbit(s.tdo_mask, i)))
+				tdo = getbit(s.tdo_data, i);
+			int rmask = s.ret_mask && getbit(s.ret_mask, i);
+			if (LIBXSVF_HOST_PULSE_TCK(tms, tdi, tdo, rmask, 0) < 0)
+				*tdo_error = 1;
+		}
+	}
+
+	if (s.exit_tms)
+		LIBXSVF_HOST_REPORT_TAPSTATE();
+	return 0;
+}
+
+static int play_tms(struct libxsvf_host *h)
+{
+	int count = LIBXSVF_HOST_GETBYTE();
+	int state = LIBXSVF_HOST_GETBYTE();
+	int i, j, bits = 0;
+
+	if (count <= 0 || state < 0 || state > LIBXSVF_TAP_IRUPDATE)
+		return -1;
+	for (i = 0; i < count; i += 8) {
+		int n = count - i < 8 ? count - i : 8;
+		if ((bits = LIBXSVF_HOST_GETBYTE()) < 0)
+			return -1;
+		if (h->pulse_tms) {
+			LIBXSVF_HOST_PULSE_TMS(bits, n);
+		} else {
+			for (j = 0; j < n; j++)
+				LIBXSVF_HOST_PULSE_TCK((bits >> j) & 1, -1, -1, 0, 0);
+		}
+	}
+	h->tap_state = state;
+	LIBXSVF_HOST_REPORT_TAPSTATE();
+	return 0;
+}
+
+int libxsvf_ops(struct libxsvf_host *h)
+{
+	struct ops_dict d = { 0, (void*)0, (void*)0, 0, 0 };
+	unsigned long a, b;
+	int rc = 0;
+
+	if (LIBXSVF_HOST_GETBYTE() != OPS_VERSION) {
+		LIBXSVF_HOST_REPORT_ERROR("Unsupported op-stream version.");
+		rc = -1;
+		goto done;
+	}
+	if (read_dict(h, &d) < 0)
+		goto format_error;
+
+	while (1)
+	{
+		int tdo_error = 0;
+		int op = LIBXSVF_HOST_GETBYTE();
+		int v;
+
+		switch (op)
+		{
+		case OPS_END:
+			if ((v = LIBXSVF_HOST_GETBYTE()) < 0)
+				goto format_error;
+			h->tap_state = v;
+			goto done;
+		case OPS_TMS:
+			if (play_tms(h) < 0)
+				goto format_error;
+			break;
+		case OPS_SHIFT:
+			if (play_shift(h, &d, &tdo_error) < 0)
+				goto format_error;
+			break;
+		case OPS_PULSE:
+			if ((v = LIBXSVF_HOST_GETBYTE()) < 0)
+				goto format_error;
+			if (LIBXSVF_HOST_PULSE_TCK(v & OPS_PULSE_TMS ? 1 : 0,
+					v & OPS_PULSE_TDI_VALID ? (v & OPS_PULSE_TDI ? 1 : 0) : -1,
+					v & OPS_PULSE_TDO_VALID ? (v & OPS_PULSE_TDO ? 1 : 0) : -1,
+					v & OPS_PULSE_RMASK ? 1 : 0, 0) < 0)
+				tdo_error = 1;
+			break;
+		case OPS_UDELAY:
+			if ((v = LIBXSVF_HOST_GETBYTE()) < 0 || read_varint(h, &a) < 0 || read_varint(h, &b) < 0)
+				goto format_error;
+			LIBXSVF_HOST_UDELAY(a, v, b);
+			break;
+		case OPS_FREQUENCY:
+			if (read_varint(h, &a) < 0)
+				goto format_error;
+			if (LIBXSVF_HOST_SET_FREQUENCY(a) < 0) {
+				LIBXSVF_HOST_REPORT_ERROR("FREQUENCY command failed!");
+				rc = -1;
+				goto done;
+			}
+			break;
+		default:
+			goto format_error;
+		}
+
+		if (tdo_error) {
+			LIBXSVF_HOST_REPORT_ERROR("TDO mismatch.");
+			rc = -1;
+			goto done;
+		}
+	}
+
+format_error:
+	LIBXSVF_HOST_REPORT_ERROR("Malformed op-stream.");
+	rc = -1;
+
+done:
+	if (LIBXSVF_HOST_SYNC() != 0 && rc >= 0 ) {
+		LIBXSVF_HOST_REPORT_ERROR("TDO mismatch.");
+		rc = -1;
+	}
+
+	LIBXSVF_HOST_REALLOC(d.index, 0, LIBXSVF_MEM_OPS_DICT_INDEX);
+	LIBXSVF_HOST_REALLOC(d.data, 0, LIBXSVF_MEM_OPS_DICT_DATA);
+
+	return rc;
+}
@@ -0,0 +1,55 @@
+/*
+ *  GWUpdate op-stream format
+ *
+ *  A precompiled (X)SVF file: the host callback sequence the SVF or XSVF
+ *  player would produce, with TAP walks resolved to TMS sequences and
+ *  every bit vector interned in a dictionary. Played by libxsvf_ops() in
+ *  ops.c and written by ops_compile() in opscomp.c.
+ *
+ *  All integers are unsigned LEB128 varints unless noted.
+ *
+ *  u8      version (OPS_VERSION)
+ *  varint  number of dictionary vectors, then for each:
+ *          varint bit length, (len+7)/8 bytes in shift order: bit k of
+ *          the scan (k = 0 is shifted first) is bit k%8 of byte k/8
+ *  ops until OPS_END:
+ *
+ *  OPS_TMS        u8 count (1..255), u8 TAP state afterwards,
+ *                 (count+7)/8 bytes of TMS values in shift order
+ *  OPS_SHIFT      u8 flags, varint bit length, then a varint dictionary
+ *                 index for each vector present, in flag order
+ *  OPS_PULSE      u8 flags (OPS_PULSE_*)
+ *  OPS_UDELAY     u8 tms, varint usecs, varint num_tck
+ *  OPS_FREQUENCY  varint frequency in Hz
+ *  OPS_END        u8 TAP state at the end of the file
+ */
+
+#ifndef _OPS_H
+#define _OPS_H
+
+#define OPS_VERSION (1)
+
+#define OPS_END (0)
+#define OPS_TMS (1)
+#define OPS_SHIFT (2)
+#define OPS_PULSE (3)
+#define OPS_UDELAY (4)
+#define OPS_FREQUENCY (5)
+
+// OPS_SHIFT flags
+#define OPS_SHIFT_EXIT_TMS (1 << 0)
+#define OPS_SHIFT_TDI_DATA (1 << 1)
+#define OPS_SHIFT_TDI_MASK (1 << 2)
+#define OPS_SHIFT_TDO_DATA (1 << 3)
+#define OPS_SHIFT_TDO_MASK (1 << 4)
+#define OPS_SHIFT_RET_MASK (1 << 5)
+
+// OPS_PULSE flags, for single clocks outside a shift
+#define OPS_PULSE_TMS (1 << 0)
+#define OPS_PULSE_TDI (1 << 1)
+#define OPS_PULSE_TDI_VALID (1 << 2)
+#define OPS_PULSE_TDO (1 << 3)
+#define OPS_PULSE_TDO_VALID (1 << 4)
+#define OPS_PULSE_RMASK (1 << 5)
+
+#endif
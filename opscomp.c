@@ -0,0 +1,310 @@
+#include "opscomp.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "ops.h"
+
+typedef struct buf_s {
+	unsigned char* data;
+	size_t len;
+	size_t alloced;
+} buf_t;
+
+#define DICT_HASH_SIZE 4096
+
+typedef struct dict_entry_s {
+	size_t offset; // Into dict.data, the vector in shift order
+	int len;       // In bits
+	int next;      // Next entry in the same hash bucket, -1 ends
+} dict_entry_t;
+
+typedef struct compiler_s {
+	gwu_span_t src;
+	buf_t ops;
+	buf_t dict;
+	dict_entry_t* entries;
+	int num_entries;
+	int alloced_entries;
+	int buckets[DICT_HASH_SIZE];
+	unsigned char* scratch;
+	int scratch_len;
+	unsigned char tms_bits[32]; // Pending TMS-only pulses
+	int tms_count;
+	enum libxsvf_tap_state state;
+	int unsupported;
+	int failed;
+} compiler_t;
+
+static void buf_put(compiler_t* c, buf_t* b, const void* data, size_t len) {
+	if (b->len + len > b->alloced) {
+		size_t alloced = b->alloced ? b->alloced : 4096;
+		while (b->len + len > alloced) { alloced *= 2; }
+		unsigned char* p = realloc(b->data, alloced);
+		if (!p) { c->failed = 1; return; }
+		b->data = p;
+		b->alloced = alloced;
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+static void buf_byte(compiler_t* c, buf_t* b, int v) {
+	unsigned char byte = v;
+	buf_put(c, b, &byte, 1);
+}
+
+static void buf_varint(compiler_t* c, buf_t* b, unsigned long v) {
+	while (v >= 0x80) {
+		buf_byte(c, b, (v & 0x7f) | 0x80);
+		v >>= 7;
+	}
+	buf_byte(c, b, v);
+}
+
+static void flush_tms(compiler_t* c) {
+	if (c->tms_count == 0) { return; }
+	buf_byte(c, &c->ops, OPS_TMS);
+	buf_byte(c, &c->ops, c->tms_count);
+	buf_byte(c, &c->ops, c->state);
+	buf_put(c, &c->ops, c->tms_bits, (c->tms_count + 7) / 8);
+	c->tms_count = 0;
+}
+
+// Interns a libxsvf-layout vector and returns its dictionary index.
+static int intern(compiler_t* c, const unsigned char* v, int len) {
+	int nbytes = (len + 7) / 8;
+	int i;
+	unsigned long hash = len;
+
+	if (nbytes > c->scratch_len) {
+		unsigned char* p = realloc(c->scratch, nbytes);
+		if (!p) { c->failed = 1; return 0; }
+		c->scratch = p;
+		c->scratch_len = nbytes;
+	}
+	for (i = 0; i < nbytes; i++) {
+		c->scratch[i] = v[nbytes - 1 - i];
+	}
+	if (len % 8) {
+		c->scratch[nbytes - 1] &= (1 << (len % 8)) - 1;
+	}
+	for (i = 0; i < nbytes; i++) {
+		hash = hash * 31 + c->scratch[i];
+	}
+	hash %= DICT_HASH_SIZE;
+
+	for (i = c->buckets[hash]; i >= 0; i = c->entries[i].next) {
+		if (c->entries[i].len == len && !memcmp(c->dict.data + c->entries[i].offset, c->scratch, nbytes)) {
+			return i;
+		}
+	}
+
+	if (c->num_entries == c->alloced_entries) {
+		int alloced = c->alloced_entries ? c->alloced_entries * 2 : 256;
+		dict_entry_t* p = realloc(c->entries, alloced * sizeof(dict_entry_t));
+		if (!p) { c->failed = 1; return 0; }
+		c->entries = p;
+		c->alloced_entries = alloced;
+	}
+	i = c->num_entries++;
+	c->entries[i].offset = c->dict.len;
+	c->entries[i].len = len;
+	c->entries[i].next = c->buckets[hash];
+	c->buckets[hash] = i;
+	buf_put(c, &c->dict, c->scratch, nbytes);
+	return i;
+}
+
+static int h_setup(struct libxsvf_host* h) {
+	return 0;
+}
+
+static int h_shutdown(struct libxsvf_host* h) {
+	return 0;
+}
+
+static void h_udelay(struct libxsvf_host* h, long usecs, int tms, long num_tck) {
+	compiler_t* c = h->user_data;
+	long i;
+	flush_tms(c);
+	buf_byte(c, &c->ops, OPS_UDELAY);
+	buf_byte(c, &c->ops, tms);
+	buf_varint(c, &c->ops, usecs);
+	buf_varint(c, &c->ops, num_tck);
+	for (i = 0; i < num_tck && i < 5; i++) {
+		c->state = libxsvf_tap_next(c->state, tms);
+	}
+}
+
+static int h_getbyte(struct libxsvf_host* h) {
+	compiler_t* c = h->user_data;
+	if (c->src.len == 0) { return EOF; }
+	c->src.len--;
+	return *c->src.p++;
+}
+
+static int h_getbytes(struct libxsvf_host* h, unsigned char* buf, int n) {
+	compiler_t* c = h->user_data;
+	size_t k = c->src.len < (size_t)n ? c->src.len : (size_t)n;
+	memcpy(buf, c->src.p, k);
+	c->src.p += k;
+	c->src.len -= k;
+	return (int)k;
+}
+
+static const unsigned char* h_getspan(struct libxsvf_host* h, long max, long* len) {
+	compiler_t* c = h->user_data;
+	const unsigned char* p = c->src.p;
+	*len = c->src.len < (size_t)max ? (long)c->src.len : max;
+	c->src.p += *len;
+	c->src.len -= *len;
+	return p;
+}
+
+static int h_sync(struct libxsvf_host* h) {
+	return 0;
+}
+
+static int h_pulse_tck(struct libxsvf_host* h, int tms, int tdi, int tdo, int rmask, int sync) {
+	compiler_t* c = h->user_data;
+	if (sync) { c->unsupported = 1; }
+
+	if (tdi < 0 && tdo < 0 && !rmask) {
+		if (c->tms_count == 0) { memset(c->tms_bits, 0, sizeof(c->tms_bits)); }
+		c->tms_bits[c->tms_count / 8] |= tms << (c->tms_count % 8);
+		c->state = libxsvf_tap_next(c->state, tms);
+		if (++c->tms_count == 255) { flush_tms(c); }
+		return 0;
+	}
+
+	int flags = 0;
+	if (tms) { flags |= OPS_PULSE_TMS; }
+	if (tdi >= 0) { flags |= OPS_PULSE_TDI_VALID | (tdi ? OPS_PULSE_TDI : 0); }
+	if (tdo >= 0) { flags |= OPS_PULSE_TDO_VALID | (tdo ? OPS_PULSE_TDO : 0); }
+	if (rmask) { flags |= OPS_PULSE_RMASK; }
+	flush_tms(c);
+	buf_byte(c, &c->ops, OPS_PULSE);
+	buf_byte(c, &c->ops, flags);
+	c->state = libxsvf_tap_next(c->state, tms);
+	return 0;
+}
+
+static int h_shift_vector(struct libxsvf_host* h, const struct libxsvf_shift* s) {
+	compiler_t* c = h->user_data;
+	const unsigned char* vectors[5] = { s->tdi_data, s->tdi_mask, s->tdo_data, s->tdo_mask, s->ret_mask };
+	int indexes[5];
+	int flags = s->exit_tms ? OPS_SHIFT_EXIT_TMS : 0;
+	int i;
+
+	if (s->sync) { c->unsupported = 1; }
+	for (i = 0; i < 5; i++) {
+		if (vectors[i]) {
+			flags |= OPS_SHIFT_TDI_DATA << i;
+			indexes[i] = intern(c, vectors[i], s->len);
+		}
+	}
+	flush_tms(c);
+	buf_byte(c, &c->ops, OPS_SHIFT);
+	buf_byte(c, &c->ops, flags);
+	buf_varint(c, &c->ops, s->len);
+	for (i = 0; i < 5; i++) {
+		if (vectors[i]) { buf_varint(c, &c->ops, indexes[i]); }
+	}
+	// libxsvf has already moved h->tap_state on to the exit state
+	if (s->exit_tms) { c->state = libxsvf_tap_next(c->state, 1); }
+	return 0;
+}
+
+static int h_set_frequency(struct libxsvf_host* h, int v) {
+	compiler_t* c = h->user_data;
+	flush_tms(c);
+	buf_byte(c, &c->ops, OPS_FREQUENCY);
+	buf_varint(c, &c->ops, v);
+	return 0;
+}
+
+static void h_report_tapstate(struct libxsvf_host* h) {
+}
+
+static void h_report_device(struct libxsvf_host* h, unsigned long idcode) {
+}
+
+static void h_report_status(struct libxsvf_host* h, const char* message) {
+}
+
+static void h_report_error(struct libxsvf_host* h, const char* file, int line, const char* message) {
+	fprintf(stderr, "[%s:%d] %s\n", file, line, message);
+}
+
+static void* h_realloc(struct libxsvf_host* h, void* ptr, int size, enum libxsvf_mem which) {
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, size);
+}
+
+int ops_compile(gwu_span_t src, enum libxsvf_mode mode, unsigned char** out, size_t* out_len) {
+	compiler_t* c = calloc(1, sizeof(compiler_t));
+	struct libxsvf_host h;
+	int rc = OPS_COMPILE_OK;
+	int i;
+
+	if (!c) { return OPS_COMPILE_ERROR; }
+	c->src = src;
+	c->state = LIBXSVF_TAP_INIT;
+	for (i = 0; i < DICT_HASH_SIZE; i++) { c->buckets[i] = -1; }
+
+	memset(&h, 0, sizeof(h));
+	h.setup = h_setup;
+	h.shutdown = h_shutdown;
+	h.udelay = h_udelay;
+	h.getbyte = h_getbyte;
+	h.getspan = h_getspan;
+	h.getbytes = h_getbytes;
+	h.sync = h_sync;
+	h.pulse_tck = h_pulse_tck;
+	h.shift_vector = h_shift_vector;
+	h.set_frequency = h_set_frequency;
+	h.report_tapstate = h_report_tapstate;
+	h.report_device = h_report_device;
+	h.report_status = h_report_status;
+	h.report_error = h_report_error;
+	h.realloc = h_realloc;
+	h.tap_state = LIBXSVF_TAP_INIT;
+	h.user_data = c;
+
+	int played = mode == LIBXSVF_MODE_XSVF ? libxsvf_xsvf(&h) : libxsvf_svf(&h);
+	flush_tms(c);
+	buf_byte(c, &c->ops, OPS_END);
+	buf_byte(c, &c->ops, h.tap_state);
+
+	if (played < 0 || c->failed) {
+		rc = OPS_COMPILE_ERROR;
+	} else if (c->unsupported) {
+		rc = OPS_COMPILE_UNSUPPORTED;
+	} else {
+		buf_t stream = { NULL, 0, 0 };
+		buf_byte(c, &stream, OPS_VERSION);
+		buf_varint(c, &stream, c->num_entries);
+		for (i = 0; i < c->num_entries; i++) {
+			buf_varint(c, &stream, c->entries[i].len);
+			buf_put(c, &stream, c->dict.data + c->entries[i].offset, (c->entries[i].len + 7) / 8);
+		}
+		buf_put(c, &stream, c->ops.data, c->ops.len);
+		if (c->failed) {
+			free(stream.data);
+			rc = OPS_COMPILE_ERROR;
+		} else {
+			*out = stream.data;
+			*out_len = stream.len;
+		}
+	}
+
+	free(c->ops.data);
+	free(c->dict.data);
+	free(c->entries);
+	free(c->scratch);
+	free(c);
+	return rc;
+}
@@ -0,0 +1,18 @@
+#ifndef _OPSCOMP_H
+#define _OPSCOMP_H
+
+#include <stdio.h>
+#include "libxsvf.h"
+#include "gwu_image.h"
+
+// Compiles an SVF or XSVF file into an op-stream (see ops.h) by running
+// it through libxsvf against a recording host.
+
+#define OPS_COMPILE_OK           0
+#define OPS_COMPILE_UNSUPPORTED  1 // Needs TDO feedback at runtime (XSVF retries)
+#define OPS_COMPILE_ERROR       -1
+
+// On OPS_COMPILE_OK *out holds a malloc()ed op-stream of *out_len bytes
+int ops_compile(gwu_span_t src, enum libxsvf_mode mode, unsigned char** out, size_t* out_len);
+
+#endif
@@ -54,6 +54,14 @@ int libxsvf_play(struct libxsvf_host *h, enum libxsvf_mode mode)
 #endif
 	}
 
+	if (mode == LIBXSVF_MODE_OPS) {
+#ifdef LIBXSVF_WITHOUT_OPS
+		LIBXSVF_HOST_REPORT_ERROR("Op-stream support in libxsvf is disabled.");
+#else
+		rc = libxsvf_ops(h);
+#endif
+	}
+
 	libxsvf_tap_walk(h, LIBXSVF_TAP_RESET);
 	if (LIBXSVF_HOST_SYNC() != 0 && rc >= 0 ) {
 		LIBXSVF_HOST_REPORT_ERROR("TDO mismatch in TAP reset. (this is not possible!)");
@@ -70,3 +78,18 @@ int libxsvf_play(struct libxsvf_host *h, enum libxsvf_mode mode)
 	return rc;
 }
 
+/* Reads exactly n bytes, returns -1 at the end of the input */
+int libxsvf_read(struct libxsvf_host *h, unsigned char *buf, int n)
+{
+	int i;
+	if (h->getbytes)
+		return LIBXSVF_HOST_GETBYTES(buf, n) == n ? 0 : -1;
+	for (i = 0; i < n; i++) {
+		int ch = LIBXSVF_HOST_GETBYTE();
+		if (ch < 0)
+			return -1;
+		buf[i] = ch;
+	}
+	return 0;
+}
+
@@ -1,53 +1,152 @@
+#ifdef __linux__
+#define _GNU_SOURCE // copy_file_range()
+#endif
+
 #include "streamtools.h"
 #include <string.h>
 
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#endif
+
 #define LEN128K (128 * 1024)
 #define LEN128K_MASK (LEN128K - 1)
 
-int file_pad128k(FILE* to) {
-	long baselength = ftell(to);
-	long insertpos = (baselength + LEN128K_MASK) & (~LEN128K_MASK);
-	long padding = insertpos - baselength;
+#define STREAM_BUF (8 * LEN128K) // Bytes moved per fread()/fwrite()
+#define TO_EOF (-1) // Count for copying everything left
 
-	for (int i = 0; i < padding; i++) {
-		fputc(0, to);
-		if (ferror(to)) { return -1; }
+static unsigned char stream_buf[STREAM_BUF];
+static const unsigned char zeros[LEN128K];
+
+// Copies count bytes, or up to EOF, through stream_buf. Returns the
+// number of bytes copied, or -1 on error.
+static long long block_copy(FILE* to, FILE* from, long long count) {
+	long long copied = 0;
+	while (count == TO_EOF || copied < count) {
+		size_t chunk = (count == TO_EOF || count - copied > STREAM_BUF) ? STREAM_BUF : (size_t)(count - copied);
+		size_t n = fread(stream_buf, 1, chunk, from);
+		if (ferror(from)) { return -1; }
+		if (n && fwrite(stream_buf, 1, n, to) != n) { return -1; }
+		copied += n;
+		if (n < chunk) { break; }
 	}
+	return copied;
 }
 
-int file_copy128k(FILE* to, FILE* from, size_t count) {
-	for (int i = 0; i < count; i++) {
-		for (int j = 0; j < LEN128K; j++) {
-			int c = fgetc(from);
-			if (ferror(from) || c == EOF) { return -1; }
-			fputc(c, to);
-			if (ferror(to)) { return -1; }
+#ifdef __linux__
+#define KERNEL_CHUNK (64L * 1024 * 1024) // Bytes per system call
+#define KERNEL_NONE (-2) // Not regular files, or no kernel support
+
+static int regular_file(int fd) {
+	struct stat st;
+	return !fstat(fd, &st) && S_ISREG(st.st_mode);
+}
+
+// Copies count bytes, or up to EOF, between two regular files without
+// passing them through user space: copy_file_range() where the kernel
+// has it, sendfile() otherwise. Both streams are left where a byte loop
+// would have left them. Returns the number of bytes copied, -1 on
+// error or KERNEL_NONE if the files need block_copy().
+static long long kernel_copy(FILE* to, FILE* from, long long count) {
+	if (fflush(to)) { return -1; }
+	int fd_to = fileno(to);
+	int fd_from = fileno(from);
+	if (!regular_file(fd_to) || !regular_file(fd_from)) { return KERNEL_NONE; }
+	off_t in = ftello(from);
+	off_t out = ftello(to);
+	if (in < 0 || out < 0) { return KERNEL_NONE; }
+
+	long long copied = 0;
+	int use_sendfile = 0;
+	while (count == TO_EOF || copied < count) {
+		size_t chunk = (count == TO_EOF || count - copied > KERNEL_CHUNK) ? KERNEL_CHUNK : (size_t)(count - copied);
+		ssize_t n;
+		if (!use_sendfile) {
+			n = copy_file_range(fd_from, &in, fd_to, &out, chunk, 0);
+			if (n < 0 && !copied && (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP)) {
+				// sendfile() writes at the file offset of the output
+				if (lseek(fd_to, out, SEEK_SET) < 0) { return KERNEL_NONE; }
+				use_sendfile = 1;
+				continue;
+			}
+		}
+		else {
+			n = sendfile(fd_to, fd_from, &in, chunk);
+			if (n < 0 && !copied && (errno == ENOSYS || errno == EINVAL)) { return KERNEL_NONE; }
+			if (n > 0) { out += n; }
 		}
+		if (n < 0 && errno == EINTR) { continue; }
+		if (n < 0) { return -1; }
+		if (n == 0) { break; }
+		copied += n;
 	}
+
+	if (fseeko(from, in, SEEK_SET) || fseeko(to, out, SEEK_SET)) { return -1; }
+	return copied;
+}
+
+// Pads a regular file to length by extending it, which the file system
+// fills with zeros without writing them. Returns 0 on success, -1 if the
+// padding has to be written.
+static int zero_extend(FILE* to, off_t length) {
+	struct stat st;
+	if (fflush(to)) { return -1; }
+	int fd = fileno(to);
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size != ftello(to)) { return -1; }
+	if (ftruncate(fd, length)) { return -1; }
+	return fseeko(to, length, SEEK_SET) ? -1 : 0;
+}
+#endif
+
+static long long stream_copy(FILE* to, FILE* from, long long count) {
+#ifdef __linux__
+	long long copied = kernel_copy(to, from, count);
+	if (copied != KERNEL_NONE) { return copied; }
+#endif
+	return block_copy(to, from, count);
+}
+
+int file_pad128k(FILE* to) {
+	long baselength = ftell(to);
+	if (baselength < 0) { return -1; }
+	long insertpos = (baselength + LEN128K_MASK) & (~LEN128K_MASK);
+	size_t padding = insertpos - baselength;
+	if (padding == 0) { return 0; }
+
+#ifdef __linux__
+	if (!zero_extend(to, insertpos)) { return 0; }
+#endif
+	if (fwrite(zeros, 1, padding, to) != padding) { return -1; }
 	return 0;
 }
 
+int file_copy128k(FILE* to, FILE* from, size_t count) {
+	long long length = (long long)count * LEN128K;
+	return stream_copy(to, from, length) == length ? 0 : -1;
+}
+
+int file_copy(FILE* to, FILE* from, size_t length) {
+	return stream_copy(to, from, (long long)length) == (long long)length ? 0 : -1;
+}
+
 int file_writeall(FILE* to, FILE* from) {
-	while (1) {
-		int c = fgetc(from);
-		if (ferror(from)) { return -1; }
-		if (c == EOF) { break; }
-		fputc(c, to);
-		if (ferror(to)) { return -1; }
-	}
-	return 0;
+	return stream_copy(to, from, TO_EOF) < 0 ? -1 : 0;
 }
 
 int file_writeallstr(FILE* to, FILE* from) {
 	while (1) {
-		int c = fgetc(from);
+		size_t n = fread(stream_buf, 1, STREAM_BUF, from);
 		if (ferror(from)) { return -1; }
-		if (c == EOF || c == 0) {
+		unsigned char* end = memchr(stream_buf, 0, n);
+		size_t len = end ? (size_t)(end - stream_buf) : n;
+		if (len && fwrite(stream_buf, 1, len, to) != len) { return -1; }
+		if (end || n < STREAM_BUF) {
 			fputc(0, to);
 			break;
 		}
-		fputc(c, to);
-		if (ferror(to)) { return -1; }
 	}
 	return 0;
 };
@@ -2,10 +2,21 @@
 #define _STREAMTOOLS_H
 #include <stdio.h>
 
+// Copies go through a large buffer, or stay in the kernel (Linux
+// copy_file_range() or sendfile()) when both ends are regular files.
+// They return 0 on success and -1 on a read or write error.
+
+// Pads with zeros to the next 128k boundary
 int file_pad128k(FILE* to);
+// Copies count 128k blocks, failing if from ends first
 int file_copy128k(FILE* to, FILE* from, size_t count);
+// Copies length bytes, failing if from ends first
+int file_copy(FILE* to, FILE* from, size_t length);
 
+// Copies everything left in from
 int file_writeall(FILE* to, FILE* from);
+// Copies up to the first zero byte or the end of from, then writes a
+// zero. May read past the zero.
 int file_writeallstr(FILE* to, FILE* from);
 
 int file_search128k(FILE *f, char *sig);
@@ -20,120 +20,322 @@
 
 #include "libxsvf.h"
 
-static int read_command(struct libxsvf_host *h, char **buffer_p, int *len_p)
+#if !defined(LIBXSVF_WITHOUT_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#  include <emmintrin.h>
+#  define SVF_HEX_SSE2
+#elif !defined(LIBXSVF_WITHOUT_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+#  include <arm_neon.h>
+#  define SVF_HEX_NEON
+#endif
+
+/* An SVF command is cut into tokens that point into the input: words,
+ * and the text between '(' and ')'. If the host lends out the rest of
+ * its input with getspan(), the whole file is tokenized in place.
+ * Otherwise each command is read into a buffer and tokenized there.
+ * Commands with more tokens than fit inline, such as long STATE paths
+ * or PIOMAP lists, grow a token array from the host. */
+
+#define SVF_INLINE_TOKENS 64
+
+struct svf_token {
+	const char *p;
+	int len;
+	int paren;
+};
+
+struct svf_reader {
+	const char *p, *end;
+	int borrowed;
+	char *buffer;
+	int buffer_len;
+	const char *cmd;
+	int cmd_len;
+	struct svf_token *tok; /* tok_inline until a command outgrows it */
+	int tok_max;
+	int num;
+	struct svf_token tok_inline[SVF_INLINE_TOKENS];
+};
+
+/* Keywords 1 to 16 are the TAP states, with the same numbers */
+enum svf_keyword {
+	KW_NONE = 0,
+	KW_ENDDR = 17, KW_ENDIR, KW_FREQUENCY, KW_HDR, KW_HIR, KW_PIO, KW_PIOMAP,
+	KW_RUNTEST, KW_SDR, KW_SIR, KW_STATE, KW_TDR, KW_TIR, KW_TRST,
+	KW_TDI, KW_TDO, KW_SMASK, KW_MASK, KW_RMASK, KW_MAXIMUM, KW_ENDSTATE,
+	KW_SEC, KW_TCK, KW_SCK, KW_ON, KW_OFF, KW_Z, KW_ABSENT,
+	KW_NUM
+};
+
+static const char * const svf_keywords[KW_NUM] = {
+	"",
+	"RESET", "IDLE",
+	"DRSELECT", "DRCAPTURE", "DRSHIFT", "DREXIT1", "DRPAUSE", "DREXIT2", "DRUPDATE",
+	"IRSELECT", "IRCAPTURE", "IRSHIFT", "IREXIT1", "IRPAUSE", "IREXIT2", "IRUPDATE",
+	"ENDDR", "ENDIR", "FREQUENCY", "HDR", "HIR", "PIO", "PIOMAP",
+	"RUNTEST", "SDR", "SIR", "STATE", "TDR", "TIR", "TRST",
+	"TDI", "TDO", "SMASK", "MASK", "RMASK", "MAXIMUM", "ENDSTATE",
+	"SEC", "TCK", "SCK", "ON", "OFF", "Z", "ABSENT"
+};
+
+/* Perfect hash of the keywords: no two of them share a slot, so one
+ * compare tells whether a word is the keyword in its slot. The hash
+ * mixes the length with the first, last and next to last character,
+ * each folded to upper case. */
+static const unsigned char svf_keyword_slots[128] = {
+	 0,  0,  0, 31,  0,  7, 39,  4,  0, 38, 40,  0,  0,  0,  0,  0,
+	 0,  0,  0,  2, 42,  0,  0, 23,  0, 21, 12,  0, 44,  0, 15, 13,
+	 0,  0,  0,  0, 18,  0, 10,  0,  0,  0,  0,  0,  0, 19,  0,  0,
+	20,  5,  0, 30,  0,  8,  6, 24,  0,  0, 17,  0,  0,  3,  0, 33,
+	27,  0,  0, 35,  0,  0,  0,  0,  0,  0,  0,  0, 36,  0,  0,  0,
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0, 34,  0,  0,  0,  0,
+	 0,  0,  0, 29, 41,  0,  0,  0, 26, 16,  0,  0,  0,  0,  0, 14,
+	11,  0,  0,  0,  0,  0, 43,  0, 22,  1, 28, 37,  0, 32, 25,  9,
+};
+
+static int keyword(const struct svf_reader *r, int i)
 {
-	char *buffer = *buffer_p;
-	int braket_mode = 0;
-	int len = *len_p;
+	if (i >= r->num || r->tok[i].paren)
+		return KW_NONE;
+	const char *p = r->tok[i].p;
+	int len = r->tok[i].len;
+	unsigned int key = (unsigned int)(p[0] & 0x5f) << 16 |
+		(unsigned int)(p[len > 1 ? len-2 : 0] & 0x5f) << 8 |
+		(unsigned int)(p[len-1] & 0x5f);
+	key ^= (unsigned int)len << 24;
+	int kw = svf_keyword_slots[(key * 0xfdf6f6fdu) >> 25];
+	const char *name = svf_keywords[kw];
+	int j;
+	for (j = 0; j < len; j++) {
+		int ch = p[j];
+		if (ch >= 'a' && ch <= 'z')
+			ch -= 'a' - 'A';
+		if (ch != name[j])
+			return KW_NONE;
+	}
+	return name[len] == 0 ? kw : KW_NONE;
+}
+
+static int token2tapstate(const struct svf_reader *r, int i)
+{
+	int kw = keyword(r, i);
+	return kw >= LIBXSVF_TAP_RESET && kw <= LIBXSVF_TAP_IRUPDATE ? kw : -1;
+}
+
+static int is_comment(const char *p, const char *end)
+{
+	return *p == '!' || (*p == '/' && p+1 < end && p[1] == '/');
+}
+
+/* Skips whitespace and comments, which run to the end of the line */
+static const char *skip_blank(const char *p, const char *end)
+{
+	while (p < end) {
+		if ((unsigned char)*p <= ' ') {
+			p++;
+		} else if (is_comment(p, end)) {
+			while (p < end && ((unsigned char)*p >= ' ' || *p == '\t'))
+				p++;
+		} else
+			break;
+	}
+	return p;
+}
+
+/* Reads one command, up to and including its ';', into the buffer */
+static int read_command(struct libxsvf_host *h, struct svf_reader *r)
+{
+	int comment = 0;
 	int p = 0;
 
 	while (1)
 	{
-		if (len < p+10) {
-			len = len < 64 ? 96 : len*2;
-			buffer = LIBXSVF_HOST_REALLOC(buffer, len, LIBXSVF_MEM_SVF_COMMANDBUF);
-			*buffer_p = buffer;
-			*len_p = len;
-			if (!buffer) {
+		if (r->buffer_len < p+2) {
+			r->buffer_len = r->buffer_len < 64 ? 96 : r->buffer_len*2;
+			r->buffer = LIBXSVF_HOST_REALLOC(r->buffer, r->buffer_len, LIBXSVF_MEM_SVF_COMMANDBUF);
+			if (!r->buffer) {
 				LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
 				return -1;
 			}
 		}
-		buffer[p] = 0;
 
 		int ch = LIBXSVF_HOST_GETBYTE();
-		if (ch < 0) {
-handle_eof:
-			if (p == 0)
+		if (ch < 0)
+			break;
+		r->buffer[p++] = ch;
+		if (comment) {
+			if (ch < ' ' && ch != '\t')
+				comment = 0;
+			continue;
+		}
+		if (ch == '!' || (ch == '/' && p > 1 && r->buffer[p-2] == '/'))
+			comment = 1;
+		else if (ch == ';')
+			break;
+	}
+	r->p = r->buffer;
+	r->end = r->buffer + p;
+	return 0;
+}
+
+/* Doubles the token array, moving it out of tok_inline the first time */
+static int grow_tokens(struct libxsvf_host *h, struct svf_reader *r)
+{
+	int inline_tok = r->tok == r->tok_inline;
+	int max = r->tok_max * 2;
+	struct svf_token *tok = LIBXSVF_HOST_REALLOC(inline_tok ? (void*)0 : r->tok,
+			max * (int)sizeof(struct svf_token), LIBXSVF_MEM_SVF_TOKENS);
+	if (!tok) {
+		LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
+		return -1;
+	}
+	if (inline_tok) {
+		int i;
+		for (i = 0; i < r->num; i++)
+			tok[i] = r->tok_inline[i];
+	}
+	r->tok = tok;
+	r->tok_max = max;
+	return 0;
+}
+
+/* Returns 1 for a command, 0 at the end of the input, -1 on an error
+ * that has been reported and -2 on a syntax error */
+static int next_command(struct libxsvf_host *h, struct svf_reader *r)
+{
+	if (!r->borrowed && read_command(h, r) < 0)
+		return -1;
+
+	const char *p = skip_blank(r->p, r->end);
+	const char *end = r->end;
+	r->cmd = p;
+	r->num = 0;
+
+	while (1)
+	{
+		p = skip_blank(p, end);
+		r->cmd_len = p - r->cmd;
+		if (p == end) {
+			r->p = p;
+			if (r->num == 0)
 				return 0;
 			LIBXSVF_HOST_REPORT_ERROR("Unexpected EOF.");
 			return -1;
 		}
-		if (ch <= ' ') {
-insert_eol:
-			if (!braket_mode && p > 0 && buffer[p-1] != ' ')
-				buffer[p++] = ' ';
-			continue;
+		if (*p == ';') {
+			r->p = p+1;
+			return 1;
 		}
-		if (ch == '!') {
-skip_to_eol:
-			while (1) {
-				ch = LIBXSVF_HOST_GETBYTE();
-				if (ch < 0)
-					goto handle_eof;
-				if (ch < ' ' && ch != '\t')
-					goto insert_eol;
+		if (*p == ')')
+			return -2;
+		if (r->num == r->tok_max && grow_tokens(h, r) < 0)
+			return -1;
+
+		struct svf_token *t = &r->tok[r->num++];
+		if (*p == '(') {
+			t->p = ++p;
+			t->paren = 1;
+			while (p < end && *p != ')' && *p != ';')
+				p = is_comment(p, end) ? skip_blank(p, end) : p+1;
+			if (p == end || *p == ';') {
+				r->cmd_len = p - r->cmd;
+				return -2;
 			}
-		}
-		if (ch == '/' && p > 0 && buffer[p-1] == '/') {
-			p--;
-			goto skip_to_eol;
-		}
-		if (ch == ';')
-			break;
-		if (ch == '(') {
-			if (!braket_mode && p > 0 && buffer[p-1] != ' ')
-				buffer[p++] = ' ';
-			braket_mode++;
-		}
-		if (ch >= 'a' && ch <= 'z')
-			buffer[p++] = ch - ('a' - 'A');
-		else
-			buffer[p++] = ch;
-		if (ch == ')') {
-			braket_mode--;
-			if (!braket_mode)
-				buffer[p++] = ' ';
+			t->len = p++ - t->p;
+		} else {
+			t->p = p;
+			t->paren = 0;
+			while (p < end && (unsigned char)*p > ' ' && *p != '(' && *p != ')' &&
+					*p != ';' && !is_comment(p, end))
+				p++;
+			t->len = p - t->p;
 		}
 	}
-	return 1;
 }
 
-static int strtokencmp(const char *str1, const char *str2)
+static void report_command(struct libxsvf_host *h, const struct svf_reader *r)
 {
-	int i = 0;
-	while (1) {
-		if ((str1[i] == ' ' || str1[i] == 0) && (str2[i] == ' ' || str2[i] == 0))
-			return 0;
-		if (str1[i] < str2[i])
-			return -1;
-		if (str1[i] > str2[i])
-			return +1;
-		i++;
+	char text[128];
+	int i, n = 0;
+	for (i = 0; i < r->cmd_len && n < (int)sizeof(text)-4; i++) {
+		int ch = (unsigned char)r->cmd[i];
+		if (ch <= ' ') {
+			if (n > 0 && text[n-1] != ' ')
+				text[n++] = ' ';
+		} else
+			text[n++] = ch;
 	}
+	if (i < r->cmd_len) {
+		text[n++] = '.';
+		text[n++] = '.';
+		text[n++] = '.';
+	}
+	text[n] = 0;
+	LIBXSVF_HOST_REPORT_ERROR(text);
 }
 
-static int strtokenskip(const char *str1)
+/* Reads a number like 100, 1E6, 1.00E+06 or 5.0E-3, times 10^exp10 and
+ * rounded towards zero */
+static int parse_number(const struct svf_reader *r, int i, int exp10, long *value)
 {
-	int i = 0;
-	while (str1[i] != 0 && str1[i] != ' ') i++;
-	while (str1[i] == ' ') i++;
-	return i;
+	if (i >= r->num || r->tok[i].paren)
+		return -1;
+	const char *p = r->tok[i].p;
+	const char *end = p + r->tok[i].len;
+	long long m = 0;
+	int digits = 0;
+	int frac = 0;
+
+	for (; p < end && ((*p >= '0' && *p <= '9') || (*p == '.' && !frac)); p++) {
+		if (*p == '.') {
+			frac = 1;
+			continue;
+		}
+		digits++;
+		if (m < 100000000000000000LL) {
+			m = m*10 + (*p - '0');
+			exp10 -= frac;
+		} else if (!frac)
+			exp10++;
+	}
+	if (digits == 0)
+		return -1;
+	if (p < end && (*p == 'E' || *p == 'e')) {
+		int exp = 0, expsign = 1;
+		p++;
+		if (p < end && (*p == '+' || *p == '-'))
+			expsign = *p++ == '-' ? -1 : 1;
+		if (p == end)
+			return -1;
+		for (; p < end && *p >= '0' && *p <= '9'; p++)
+			exp = exp*10 + (*p - '0');
+		exp10 += exp * expsign;
+	}
+	if (p != end)
+		return -1;
+	while (exp10 < 0 && m > 0) {
+		m /= 10;
+		exp10++;
+	}
+	while (exp10 > 0 && m > 0 && m < 0x7fffffffLL) {
+		m *= 10;
+		exp10--;
+	}
+	*value = m < 0x7fffffffLL ? (long)m : 0x7fffffffL;
+	return 0;
 }
 
-static int token2tapstate(const char *str1)
-{
-#define X(_t) if (!strtokencmp(str1, #_t)) return LIBXSVF_TAP_ ## _t;
-	X(RESET)
-	X(IDLE)
-	X(DRSELECT)
-	X(DRCAPTURE)
-	X(DRSHIFT)
-	X(DREXIT1)
-	X(DRPAUSE)
-	X(DREXIT2)
-	X(DRUPDATE)
-	X(IRSELECT)
-	X(IRCAPTURE)
-	X(IRSHIFT)
-	X(IREXIT1)
-	X(IRPAUSE)
-	X(IREXIT2)
-	X(IRUPDATE)
-#undef X
-	return -1;
-}
+/* Fields in the order of their LIBXSVF_MEM_SVF_*_ slots */
+enum bitdata_field {
+	BD_TDI_DATA,
+	BD_TDI_MASK,
+	BD_TDO_DATA,
+	BD_TDO_MASK,
+	BD_RET_MASK,
+	BD_NUM
+};
 
+/* The field pointers are NULL until the field is given for the current
+ * length. Buffers outlive a change of length and only grow. */
 struct bitdata_s {
 	int len, alloced_len;
 	int alloced_bytes;
@@ -143,15 +345,19 @@ struct bitdata_s {
 	unsigned char *tdo_mask;
 	unsigned char *ret_mask;
 	int has_tdo_data;
+	unsigned char *buf[BD_NUM];
+	int buf_size[BD_NUM];
 };
 
 static void bitdata_free(struct libxsvf_host *h, struct bitdata_s *bd, int offset)
 {
-	LIBXSVF_HOST_REALLOC(bd->tdi_data, 0, offset+0);
-	LIBXSVF_HOST_REALLOC(bd->tdi_mask, 0, offset+1);
-	LIBXSVF_HOST_REALLOC(bd->tdo_data, 0, offset+2);
-	LIBXSVF_HOST_REALLOC(bd->tdo_mask, 0, offset+3);
-	LIBXSVF_HOST_REALLOC(bd->ret_mask, 0, offset+4);
+	int k;
+	for (k = 0; k < BD_NUM; k++) {
+		if (bd->buf[k])
+			LIBXSVF_HOST_REALLOC(bd->buf[k], 0, offset+k);
+		bd->buf[k] = (void*)0;
+		bd->buf_size[k] = 0;
+	}
 
 	bd->tdi_data = (void*)0;
 	bd->tdi_mask = (void*)0;
@@ -162,155 +368,320 @@ static void bitdata_free(struct libxsvf_host *h, struct bitdata_s *bd, int offse
 
 static int hex(char ch)
 {
-	if (ch >= 'A' && ch <= 'Z')
-		return (ch - 'A') + 10;
 	if (ch >= '0' && ch <= '9')
 		return ch - '0';
+	if (ch >= 'A' && ch <= 'F')
+		return (ch - 'A') + 10;
+	if (ch >= 'a' && ch <= 'f')
+		return (ch - 'a') + 10;
+	return -1;
+}
+
+/* Long runs of hex digits are checked and converted 32 at a time, with
+ * SSE2 or NEON where the target always has them. hex_decode32() returns
+ * -1 if any of the 32 is not a hex digit, and may have written d. */
+
+#if defined(SVF_HEX_SSE2)
+
+static __m128i hex_values(__m128i v, int *valid)
+{
+	__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	__m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+	*valid = _mm_movemask_epi8(_mm_or_si128(digit, letter));
+	return _mm_or_si128(_mm_and_si128(digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+			_mm_and_si128(letter, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+static int hex_check32(const char *p)
+{
+	int valid_a, valid_b;
+	hex_values(_mm_loadu_si128((const __m128i*)p), &valid_a);
+	hex_values(_mm_loadu_si128((const __m128i*)(p+16)), &valid_b);
+	return (valid_a & valid_b) == 0xffff;
+}
+
+static int hex_decode32(const char *p, unsigned char *d)
+{
+	const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+	int valid_a, valid_b;
+	__m128i a = hex_values(_mm_loadu_si128((const __m128i*)p), &valid_a);
+	__m128i b = hex_values(_mm_loadu_si128((const __m128i*)(p+16)), &valid_b);
+	if ((valid_a & valid_b) != 0xffff)
+		return -1;
+	/* Each 16 bit lane holds a pair of digits, the high nibble first */
+	a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low_bytes), 4), _mm_srli_epi16(a, 8));
+	b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low_bytes), 4), _mm_srli_epi16(b, 8));
+	_mm_storeu_si128((__m128i*)d, _mm_packus_epi16(a, b));
+	return 0;
+}
+
+#elif defined(SVF_HEX_NEON)
+
+static uint8x16_t hex_values(uint8x16_t v, uint8x16_t *valid)
+{
+	uint8x16_t lower = vorrq_u8(v, vdupq_n_u8(0x20));
+	uint8x16_t digit = vandq_u8(vcgeq_u8(v, vdupq_n_u8('0')), vcleq_u8(v, vdupq_n_u8('9')));
+	uint8x16_t letter = vandq_u8(vcgeq_u8(lower, vdupq_n_u8('a')), vcleq_u8(lower, vdupq_n_u8('f')));
+	*valid = vorrq_u8(digit, letter);
+	return vorrq_u8(vandq_u8(digit, vsubq_u8(v, vdupq_n_u8('0'))),
+			vandq_u8(letter, vsubq_u8(lower, vdupq_n_u8('a' - 10))));
+}
+
+static int hex_check32(const char *p)
+{
+	uint8x16_t valid_a, valid_b;
+	hex_values(vld1q_u8((const uint8_t*)p), &valid_a);
+	hex_values(vld1q_u8((const uint8_t*)(p+16)), &valid_b);
+	return vminvq_u8(vandq_u8(valid_a, valid_b)) == 0xff;
+}
+
+static int hex_decode32(const char *p, unsigned char *d)
+{
+	/* Loads the high nibbles into val[0] and the low ones into val[1] */
+	uint8x16x2_t x = vld2q_u8((const uint8_t*)p);
+	uint8x16_t valid_hi, valid_lo;
+	uint8x16_t hi = hex_values(x.val[0], &valid_hi);
+	uint8x16_t lo = hex_values(x.val[1], &valid_lo);
+	if (vminvq_u8(vandq_u8(valid_hi, valid_lo)) != 0xff)
+		return -1;
+	vst1q_u8(d, vorrq_u8(vshlq_n_u8(hi, 4), lo));
 	return 0;
 }
 
-static const char *bitdata_parse(struct libxsvf_host *h, const char *p, struct bitdata_s *bd, int offset)
+#else
+
+static int hex_check32(const char *p)
+{
+	int j;
+	for (j = 0; j < 32; j++) {
+		if (hex(p[j]) < 0)
+			return 0;
+	}
+	return 1;
+}
+
+static int hex_decode32(const char *p, unsigned char *d)
 {
-	int i, j;
+	int j;
+	for (j = 0; j < 16; j++) {
+		int hi = hex(p[2*j]);
+		int lo = hex(p[2*j+1]);
+		if (hi < 0 || lo < 0)
+			return -1;
+		d[j] = hi << 4 | lo;
+	}
+	return 0;
+}
+
+#endif
+
+/* Fills d with the hex digits of t, right aligned, so that bit k of the
+ * scan is bit k%8 of byte bytes-1-k/8. Digits beyond the length of the
+ * scan are dropped from the front. Returns -1 on anything but hex
+ * digits, blanks and comments. */
+static int hex_parse(const struct svf_token *t, unsigned char *d, int bytes)
+{
+	const char *end = t->p + t->len;
+	const char *p;
+	int hexdigits = 0;
+	int i, v;
+
+	/* Count and check the digits, a run between blanks at a time */
+	for (p = t->p; (p = skip_blank(p, end)) < end; ) {
+		if (end - p >= 32 && hex_check32(p)) {
+			p += 32;
+			hexdigits += 32;
+			continue;
+		}
+		if (hex(*p) < 0)
+			return -1;
+		for (; p < end && hex(*p) >= 0; p++)
+			hexdigits++;
+	}
+
+	/* Zero the bytes in front of the first digit, and the one it is
+	 * the low nibble of */
+	i = bytes*2 - hexdigits;
+	for (v = 0; v < (i+1)/2; v++)
+		d[v] = 0;
+
+	for (p = t->p; (p = skip_blank(p, end)) < end; ) {
+		if (i >= 0 && i%2 == 0) {
+			if (end - p >= 32 && hex_decode32(p, d + i/2) == 0) {
+				p += 32;
+				i += 32;
+				continue;
+			}
+			for (; p < end && (v = hex(*p)) >= 0; p++, i++) {
+				if (i%2 == 0)
+					d[i/2] = v << 4;
+				else
+					d[i/2] |= v;
+			}
+		} else {
+			/* Up to the first whole byte */
+			v = hex(*p++);
+			if (i >= 0)
+				d[i/2] |= v;
+			i++;
+		}
+	}
+	return 0;
+}
+
+/* Parses the length and data fields from token i on. Returns the index
+ * of the token after them, or -1. */
+static int bitdata_parse(struct libxsvf_host *h, const struct svf_reader *r, int i, struct bitdata_s *bd, int offset)
+{
+	long len = 0;
 	bd->len = 0;
 	bd->has_tdo_data = 0;
-	while (*p >= '0' && *p <= '9') {
-		bd->len = bd->len * 10 + (*p - '0');
-		p++;
-	}
-	while (*p == ' ') {
-		p++;
+	if (i < r->num && !r->tok[i].paren && r->tok[i].p[0] >= '0' && r->tok[i].p[0] <= '9') {
+		const char *p = r->tok[i].p;
+		int j;
+		for (j = 0; j < r->tok[i].len; j++) {
+			if (p[j] < '0' || p[j] > '9' || len > 0x7ffffffL)
+				return -1;
+			len = len * 10 + (p[j] - '0');
+		}
+		bd->len = len;
+		i++;
 	}
 	if (bd->len != bd->alloced_len) {
-		bitdata_free(h, bd, offset);
+		bd->tdi_data = (void*)0;
+		bd->tdi_mask = (void*)0;
+		bd->tdo_data = (void*)0;
+		bd->tdo_mask = (void*)0;
+		bd->ret_mask = (void*)0;
 		bd->alloced_len = bd->len;
 		bd->alloced_bytes = (bd->len+7) / 8;
 	}
-	while (*p)
+	while (i < r->num)
 	{
-		int memnum = 0;
-		unsigned char **dp = (void*)0;
-		if (!strtokencmp(p, "TDI")) {
-			p += strtokenskip(p);
+		int field;
+		unsigned char **dp;
+		switch (keyword(r, i)) {
+		case KW_TDI:
 			dp = &bd->tdi_data;
-			memnum = 0;
-		}
-		if (!strtokencmp(p, "TDO")) {
-			p += strtokenskip(p);
+			field = BD_TDI_DATA;
+			break;
+		case KW_TDO:
 			dp = &bd->tdo_data;
 			bd->has_tdo_data = 1;
-			memnum = 1;
-		}
-		if (!strtokencmp(p, "SMASK")) {
-			p += strtokenskip(p);
+			field = BD_TDO_DATA;
+			break;
+		case KW_SMASK:
 			dp = &bd->tdi_mask;
-			memnum = 2;
-		}
-		if (!strtokencmp(p, "MASK")) {
-			p += strtokenskip(p);
+			field = BD_TDI_MASK;
+			break;
+		case KW_MASK:
 			dp = &bd->tdo_mask;
-			memnum = 3;
-		}
-		if (!strtokencmp(p, "RMASK")) {
-			p += strtokenskip(p);
+			field = BD_TDO_MASK;
+			break;
+		case KW_RMASK:
 			dp = &bd->ret_mask;
-			memnum = 4;
-		}
-		if (!dp)
-			return (void*)0;
-		if (*dp == (void*)0) {
-			*dp = LIBXSVF_HOST_REALLOC(*dp, bd->alloced_bytes, offset+memnum);
-		}
-		if (*dp == (void*)0) {
-			LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
-			return (void*)0;
+			field = BD_RET_MASK;
+			break;
+		default:
+			return -1;
 		}
-
-		unsigned char *d = *dp;
-		for (i=0; i<bd->alloced_bytes; i++)
-			d[i] = 0;
-
-		if (*p != '(')
-			return (void*)0;
-		p++;
-
-		int hexdigits = 0;
-		for (i=0; (p[i] >= 'A' && p[i] <= 'F') || (p[i] >= '0' && p[i] <= '9'); i++)
-			hexdigits++;
-
-		i = bd->alloced_bytes*2 - hexdigits;
-		for (j=0; j<hexdigits; j++, i++, p++) {
-			if (i%2 == 0) {
-				d[i/2] |= hex(*p) << 4;
-			} else {
-				d[i/2] |= hex(*p);
+		i++;
+		if (!bd->buf[field] || bd->buf_size[field] < bd->alloced_bytes) {
+			int size = bd->alloced_bytes > 0 ? bd->alloced_bytes : 1;
+			unsigned char *p = LIBXSVF_HOST_REALLOC(bd->buf[field], size, offset+field);
+			if (p == (void*)0) {
+				LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
+				return -1;
 			}
+			bd->buf[field] = p;
+			bd->buf_size[field] = size;
 		}
+		*dp = bd->buf[field];
 
-		if (*p != ')')
-			return (void*)0;
-		p++;
-		while (*p == ' ') {
-			p++;
+		if (i >= r->num || !r->tok[i].paren)
+			return -1;
+		if (hex_parse(&r->tok[i], *dp, bd->alloced_bytes) < 0) {
+			LIBXSVF_HOST_REPORT_ERROR("Invalid hex digit in SVF data.");
+			return -1;
 		}
+		i++;
 	}
 #if 0
 	/* Debugging Output, needs <stdio.h> */
 	printf("--- Parsed bitdata [%d] ---\n", bd->len);
 	if (bd->tdi_data) {
 		printf("TDI DATA:");
-		for (i=0; i<bd->alloced_bytes; i++)
-			printf(" %02x", bd->tdi_data[i]);
+		for (int j=0; j<bd->alloced_bytes; j++)
+			printf(" %02x", bd->tdi_data[j]);
 		printf("\n");
 	}
 	if (bd->tdo_data && has_tdo_data) {
 		printf("TDO DATA:");
-		for (i=0; i<bd->alloced_bytes; i++)
-			printf(" %02x", bd->tdo_data[i]);
+		for (int j=0; j<bd->alloced_bytes; j++)
+			printf(" %02x", bd->tdo_data[j]);
 		printf("\n");
 	}
 	if (bd->tdi_mask) {
 		printf("TDI MASK:");
-		for (i=0; i<bd->alloced_bytes; i++)
-			printf(" %02x", bd->tdi_mask[i]);
+		for (int j=0; j<bd->alloced_bytes; j++)
+			printf(" %02x", bd->tdi_mask[j]);
 		printf("\n");
 	}
 	if (bd->tdo_mask) {
 		printf("TDO MASK:");
-		for (i=0; i<bd->alloced_bytes; i++)
-			printf(" %02x", bd->tdo_mask[i]);
+		for (int j=0; j<bd->alloced_bytes; j++)
+			printf(" %02x", bd->tdo_mask[j]);
 		printf("\n");
 	}
 #endif
-	return p;
+	return i;
 }
 
-static int getbit(unsigned char *data, int n)
+/* Bit k of a scan, k = 0 being shifted first */
+static int getbit(const unsigned char *data, int bytes, int k)
 {
-	return (data[n/8] & (1 << (7 - n%8))) ? 1 : 0;
+	return (data[bytes-1-k/8] >> (k%8)) & 1;
 }
 
 static int bitdata_play(struct libxsvf_host *h, struct bitdata_s *bd, enum libxsvf_tap_state estate)
 {
-	int left_padding = (8 - bd->len % 8) % 8;
+	int bytes = bd->alloced_bytes;
 	int tdo_error = 0;
 	int tms = 0;
 	int i;
 
-	for (i=bd->len+left_padding-1; i >= left_padding; i--) {
-		if (i == left_padding && h->tap_state != estate) {
+	if (h->shift_vector && bd->len > 0) {
+		struct libxsvf_shift s;
+		s.len = bd->len;
+		s.tdi_data = bd->tdi_data;
+		s.tdi_mask = bd->tdi_mask;
+		s.tdo_data = bd->has_tdo_data ? bd->tdo_data : (void*)0;
+		s.tdo_mask = bd->tdo_mask;
+		s.ret_mask = bd->ret_mask;
+		s.exit_tms = h->tap_state != estate;
+		s.sync = 0;
+		if (s.exit_tms) {
+			h->tap_state++;
+			tms = 1;
+		}
+		if (LIBXSVF_HOST_SHIFT_VECTOR(&s) < 0)
+			tdo_error = 1;
+	}
+	else for (i=0; i < bd->len; i++) {
+		if (i == bd->len-1 && h->tap_state != estate) {
 			h->tap_state++;
 			tms = 1;
 		}
 		int tdi = -1;
 		if (bd->tdi_data) {
-			if (!bd->tdi_mask || getbit(bd->tdi_mask, i))
-				tdi = getbit(bd->tdi_data, i);
+			if (!bd->tdi_mask || getbit(bd->tdi_mask, bytes, i))
+				tdi = getbit(bd->tdi_data, bytes, i);
 		}
 		int tdo = -1;
-		if (bd->tdo_data && bd->has_tdo_data && (!bd->tdo_mask || getbit(bd->tdo_mask, i)))
-			tdo = getbit(bd->tdo_data, i);
-		int rmask = bd->ret_mask && getbit(bd->ret_mask, i);
+		if (bd->tdo_data && bd->has_tdo_data && (!bd->tdo_mask || getbit(bd->tdo_mask, bytes, i)))
+			tdo = getbit(bd->tdo_data, bytes, i);
+		int rmask = bd->ret_mask && getbit(bd->ret_mask, bytes, i);
 		if (LIBXSVF_HOST_PULSE_TCK(tms, tdi, tdo, rmask, 0) < 0)
 			tdo_error = 1;
 	}
@@ -327,74 +698,69 @@ static int bitdata_play(struct libxsvf_host *h, struct bitdata_s *bd, enum libxs
 
 int libxsvf_svf(struct libxsvf_host *h)
 {
-	char *command_buffer = (void*)0;
-	int command_buffer_len = 0;
+	struct svf_reader r;
 	int rc, i;
 
-	struct bitdata_s bd_hdr = { 0, 0, 0, (void*)0, (void*)0, (void*)0, (void*)0, (void*)0 };
-	struct bitdata_s bd_hir = { 0, 0, 0, (void*)0, (void*)0, (void*)0, (void*)0, (void*)0 };
-	struct bitdata_s bd_tdr = { 0, 0, 0, (void*)0, (void*)0, (void*)0, (void*)0, (void*)0 };
-	struct bitdata_s bd_tir = { 0, 0, 0, (void*)0, (void*)0, (void*)0, (void*)0, (void*)0 };
-	struct bitdata_s bd_sdr = { 0, 0, 0, (void*)0, (void*)0, (void*)0, (void*)0, (void*)0 };
-	struct bitdata_s bd_sir = { 0, 0, 0, (void*)0, (void*)0, (void*)0, (void*)0, (void*)0 };
+	struct bitdata_s bd_hdr = { 0 };
+	struct bitdata_s bd_hir = { 0 };
+	struct bitdata_s bd_tdr = { 0 };
+	struct bitdata_s bd_tir = { 0 };
+	struct bitdata_s bd_sdr = { 0 };
+	struct bitdata_s bd_sir = { 0 };
 
 	int state_endir = LIBXSVF_TAP_IDLE;
 	int state_enddr = LIBXSVF_TAP_IDLE;
 	int state_run = LIBXSVF_TAP_IDLE;
 	int state_endrun = LIBXSVF_TAP_IDLE;
 
+	long span_len = 0;
+	const unsigned char *span = LIBXSVF_HOST_GETSPAN(0x7fffffffL, &span_len);
+	r.borrowed = span != (void*)0;
+	r.p = (const char*)span;
+	r.end = span ? r.p + span_len : r.p;
+	r.buffer = (void*)0;
+	r.buffer_len = 0;
+	r.tok = r.tok_inline;
+	r.tok_max = SVF_INLINE_TOKENS;
+
 	while (1)
 	{
-		rc = read_command(h, &command_buffer, &command_buffer_len);
+		rc = next_command(h, &r);
 
+		if (rc == -2)
+			goto syntax_error;
 		if (rc <= 0)
 			break;
+		if (r.num == 0)
+			continue;
 
-		const char *p = command_buffer;
+		int kw = keyword(&r, 0);
+		if (kw < KW_ENDDR || kw > KW_TRST)
+			goto syntax_error;
 
-		LIBXSVF_HOST_REPORT_STATUS(command_buffer);
+		LIBXSVF_HOST_REPORT_STATUS(svf_keywords[kw]);
+		i = 1;
 
-		if (!strtokencmp(p, "ENDIR")) {
-			p += strtokenskip(p);
-			state_endir = token2tapstate(p);
+		switch (kw)
+		{
+		case KW_ENDIR:
+			state_endir = token2tapstate(&r, i++);
 			if (state_endir < 0)
 				goto syntax_error;
-			p += strtokenskip(p);
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "ENDDR")) {
-			p += strtokenskip(p);
-			state_enddr = token2tapstate(p);
-			if (state_endir < 0)
+		case KW_ENDDR:
+			state_enddr = token2tapstate(&r, i++);
+			if (state_enddr < 0)
 				goto syntax_error;
-			p += strtokenskip(p);
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "FREQUENCY")) {
-			unsigned long number = 0;
-			int exp = 0;
-			p += strtokenskip(p);
-			if (*p < '0' || *p > '9')
+		case KW_FREQUENCY: {
+			long number;
+			if (parse_number(&r, i++, 0, &number) < 0)
 				goto syntax_error;
-			while (*p >= '0' && *p <= '9') {
-				number = number*10 + (*p - '0');
-				p++;
-			}
-			if(*p == 'E' || *p == 'e') {
-				p++;
-				while (*p >= '0' && *p <= '9') {
-					exp = exp*10 + (*p - '0');
-					p++;
-				}
-				for(i=0; i<exp; i++)
-					number *= 10;
-			}
-			while (*p == ' ') {
-				p++;
-			}
-			p += strtokenskip(p);
+			if (i < r.num && !r.tok[i].paren)
+				i++;
 			if (LIBXSVF_HOST_SET_FREQUENCY(number) < 0) {
 				LIBXSVF_HOST_REPORT_ERROR("FREQUENCY command failed!");
 				goto error;
@@ -402,115 +768,67 @@ int libxsvf_svf(struct libxsvf_host *h)
 			goto eol_check;
 		}
 
-		if (!strtokencmp(p, "HDR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_hdr, LIBXSVF_MEM_SVF_HDR_TDI_DATA);
-			if (!p)
+		case KW_HDR:
+			i = bitdata_parse(h, &r, i, &bd_hdr, LIBXSVF_MEM_SVF_HDR_TDI_DATA);
+			if (i < 0)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "HIR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_hir, LIBXSVF_MEM_SVF_HIR_TDI_DATA);
-			if (!p)
+		case KW_HIR:
+			i = bitdata_parse(h, &r, i, &bd_hir, LIBXSVF_MEM_SVF_HIR_TDI_DATA);
+			if (i < 0)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "PIO") || !strtokencmp(p, "PIOMAP")) {
+		case KW_PIO:
+		case KW_PIOMAP:
 			goto unsupported_error;
-		}
 
-		if (!strtokencmp(p, "RUNTEST")) {
-			p += strtokenskip(p);
-			int tck_count = -1;
-			int sck_count = -1;
-			int min_time = -1;
-			int max_time = -1;
-			while (*p) {
+		case KW_RUNTEST: {
+			long tck_count = -1;
+			long sck_count = -1;
+			long min_time = -1;
+			long max_time = -1;
+			while (i < r.num) {
 				int got_maximum = 0;
-				if (!strtokencmp(p, "MAXIMUM")) {
-					p += strtokenskip(p);
+				if (keyword(&r, i) == KW_MAXIMUM) {
+					i++;
 					got_maximum = 1;
 				}
 				int got_endstate = 0;
-				if (!strtokencmp(p, "ENDSTATE")) {
-					p += strtokenskip(p);
+				if (keyword(&r, i) == KW_ENDSTATE) {
+					i++;
 					got_endstate = 1;
 				}
-				int st = token2tapstate(p);
+				int st = token2tapstate(&r, i);
 				if (st >= 0) {
-					p += strtokenskip(p);
+					i++;
 					if (got_endstate)
 						state_endrun = st;
 					else
 						state_run = st;
 					continue;
 				}
-				if (*p < '0' || *p > '9')
+				long number, number_e6;
+				if (parse_number(&r, i, 0, &number) < 0 || parse_number(&r, i, 6, &number_e6) < 0)
 					goto syntax_error;
-				int number = 0;
-				int exp = 0, expsign = 1;
-				int number_e6, exp_e6;
-				while (*p >= '0' && *p <= '9') {
-					number = number*10 + (*p - '0');
-					p++;
-				}
-				if(*p == 'E' || *p == 'e') {
-					p++;
-					if(*p == '-') {
-						expsign = -1;
-						p++;
-					}
-					while (*p >= '0' && *p <= '9') {
-						exp = exp*10 + (*p - '0');
-						p++;
-					}
-					exp = exp * expsign;
-					number_e6 = number;
-					exp_e6 = exp + 6;
-					while (exp < 0) {
-						number /= 10;
-						exp++;
-					}
-					while (exp > 0) {
-						number *= 10;
-						exp--;
-					}
-					while (exp_e6 < 0) {
-						number_e6 /= 10;
-						exp_e6++;
-					}
-					while (exp_e6 > 0) {
-						number_e6 *= 10;
-						exp_e6--;
-					}
-				} else {
-					number_e6 = number * 1000000;
-				}
-				while (*p == ' ') {
-					p++;
-				}
-				if (!strtokencmp(p, "SEC")) {
-					p += strtokenskip(p);
+				switch (keyword(&r, ++i)) {
+				case KW_SEC:
 					if (got_maximum)
 						max_time = number_e6;
 					else
 						min_time = number_e6;
-					continue;
-				}
-				if (!strtokencmp(p, "TCK")) {
-					p += strtokenskip(p);
+					break;
+				case KW_TCK:
 					tck_count = number;
-					continue;
-				}
-				if (!strtokencmp(p, "SCK")) {
-					p += strtokenskip(p);
+					break;
+				case KW_SCK:
 					sck_count = number;
-					continue;
+					break;
+				default:
+					goto syntax_error;
 				}
-				goto syntax_error;
+				i++;
 			}
 			if (libxsvf_tap_walk(h, state_run) < 0)
 				goto error;
@@ -518,7 +836,8 @@ int libxsvf_svf(struct libxsvf_host *h)
 				LIBXSVF_HOST_REPORT_ERROR("WARNING: Maximum time in SVF RUNTEST command is ignored.");
 			}
 			if (sck_count >= 0) {
-				for (i=0; i < sck_count; i++) {
+				long k;
+				for (k=0; k < sck_count; k++) {
 					LIBXSVF_HOST_PULSE_SCK();
 				}
 			}
@@ -530,10 +849,9 @@ int libxsvf_svf(struct libxsvf_host *h)
 			goto eol_check;
 		}
 
-		if (!strtokencmp(p, "SDR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
-			if (!p)
+		case KW_SDR:
+			i = bitdata_parse(h, &r, i, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
+			if (i < 0)
 				goto syntax_error;
 			if (libxsvf_tap_walk(h, LIBXSVF_TAP_DRSHIFT) < 0)
 				goto error;
@@ -546,12 +864,10 @@ int libxsvf_svf(struct libxsvf_host *h)
 			if (libxsvf_tap_walk(h, state_enddr) < 0)
 				goto error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "SIR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA);
-			if (!p)
+		case KW_SIR:
+			i = bitdata_parse(h, &r, i, &bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA);
+			if (i < 0)
 				goto syntax_error;
 			if (libxsvf_tap_walk(h, LIBXSVF_TAP_IRSHIFT) < 0)
 				goto error;
@@ -564,56 +880,41 @@ int libxsvf_svf(struct libxsvf_host *h)
 			if (libxsvf_tap_walk(h, state_endir) < 0)
 				goto error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "STATE")) {
-			p += strtokenskip(p);
-			while (*p) {
-				int st = token2tapstate(p);
+		case KW_STATE:
+			while (i < r.num) {
+				int st = token2tapstate(&r, i++);
 				if (st < 0)
 					goto syntax_error;
 				if (libxsvf_tap_walk(h, st) < 0)
 					goto error;
-				p += strtokenskip(p);
 			}
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "TDR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_tdr, LIBXSVF_MEM_SVF_TDR_TDI_DATA);
-			if (!p)
+		case KW_TDR:
+			i = bitdata_parse(h, &r, i, &bd_tdr, LIBXSVF_MEM_SVF_TDR_TDI_DATA);
+			if (i < 0)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "TIR")) {
-			p += strtokenskip(p);
-			p = bitdata_parse(h, p, &bd_tir, LIBXSVF_MEM_SVF_TIR_TDI_DATA);
-			if (!p)
+		case KW_TIR:
+			i = bitdata_parse(h, &r, i, &bd_tir, LIBXSVF_MEM_SVF_TIR_TDI_DATA);
+			if (i < 0)
 				goto syntax_error;
 			goto eol_check;
-		}
 
-		if (!strtokencmp(p, "TRST")) {
-			p += strtokenskip(p);
-			if (!strtokencmp(p, "ON")) {
-				p += strtokenskip(p);
+		case KW_TRST:
+			switch (keyword(&r, i++)) {
+			case KW_ON:
 				LIBXSVF_HOST_SET_TRST(1);
 				goto eol_check;
-			}
-			if (!strtokencmp(p, "OFF")) {
-				p += strtokenskip(p);
+			case KW_OFF:
 				LIBXSVF_HOST_SET_TRST(0);
 				goto eol_check;
-			}
-			if (!strtokencmp(p, "Z")) {
-				p += strtokenskip(p);
+			case KW_Z:
 				LIBXSVF_HOST_SET_TRST(-1);
 				goto eol_check;
-			}
-			if (!strtokencmp(p, "ABSENT")) {
-				p += strtokenskip(p);
+			case KW_ABSENT:
 				LIBXSVF_HOST_SET_TRST(-2);
 				goto eol_check;
 			}
@@ -621,9 +922,7 @@ int libxsvf_svf(struct libxsvf_host *h)
 		}
 
 eol_check:
-		while (*p == ' ')
-			p++;
-		if (*p == 0)
+		if (i == r.num)
 			continue;
 
 syntax_error:
@@ -632,7 +931,7 @@ syntax_error:
 unsupported_error:
 			LIBXSVF_HOST_REPORT_ERROR("Error in SVF input: unsupported command:");
 		}
-		LIBXSVF_HOST_REPORT_ERROR(command_buffer);
+		report_command(h, &r);
 error:
 		rc = -1;
 		break;
@@ -650,7 +949,9 @@ error:
 	bitdata_free(h, &bd_sdr, LIBXSVF_MEM_SVF_SDR_TDI_DATA);
 	bitdata_free(h, &bd_sir, LIBXSVF_MEM_SVF_SIR_TDI_DATA);
 
-	LIBXSVF_HOST_REALLOC(command_buffer, 0, LIBXSVF_MEM_SVF_COMMANDBUF);
+	LIBXSVF_HOST_REALLOC(r.buffer, 0, LIBXSVF_MEM_SVF_COMMANDBUF);
+	if (r.tok != r.tok_inline)
+		LIBXSVF_HOST_REALLOC(r.tok, 0, LIBXSVF_MEM_SVF_TOKENS);
 
 	return rc;
 }
@@ -25,149 +25,149 @@ static void tap_transition(struct libxsvf_host *h, int v)
 	LIBXSVF_HOST_PULSE_TCK(v, -1, -1, 0, 0);
 }
 
-int libxsvf_tap_walk(struct libxsvf_host *h, enum libxsvf_tap_state s)
+/* The state a TAP in state s moves to on a TCK with the given TMS. From
+ * LIBXSVF_TAP_INIT, TMS=1 is taken as reaching TEST-LOGIC-RESET, which
+ * holds for any state once five such clocks have been given. */
+enum libxsvf_tap_state libxsvf_tap_next(enum libxsvf_tap_state s, int tms)
 {
-	int i, j;
-	for (i=0; s != h->tap_state; i++)
+	switch (s)
 	{
-		switch (h->tap_state)
-		{
-		/* Special States */
-		case LIBXSVF_TAP_INIT:
-			for (j = 0; j < 6; j++)
-				tap_transition(h, 1);
-			h->tap_state = LIBXSVF_TAP_RESET;
-			break;
-		case LIBXSVF_TAP_RESET:
-			tap_transition(h, 0);
-			h->tap_state = LIBXSVF_TAP_IDLE;
-			break;
-		case LIBXSVF_TAP_IDLE:
-			tap_transition(h, 1);
-			h->tap_state = LIBXSVF_TAP_DRSELECT;
-			break;
+	case LIBXSVF_TAP_INIT:      return tms ? LIBXSVF_TAP_RESET : LIBXSVF_TAP_INIT;
+	case LIBXSVF_TAP_RESET:     return tms ? LIBXSVF_TAP_RESET : LIBXSVF_TAP_IDLE;
+	case LIBXSVF_TAP_IDLE:      return tms ? LIBXSVF_TAP_DRSELECT : LIBXSVF_TAP_IDLE;
+	case LIBXSVF_TAP_DRSELECT:  return tms ? LIBXSVF_TAP_IRSELECT : LIBXSVF_TAP_DRCAPTURE;
+	case LIBXSVF_TAP_DRCAPTURE: return tms ? LIBXSVF_TAP_DREXIT1 : LIBXSVF_TAP_DRSHIFT;
+	case LIBXSVF_TAP_DRSHIFT:   return tms ? LIBXSVF_TAP_DREXIT1 : LIBXSVF_TAP_DRSHIFT;
+	case LIBXSVF_TAP_DREXIT1:   return tms ? LIBXSVF_TAP_DRUPDATE : LIBXSVF_TAP_DRPAUSE;
+	case LIBXSVF_TAP_DRPAUSE:   return tms ? LIBXSVF_TAP_DREXIT2 : LIBXSVF_TAP_DRPAUSE;
+	case LIBXSVF_TAP_DREXIT2:   return tms ? LIBXSVF_TAP_DRUPDATE : LIBXSVF_TAP_DRSHIFT;
+	case LIBXSVF_TAP_DRUPDATE:  return tms ? LIBXSVF_TAP_DRSELECT : LIBXSVF_TAP_IDLE;
+	case LIBXSVF_TAP_IRSELECT:  return tms ? LIBXSVF_TAP_RESET : LIBXSVF_TAP_IRCAPTURE;
+	case LIBXSVF_TAP_IRCAPTURE: return tms ? LIBXSVF_TAP_IREXIT1 : LIBXSVF_TAP_IRSHIFT;
+	case LIBXSVF_TAP_IRSHIFT:   return tms ? LIBXSVF_TAP_IREXIT1 : LIBXSVF_TAP_IRSHIFT;
+	case LIBXSVF_TAP_IREXIT1:   return tms ? LIBXSVF_TAP_IRUPDATE : LIBXSVF_TAP_IRPAUSE;
+	case LIBXSVF_TAP_IRPAUSE:   return tms ? LIBXSVF_TAP_IREXIT2 : LIBXSVF_TAP_IRPAUSE;
+	case LIBXSVF_TAP_IREXIT2:   return tms ? LIBXSVF_TAP_IRUPDATE : LIBXSVF_TAP_IRSHIFT;
+	case LIBXSVF_TAP_IRUPDATE:  return tms ? LIBXSVF_TAP_DRSELECT : LIBXSVF_TAP_IDLE;
+	}
+	return LIBXSVF_TAP_INIT;
+}
+
+/* TMS for the walk from every state to every other, first clock in bit
+ * 0. These are the paths the step-by-step walker used to take, which
+ * pass through Update rather than Pause and never through
+ * Test-Logic-Reset unless it is the target; the plain shortest path
+ * would do either. From LIBXSVF_TAP_INIT every walk starts with six
+ * TMS=1 clocks. The Exit2 states and LIBXSVF_TAP_INIT are never walked
+ * to. */
+#define P(_len, _tms) { _tms, _len }
+#define NO_PATH { 0, 0xff }
+
+static const struct tap_path {
+	unsigned short tms;
+	unsigned char len;
+} tap_paths[17][17] = {
+	/* from INIT */
+	{ P( 0, 0x000), P( 6, 0x03f), P( 7, 0x03f), P( 8, 0x0bf), P( 9, 0x0bf), P(10, 0x0bf),
+	  P(10, 0x2bf), P(11, 0x2bf), NO_PATH, P(11, 0x6bf), P( 9, 0x1bf), P(10, 0x1bf),
+	  P(11, 0x1bf), P(11, 0x5bf), P(12, 0x5bf), NO_PATH, P(12, 0xdbf) },
+	/* from RESET */
+	{ NO_PATH, P( 0, 0x000), P( 1, 0x000), P( 2, 0x002), P( 3, 0x002), P( 4, 0x002),
+	  P( 4, 0x00a), P( 5, 0x00a), NO_PATH, P( 5, 0x01a), P( 3, 0x006), P( 4, 0x006),
+	  P( 5, 0x006), P( 5, 0x016), P( 6, 0x016), NO_PATH, P( 6, 0x036) },
+	/* from IDLE */
+	{ NO_PATH, P( 3, 0x007), P( 0, 0x000), P( 1, 0x001), P( 2, 0x001), P( 3, 0x001),
+	  P( 3, 0x005), P( 4, 0x005), NO_PATH, P( 4, 0x00d), P( 2, 0x003), P( 3, 0x003),
+	  P( 4, 0x003), P( 4, 0x00b), P( 5, 0x00b), NO_PATH, P( 5, 0x01b) },
+	/* from DRSELECT */
+	{ NO_PATH, P( 2, 0x003), P( 4, 0x006), P( 0, 0x000), P( 1, 0x000), P( 2, 0x000),
+	  P( 2, 0x002), P( 3, 0x002), NO_PATH, P( 3, 0x006), P( 1, 0x001), P( 2, 0x001),
+	  P( 3, 0x001), P( 3, 0x005), P( 4, 0x005), NO_PATH, P( 4, 0x00d) },
+	/* from DRCAPTURE */
+	{ NO_PATH, P( 5, 0x01f), P( 3, 0x003), P( 3, 0x007), P( 0, 0x000), P( 1, 0x000),
+	  P( 1, 0x001), P( 2, 0x001), NO_PATH, P( 2, 0x003), P( 4, 0x00f), P( 5, 0x00f),
+	  P( 6, 0x00f), P( 6, 0x02f), P( 7, 0x02f), NO_PATH, P( 7, 0x06f) },
+	/* from DRSHIFT */
+	{ NO_PATH, P( 5, 0x01f), P( 3, 0x003), P( 3, 0x007), P( 4, 0x007), P( 0, 0x000),
+	  P( 1, 0x001), P( 2, 0x001), NO_PATH, P( 2, 0x003), P( 4, 0x00f), P( 5, 0x00f),
+	  P( 6, 0x00f), P( 6, 0x02f), P( 7, 0x02f), NO_PATH, P( 7, 0x06f) },
+	/* from DREXIT1 */
+	{ NO_PATH, P( 4, 0x00f), P( 2, 0x001), P( 2, 0x003), P( 3, 0x003), P( 4, 0x003),
+	  P( 0, 0x000), P( 1, 0x000), NO_PATH, P( 1, 0x001), P( 3, 0x007), P( 4, 0x007),
+	  P( 5, 0x007), P( 5, 0x017), P( 6, 0x017), NO_PATH, P( 6, 0x037) },
+	/* from DRPAUSE */
+	{ NO_PATH, P( 5, 0x01f), P( 3, 0x003), P( 3, 0x007), P( 4, 0x007), P( 2, 0x001),
+	  P( 5, 0x017), P( 0, 0x000), P( 1, 0x001), P( 2, 0x003), P( 4, 0x00f), P( 5, 0x00f),
+	  P( 6, 0x00f), P( 6, 0x02f), P( 7, 0x02f), NO_PATH, P( 7, 0x06f) },
+	/* from DREXIT2 */
+	{ NO_PATH, P( 4, 0x00f), P( 2, 0x001), P( 2, 0x003), P( 3, 0x003), P( 1, 0x000),
+	  P( 4, 0x00b), P( 5, 0x00b), P( 0, 0x000), P( 1, 0x001), P( 3, 0x007), P( 4, 0x007),
+	  P( 5, 0x007), P( 5, 0x017), P( 6, 0x017), NO_PATH, P( 6, 0x037) },
+	/* from DRUPDATE */
+	{ NO_PATH, P( 3, 0x007), P( 1, 0x000), P( 1, 0x001), P( 2, 0x001), P( 3, 0x001),
+	  P( 3, 0x005), P( 4, 0x005), NO_PATH, P( 0, 0x000), P( 2, 0x003), P( 3, 0x003),
+	  P( 4, 0x003), P( 4, 0x00b), P( 5, 0x00b), NO_PATH, P( 5, 0x01b) },
+	/* from IRSELECT */
+	{ NO_PATH, P( 1, 0x001), P( 4, 0x006), P( 4, 0x00e), P( 5, 0x00e), P( 6, 0x00e),
+	  P( 6, 0x02e), P( 7, 0x02e), NO_PATH, P( 7, 0x06e), P( 0, 0x000), P( 1, 0x000),
+	  P( 2, 0x000), P( 2, 0x002), P( 3, 0x002), NO_PATH, P( 3, 0x006) },
+	/* from IRCAPTURE */
+	{ NO_PATH, P( 5, 0x01f), P( 3, 0x003), P( 3, 0x007), P( 4, 0x007), P( 5, 0x007),
+	  P( 5, 0x017), P( 6, 0x017), NO_PATH, P( 6, 0x037), P( 4, 0x00f), P( 0, 0x000),
+	  P( 1, 0x000), P( 1, 0x001), P( 2, 0x001), NO_PATH, P( 2, 0x003) },
+	/* from IRSHIFT */
+	{ NO_PATH, P( 5, 0x01f), P( 3, 0x003), P( 3, 0x007), P( 4, 0x007), P( 5, 0x007),
+	  P( 5, 0x017), P( 6, 0x017), NO_PATH, P( 6, 0x037), P( 4, 0x00f), P( 5, 0x00f),
+	  P( 0, 0x000), P( 1, 0x001), P( 2, 0x001), NO_PATH, P( 2, 0x003) },
+	/* from IREXIT1 */
+	{ NO_PATH, P( 4, 0x00f), P( 2, 0x001), P( 2, 0x003), P( 3, 0x003), P( 4, 0x003),
+	  P( 4, 0x00b), P( 5, 0x00b), NO_PATH, P( 5, 0x01b), P( 3, 0x007), P( 4, 0x007),
+	  P( 5, 0x007), P( 0, 0x000), P( 1, 0x000), NO_PATH, P( 1, 0x001) },
+	/* from IRPAUSE */
+	{ NO_PATH, P( 5, 0x01f), P( 3, 0x003), P( 3, 0x007), P( 4, 0x007), P( 5, 0x007),
+	  P( 5, 0x017), P( 6, 0x017), NO_PATH, P( 6, 0x037), P( 4, 0x00f), P( 5, 0x00f),
+	  P( 2, 0x001), P( 6, 0x02f), P( 0, 0x000), P( 1, 0x001), P( 2, 0x003) },
+	/* from IREXIT2 */
+	{ NO_PATH, P( 4, 0x00f), P( 2, 0x001), P( 2, 0x003), P( 3, 0x003), P( 4, 0x003),
+	  P( 4, 0x00b), P( 5, 0x00b), NO_PATH, P( 5, 0x01b), P( 3, 0x007), P( 4, 0x007),
+	  P( 1, 0x000), P( 5, 0x017), P( 6, 0x017), P( 0, 0x000), P( 1, 0x001) },
+	/* from IRUPDATE */
+	{ NO_PATH, P( 3, 0x007), P( 1, 0x000), P( 1, 0x001), P( 2, 0x001), P( 3, 0x001),
+	  P( 3, 0x005), P( 4, 0x005), NO_PATH, P( 4, 0x00d), P( 2, 0x003), P( 3, 0x003),
+	  P( 4, 0x003), P( 4, 0x00b), P( 5, 0x00b), NO_PATH, P( 0, 0x000) },
+};
 
-		/* DR States */
-		case LIBXSVF_TAP_DRSELECT:
-			if (s >= LIBXSVF_TAP_IRSELECT || s == LIBXSVF_TAP_RESET) {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_IRSELECT;
-			} else {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_DRCAPTURE;
-			}
-			break;
-		case LIBXSVF_TAP_DRCAPTURE:
-			if (s == LIBXSVF_TAP_DRSHIFT) {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_DRSHIFT;
-			} else {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_DREXIT1;
-			}
-			break;
-		case LIBXSVF_TAP_DRSHIFT:
-			tap_transition(h, 1);
-			h->tap_state = LIBXSVF_TAP_DREXIT1;
-			break;
-		case LIBXSVF_TAP_DREXIT1:
-			if (s == LIBXSVF_TAP_DRPAUSE) {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_DRPAUSE;
-			} else {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_DRUPDATE;
-			}
-			break;
-		case LIBXSVF_TAP_DRPAUSE:
-			tap_transition(h, 1);
-			h->tap_state = LIBXSVF_TAP_DREXIT2;
-			break;
-		case LIBXSVF_TAP_DREXIT2:
-			if (s == LIBXSVF_TAP_DRSHIFT) {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_DRSHIFT;
-			} else {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_DRUPDATE;
-			}
-			break;
-		case LIBXSVF_TAP_DRUPDATE:
-			if (s == LIBXSVF_TAP_IDLE) {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_IDLE;
-			} else {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_DRSELECT;
-			}
-			break;
+#undef P
+#undef NO_PATH
 
-		/* IR States */
-		case LIBXSVF_TAP_IRSELECT:
-			if (s == LIBXSVF_TAP_RESET) {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_RESET;
-			} else {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_IRCAPTURE;
-			}
-			break;
-		case LIBXSVF_TAP_IRCAPTURE:
-			if (s == LIBXSVF_TAP_IRSHIFT) {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_IRSHIFT;
-			} else {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_IREXIT1;
-			}
-			break;
-		case LIBXSVF_TAP_IRSHIFT:
-			tap_transition(h, 1);
-			h->tap_state = LIBXSVF_TAP_IREXIT1;
-			break;
-		case LIBXSVF_TAP_IREXIT1:
-			if (s == LIBXSVF_TAP_IRPAUSE) {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_IRPAUSE;
-			} else {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_IRUPDATE;
-			}
-			break;
-		case LIBXSVF_TAP_IRPAUSE:
-			tap_transition(h, 1);
-			h->tap_state = LIBXSVF_TAP_IREXIT2;
-			break;
-		case LIBXSVF_TAP_IREXIT2:
-			if (s == LIBXSVF_TAP_IRSHIFT) {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_IRSHIFT;
-			} else {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_IRUPDATE;
-			}
-			break;
-		case LIBXSVF_TAP_IRUPDATE:
-			if (s == LIBXSVF_TAP_IDLE) {
-				tap_transition(h, 0);
-				h->tap_state = LIBXSVF_TAP_IDLE;
-			} else {
-				tap_transition(h, 1);
-				h->tap_state = LIBXSVF_TAP_DRSELECT;
-			}
-			break;
+int libxsvf_tap_walk(struct libxsvf_host *h, enum libxsvf_tap_state s)
+{
+	const struct tap_path *p;
+	int i;
+
+	if (h->tap_state < LIBXSVF_TAP_INIT || h->tap_state > LIBXSVF_TAP_IRUPDATE ||
+			s < LIBXSVF_TAP_INIT || s > LIBXSVF_TAP_IRUPDATE) {
+		LIBXSVF_HOST_REPORT_ERROR("Illegal tap state.");
+		return -1;
+	}
+	p = &tap_paths[h->tap_state][s];
+	if (p->len == 0xff) {
+		LIBXSVF_HOST_REPORT_ERROR("Loop in tap walker.");
+		return -1;
+	}
+	if (p->len == 0)
+		return 0;
 
-		default:
-			LIBXSVF_HOST_REPORT_ERROR("Illegal tap state.");
-			return -1;
-		}
-		if (h->report_tapstate)
-			LIBXSVF_HOST_REPORT_TAPSTATE();
-		if (i>10) {
-			LIBXSVF_HOST_REPORT_ERROR("Loop in tap walker.");
-			return -1;
-		}
+	/* The whole walk goes to the host at once, with one state report */
+	if (h->pulse_tms) {
+		LIBXSVF_HOST_PULSE_TMS(p->tms, p->len);
+	} else {
+		for (i = 0; i < p->len; i++)
+			tap_transition(h, (p->tms >> i) & 1);
 	}
+	h->tap_state = s;
+	if (h->report_tapstate)
+		LIBXSVF_HOST_REPORT_TAPSTATE();
 
 	return 0;
 }
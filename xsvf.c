@@ -50,28 +50,20 @@ enum xsvf_cmd {
 };
 
 #define READ_BITS(_buf, _len) do {                                          \
-	unsigned char *_p = _buf; int _i;                                   \
-	for (_i=0; _i<(_len); _i+=8) {                                      \
-		int tmp = LIBXSVF_HOST_GETBYTE();                           \
-		if (tmp < 0) {                                              \
-			LIBXSVF_HOST_REPORT_ERROR("Unexpected EOF.");       \
-			goto error;                                         \
-		}                                                           \
-		*(_p++) = tmp;                                              \
+	if ((_len) > 0 && libxsvf_read(h, _buf, bits2bytes(_len)) < 0) {   \
+		LIBXSVF_HOST_REPORT_ERROR("Unexpected EOF.");               \
+		goto error;                                                 \
 	}                                                                   \
 } while (0)
 
 #define READ_LONG2(x) {                                               \
-	long _buf = 0; int _i;                                              \
-	for (_i=0; _i<4; _i++) {                                            \
-		int tmp = LIBXSVF_HOST_GETBYTE();                           \
-		if (tmp < 0) {                                              \
-			LIBXSVF_HOST_REPORT_ERROR("Unexpected EOF.");       \
-			goto error;                                         \
-		}                                                           \
-		_buf = _buf << 8 | tmp;                                     \
+	unsigned char _buf[4];                                              \
+	if (libxsvf_read(h, _buf, 4) < 0) {                                 \
+		LIBXSVF_HOST_REPORT_ERROR("Unexpected EOF.");               \
+		goto error;                                                 \
 	}                                                                   \
-	x = _buf;                                                               \
+	x = (long)((unsigned long)_buf[0] << 24 | (unsigned long)_buf[1] << 16 | \
+		(unsigned long)_buf[2] << 8 | _buf[3]);                     \
 }
 
 
@@ -190,7 +182,26 @@ static int shift_data(struct libxsvf_host *h, unsigned char *inp, unsigned char
 		TAP(state);
 		tms = 0;
 
-		for (i=len+left_padding-1; i>=left_padding; i--) {
+		/* An XSVF mask without expected data compares against zeros,
+		 * which has no vector form, so that case stays bit by bit. */
+		if (h->shift_vector && len > 0 && (!maskp || outp)) {
+			struct libxsvf_shift s;
+			s.len = len;
+			s.tdi_data = inp;
+			s.tdi_mask = (void*)0;
+			s.tdo_data = maskp ? outp : (void*)0;
+			s.tdo_mask = maskp;
+			s.ret_mask = (void*)0;
+			s.exit_tms = h->tap_state != estate;
+			s.sync = with_retries;
+			if (s.exit_tms) {
+				h->tap_state++;
+				tms = 1;
+			}
+			if (LIBXSVF_HOST_SHIFT_VECTOR(&s) < 0)
+				tdo_error = 1;
+		}
+		else for (i=len+left_padding-1; i>=left_padding; i--) {
 			if (i == left_padding && h->tap_state != estate) {
 				h->tap_state++;
 				tms = 1;
@@ -239,6 +250,9 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 	unsigned char *buf_tdo_mask = (void*)0;
 	unsigned char *buf_addr_mask = (void*)0;
 	unsigned char *buf_data_mask = (void*)0;
+	unsigned char *buf_ir_data = (void*)0;
+	int buf_dr_bytes = 0;
+	int buf_ir_bytes = 0;
 
 	long state_dr_size = 0;
 	long state_data_size = 0;
@@ -255,6 +269,18 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 
 #define STATUS(_c) LIBXSVF_HOST_REPORT_STATUS("XSVF Command " #_c);
 
+/* Grows the instruction buffer to hold _len bits */
+#define IR_BUFFER(_len) do {                                                \
+	if (bits2bytes(_len) > buf_ir_bytes) {                              \
+		buf_ir_data = LIBXSVF_HOST_REALLOC(buf_ir_data, bits2bytes(_len), LIBXSVF_MEM_XSVF_IR_DATA); \
+		if (!buf_ir_data) {                                         \
+			LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed."); \
+			goto error;                                         \
+		}                                                           \
+		buf_ir_bytes = bits2bytes(_len);                            \
+	}                                                                   \
+} while (0)
+
 		switch (cmd)
 		{
 		case XCOMPLETE: {
@@ -271,9 +297,9 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 			//int length = READ_BYTE();
 			int length;
 			READ_BYTE2(length);
-			unsigned char buf[100000/*bits2bytes(length)*/];
-			READ_BITS(buf, length);
-			SHIFT_DATA(buf, (void*)0, (void*)0, length, LIBXSVF_TAP_IRSHIFT,
+			IR_BUFFER(length);
+			READ_BITS(buf_ir_data, length);
+			SHIFT_DATA(buf_ir_data, (void*)0, (void*)0, length, LIBXSVF_TAP_IRSHIFT,
 					state_xendir ? LIBXSVF_TAP_IRPAUSE : LIBXSVF_TAP_IDLE,
 					state_runtest, state_retries);
 			break;
@@ -302,14 +328,19 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 			STATUS(XSDRSIZE);
 			//state_dr_size = READ_LONG();
 			READ_LONG2(state_dr_size);
-			buf_tdi_data = LIBXSVF_HOST_REALLOC(buf_tdi_data, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_TDI_DATA);
-			buf_tdo_data = LIBXSVF_HOST_REALLOC(buf_tdo_data, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_TDO_DATA);
-			buf_tdo_mask = LIBXSVF_HOST_REALLOC(buf_tdo_mask, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_TDO_MASK);
-			buf_addr_mask = LIBXSVF_HOST_REALLOC(buf_addr_mask, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_ADDR_MASK);
-			buf_data_mask = LIBXSVF_HOST_REALLOC(buf_data_mask, bits2bytes(state_dr_size), LIBXSVF_MEM_XSVF_DATA_MASK);
-			if (!buf_tdi_data || !buf_tdo_data || !buf_tdo_mask || !buf_addr_mask || !buf_data_mask) {
-				LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
-				goto error;
+			/* The buffers only grow, so a smaller size reuses them */
+			int bytes = bits2bytes(state_dr_size);
+			if (bytes > buf_dr_bytes) {
+				buf_tdi_data = LIBXSVF_HOST_REALLOC(buf_tdi_data, bytes, LIBXSVF_MEM_XSVF_TDI_DATA);
+				buf_tdo_data = LIBXSVF_HOST_REALLOC(buf_tdo_data, bytes, LIBXSVF_MEM_XSVF_TDO_DATA);
+				buf_tdo_mask = LIBXSVF_HOST_REALLOC(buf_tdo_mask, bytes, LIBXSVF_MEM_XSVF_TDO_MASK);
+				buf_addr_mask = LIBXSVF_HOST_REALLOC(buf_addr_mask, bytes, LIBXSVF_MEM_XSVF_ADDR_MASK);
+				buf_data_mask = LIBXSVF_HOST_REALLOC(buf_data_mask, bytes, LIBXSVF_MEM_XSVF_DATA_MASK);
+				if (!buf_tdi_data || !buf_tdo_data || !buf_tdo_mask || !buf_addr_mask || !buf_data_mask) {
+					LIBXSVF_HOST_REPORT_ERROR("Allocating memory failed.");
+					goto error;
+				}
+				buf_dr_bytes = bytes;
 			}
 			break;
 		  }
@@ -440,9 +471,9 @@ int libxsvf_xsvf(struct libxsvf_host *h)
 			int length_temp;
 			READ_BYTE2(length_temp);
 			length = length << 8 | length_temp;
-			unsigned char buf[100000/*bits2bytes(length)*/];
-			READ_BITS(buf, length);
-			SHIFT_DATA(buf, (void*)0, (void*)0, length, LIBXSVF_TAP_IRSHIFT,
+			IR_BUFFER(length);
+			READ_BITS(buf_ir_data, length);
+			SHIFT_DATA(buf_ir_data, (void*)0, (void*)0, length, LIBXSVF_TAP_IRSHIFT,
 					state_xendir ? LIBXSVF_TAP_IRPAUSE : LIBXSVF_TAP_IDLE,
 					state_runtest, state_retries);
 			break;
@@ -503,6 +534,7 @@ got_complete_command:
 	LIBXSVF_HOST_REALLOC(buf_tdo_mask, 0, LIBXSVF_MEM_XSVF_TDO_MASK);
 	LIBXSVF_HOST_REALLOC(buf_addr_mask, 0, LIBXSVF_MEM_XSVF_ADDR_MASK);
 	LIBXSVF_HOST_REALLOC(buf_data_mask, 0, LIBXSVF_MEM_XSVF_DATA_MASK);
+	LIBXSVF_HOST_REALLOC(buf_ir_data, 0, LIBXSVF_MEM_XSVF_IR_DATA);
 
 	return rc;
 }